@@ -25,7 +25,7 @@ bool seqNumLT(u_int16_t s1, u_int16_t s2)
 	}
 }
 
-static void decodeURL(char* url) 
+void decodeURL(char* url) 
 {
 	// Replace (in place) any %<hex><hex> sequences with the appropriate 8-bit character.
 	char* cursor = url;
@@ -50,167 +50,199 @@ static void decodeURL(char* url)
 	*url = '\0';
 }
 
-bool parseRTSPRequestString(char const* reqStr,
-							unsigned reqStrSize,
-							char* resultCmdName,
-							unsigned resultCmdNameMaxSize,
-							char* resultURLPreSuffix,
-							unsigned resultURLPreSuffixMaxSize,
-							char* resultURLSuffix,
-							unsigned resultURLSuffixMaxSize,
-							char* resultCSeq,
-							unsigned resultCSeqMaxSize,
-							char* resultSessionIdStr,
-							unsigned resultSessionIdStrMaxSize,
-							unsigned& contentLength) 
+bool RTSPField::equals(char const* s) const
 {
-	// This parser is currently rather dumb; it should be made smarter #####
+	return strlen(s) == len && memcmp(str, s, len) == 0;
+}
 
-	// "Be liberal in what you accept": Skip over any whitespace at the start of the request:
-	unsigned i;
-	for (i = 0; i < reqStrSize; ++i) {
-		char c = reqStr[i];
-		if (!(c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\0')) break;
-	}
-	if (i == reqStrSize) return false; // The request consisted of nothing but whitespace!
-
-	// Then read everything up to the next space (or tab) as the command name:
-	bool parseSucceeded = false;
-	unsigned i1 = 0;
-	for (; i1 < resultCmdNameMaxSize-1 && i < reqStrSize; ++i,++i1) {
-		char c = reqStr[i];
-		if (c == ' ' || c == '\t') {
-			parseSucceeded = true;
-			break;
-		}
+bool RTSPField::equalsNoCase(char const* s) const
+{
+	return strlen(s) == len && _strcasecmp(str, s, len) == 0;
+}
 
-		resultCmdName[i1] = c;
+bool RTSPField::startsWith(char const* prefix) const
+{
+	unsigned prefixLen = strlen(prefix);
+	return len >= prefixLen && memcmp(str, prefix, prefixLen) == 0;
+}
+
+unsigned RTSPField::copyTo(char* buf, unsigned bufSize) const
+{
+	unsigned n = len < bufSize-1 ? len : bufSize-1;
+	memcpy(buf, str, n);
+	buf[n] = '\0';
+	return n;
+}
+
+static RTSPField const emptyField = { "", 0 };
+
+static bool isSpaceOrTab(char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+RTSPRequestParser::RTSPRequestParser()
+{
+	reset();
+}
+
+void RTSPRequestParser::reset()
+{
+	fBase = NULL;
+	fScanned = fLineStart = 0;
+	fSawRequestLine = fSawCSeq = false;
+	fHeaderSize = 0;
+	fValid = false;
+
+	fMethod = fURLPreSuffix = fURLSuffix = fCSeq = fSessionId = emptyField;
+	fContentLength = 0;
+	fNumHeaders = 0;
+}
+
+static void rebaseField(RTSPField& field, char const* oldBase, char const* newBase)
+{
+	if (field.len > 0) field.str = newBase + (field.str - oldBase);
+}
+
+void RTSPRequestParser::rebase(char const* buf)
+{
+	// The request was moved (but not changed) since we last saw it, so make our fields follow it:
+	rebaseField(fMethod, fBase, buf);
+	rebaseField(fURLPreSuffix, fBase, buf);
+	rebaseField(fURLSuffix, fBase, buf);
+	rebaseField(fCSeq, fBase, buf);
+	rebaseField(fSessionId, fBase, buf);
+	for (unsigned i = 0; i < fNumHeaders; i++) {
+		rebaseField(fHeaderNames[i], fBase, buf);
+		rebaseField(fHeaderValues[i], fBase, buf);
 	}
-	resultCmdName[i1] = '\0';
-	if (!parseSucceeded) return false;
-
-	// Skip over the prefix of any "rtsp://" or "rtsp:/" URL that follows:
-	unsigned j = i+1;
-	while (j < reqStrSize && (reqStr[j] == ' ' || reqStr[j] == '\t')) ++j; // skip over any additional white space
-	for (; (int)j < (int)(reqStrSize-8); ++j) {
-		if ((reqStr[j] == 'r' || reqStr[j] == 'R')
-			&& (reqStr[j+1] == 't' || reqStr[j+1] == 'T')
-			&& (reqStr[j+2] == 's' || reqStr[j+2] == 'S')
-			&& (reqStr[j+3] == 'p' || reqStr[j+3] == 'P')
-			&& reqStr[j+4] == ':' && reqStr[j+5] == '/') 
-		{
-			j += 6;
-			if (reqStr[j] == '/') {
-				// This is a "rtsp://" URL; skip over the host:port part that follows:
-				++j;
-				while (j < reqStrSize && reqStr[j] != '/' && reqStr[j] != ' ') ++j;
-			} else {
-				// This is a "rtsp:/" URL; back up to the "/":
-				--j;
-			}
-			i = j;
-			break;
+}
+
+int RTSPRequestParser::parse(char const* buf, unsigned len)
+{
+	if (fBase != NULL && buf != fBase) rebase(buf);
+	fBase = buf;
+
+	if (fHeaderSize > 0) return fHeaderSize; // (we're waiting for the request's body)
+
+	// Handle each line as soon as we have all of it; the bytes after the last one are looked at again only once more arrive:
+	for (; fScanned < len; ++fScanned) {
+		if (buf[fScanned] != '\n') continue;
+
+		char const* line = &buf[fLineStart];
+		unsigned lineLen = fScanned - fLineStart;
+		if (lineLen > 0 && line[lineLen-1] == '\r') --lineLen; // (we also accept '\n' by itself)
+		fLineStart = fScanned+1;
+
+		if (!fSawRequestLine) {
+			if (lineLen == 0) continue; // "Be liberal in what you accept": skip over any empty lines before the request
+			parseRequestLine(line, lineLen);
+			fSawRequestLine = true;
+		} else if (lineLen > 0) {
+			parseHeaderLine(line, lineLen);
+		} else {
+			// The empty line ends the header:
+			fScanned = fLineStart;
+			fHeaderSize = fLineStart;
+			fValid = fValid && fSawCSeq;
+			return fHeaderSize;
 		}
 	}
 
-	// Look for the URL suffix (before the following "RTSP/"):
-	parseSucceeded = false;
-	for (unsigned k = i+1; (int)k < (int)(reqStrSize-5); ++k) {
-		if (reqStr[k] == 'R' && reqStr[k+1] == 'T' &&
-			reqStr[k+2] == 'S' && reqStr[k+3] == 'P' && reqStr[k+4] == '/') 
-		{
-			while (--k >= i && reqStr[k] == ' ') {} // go back over all spaces before "RTSP/"
-			unsigned k1 = k;
-			while (k1 > i && reqStr[k1] != '/') --k1;
-
-			// ASSERT: At this point
-			//   i: first space or slash after "host" or "host:port"
-			//   k: last non-space before "RTSP/"
-			//   k1: last slash in the range [i,k]
-
-			// The URL suffix comes from [k1+1,k]
-			// Copy "resultURLSuffix":
-			unsigned n = 0, k2 = k1+1;
-			if (k2 <= k) {
-				if (k - k1 + 1 > resultURLSuffixMaxSize) return false; // there's no room
-				while (k2 <= k) resultURLSuffix[n++] = reqStr[k2++];
-			}
-			resultURLSuffix[n] = '\0';
-
-			// The URL 'pre-suffix' comes from [i+1,k1-1]
-			// Copy "resultURLPreSuffix":
-			n = 0; k2 = i+1;
-			if (k2+1 <= k1) {
-				if (k1 - i > resultURLPreSuffixMaxSize) return false; // there's no room
-				while (k2 <= k1-1) resultURLPreSuffix[n++] = reqStr[k2++];
-			}
-			resultURLPreSuffix[n] = '\0';
-			decodeURL(resultURLPreSuffix);
+	return 0;
+}
 
-			i = k + 7; // to go past " RTSP/"
-			parseSucceeded = true;
-			break;
+void RTSPRequestParser::parseRequestLine(char const* line, unsigned len)
+{
+	// The command name comes first, up to a space (or tab):
+	unsigned i = 0;
+	while (i < len && !isSpaceOrTab(line[i])) ++i;
+	if (i == 0 || i == len) return;
+	fMethod.str = line;
+	fMethod.len = i;
+	while (i < len && isSpaceOrTab(line[i])) ++i;
+
+	// The line ends with "RTSP/<version>"; the URL is what lies inbetween:
+	unsigned end = len;
+	while (end > i && isSpaceOrTab(line[end-1])) --end;
+	unsigned k = end;
+	while (k > i && !isSpaceOrTab(line[k-1])) --k;
+	if (end - k < 5 || strncmp(&line[k], "RTSP/", 5) != 0) return;
+	while (k > i && isSpaceOrTab(line[k-1])) --k;
+
+	// Skip over the prefix of any "rtsp://" or "rtsp:/" URL:
+	char const* url = &line[i];
+	unsigned urlLen = k - i;
+	unsigned j = 0;
+	if (urlLen >= 6 && _strcasecmp(url, "rtsp:/", 6) == 0) {
+		j = 6;
+		if (j < urlLen && url[j] == '/') {
+			// This is a "rtsp://" URL; skip over the host:port part that follows (and the '/' after it):
+			++j;
+			while (j < urlLen && url[j] != '/') ++j;
+			if (j < urlLen) ++j;
 		}
 	}
-	if (!parseSucceeded) return false;
-
-	// Look for "CSeq:" (mandatory, case insensitive), skip whitespace,
-	// then read everything up to the next \r or \n as 'CSeq':
-	parseSucceeded = false;
-	for (j = i; (int)j < (int)(reqStrSize-5); ++j) {
-		if (_strcasecmp("CSeq:", &reqStr[j], 5) == 0) {
-			j += 5;
-			while (j < reqStrSize && (reqStr[j] ==  ' ' || reqStr[j] == '\t')) ++j;
-			unsigned n;
-			for (n = 0; n < resultCSeqMaxSize-1 && j < reqStrSize; ++n,++j) {
-				char c = reqStr[j];
-				if (c == '\r' || c == '\n') {
-					parseSucceeded = true;
-					break;
-				}
-
-				resultCSeq[n] = c;
-			}
-			resultCSeq[n] = '\0';
-			break;
-		}
+
+	// The URL suffix comes after the last '/', and the 'pre-suffix' before it:
+	char const* path = &url[j];
+	unsigned pathLen = urlLen - j;
+	unsigned slash = pathLen;
+	while (slash > 0 && path[slash-1] != '/') --slash;
+	fURLPreSuffix.str = path;
+	fURLPreSuffix.len = slash > 0 ? slash-1 : 0;
+	fURLSuffix.str = &path[slash];
+	fURLSuffix.len = pathLen - slash;
+
+	fValid = true;
+}
+
+void RTSPRequestParser::parseHeaderLine(char const* line, unsigned len)
+{
+	if (isSpaceOrTab(line[0])) return; // (we don't use folded header lines)
+
+	unsigned colon = 0;
+	while (colon < len && line[colon] != ':') ++colon;
+	if (colon == len) return; // not a header
+
+	RTSPField name, value;
+	name.str = line;
+	name.len = colon;
+	while (name.len > 0 && isSpaceOrTab(name.str[name.len-1])) --name.len;
+
+	unsigned i = colon+1;
+	while (i < len && isSpaceOrTab(line[i])) ++i;
+	value.str = &line[i];
+	value.len = len - i;
+	while (value.len > 0 && isSpaceOrTab(value.str[value.len-1])) --value.len;
+
+	// The headers that every request needs are picked out as we go:
+	if (name.equalsNoCase("CSeq")) {
+		if (!fSawCSeq) fCSeq = value;
+		fSawCSeq = true;
+	} else if (name.equalsNoCase("Session")) {
+		if (fSessionId.len == 0) fSessionId = value;
+	} else if (name.equalsNoCase("Content-Length")) {
+		unsigned n = 0;
+		for (unsigned k = 0; k < value.len && value.str[k] >= '0' && value.str[k] <= '9' && n < 0x10000000; k++)
+			n = n*10 + (value.str[k]-'0');
+		fContentLength = n;
 	}
-	if (!parseSucceeded) return false;
-
-	// Look for "Session:" (optional, case insensitive), skip whitespace,
-	// then read everything up to the next \r or \n as 'Session':
-	resultSessionIdStr[0] = '\0'; // default value (empty string)
-	for (j = i; (int)j < (int)(reqStrSize-8); ++j) {
-		if (_strcasecmp("Session:", &reqStr[j], 8) == 0) {
-			j += 8;
-			while (j < reqStrSize && (reqStr[j] ==  ' ' || reqStr[j] == '\t')) ++j;
-			unsigned n;
-			for (n = 0; n < resultSessionIdStrMaxSize-1 && j < reqStrSize; ++n,++j) {
-				char c = reqStr[j];
-				if (c == '\r' || c == '\n') {
-					break;
-				}
-
-				resultSessionIdStr[n] = c;
-			}
-			resultSessionIdStr[n] = '\0';
-			break;
-		}
+
+	if (fNumHeaders < RTSP_MAX_HEADERS) {
+		fHeaderNames[fNumHeaders] = name;
+		fHeaderValues[fNumHeaders] = value;
+		fNumHeaders++;
 	}
+}
 
-	// Also: Look for "Content-Length:" (optional, case insensitive)
-	contentLength = 0; // default value
-	for (j = i; (int)j < (int)(reqStrSize-15); ++j) {
-		if (_strcasecmp("Content-Length:", &(reqStr[j]), 15) == 0) {
-			j += 15;
-			while (j < reqStrSize && (reqStr[j] ==  ' ' || reqStr[j] == '\t')) ++j;
-			unsigned num;
-			if (sscanf(&reqStr[j], "%u", &num) == 1) {
-				contentLength = num;
-			}
-		}
+RTSPField const* RTSPRequestParser::header(char const* name) const
+{
+	for (unsigned i = 0; i < fNumHeaders; i++) {
+		if (fHeaderNames[i].equalsNoCase(name))
+			return &fHeaderValues[i];
 	}
-	return true;
+	return NULL;
 }
 
 bool parseRangeParam(char const* paramStr,
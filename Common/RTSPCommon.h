@@ -56,18 +56,74 @@ bool seqNumLT(u_int16_t s1, u_int16_t s2);
 
 #define RTSP_PARAM_STRING_MAX 200
 
-bool parseRTSPRequestString(char const *reqStr, unsigned reqStrSize,
-							char *resultCmdName,
-							unsigned resultCmdNameMaxSize,
-							char* resultURLPreSuffix,
-							unsigned resultURLPreSuffixMaxSize,
-							char* resultURLSuffix,
-							unsigned resultURLSuffixMaxSize,
-							char* resultCSeq,
-							unsigned resultCSeqMaxSize,
-							char* resultSessionId,
-							unsigned resultSessionIdMaxSize,
-							unsigned& contentLength);
+#define RTSP_MAX_HEADERS	32
+
+// A piece of a RTSP message, pointing into the buffer that the message was received in.
+// (It is not '\0'-terminated.)
+struct RTSPField
+{
+	char const*	str;
+	unsigned	len;
+
+	bool equals(char const* s) const;
+	bool equalsNoCase(char const* s) const;
+	bool startsWith(char const* prefix) const;
+	unsigned copyTo(char* buf, unsigned bufSize) const; // '\0'-terminated; cut off if it doesn't fit
+};
+
+// Parses a RTSP request in one pass over its bytes, as they arrive.
+// The results point into the request buffer; nothing is copied.
+class RTSPRequestParser
+{
+public:
+	RTSPRequestParser();
+
+	void reset(); // before the next request
+
+	int parse(char const* buf, unsigned len);
+	// "buf" holds the request received so far; it may have moved since the last call (but the bytes given then are unchanged).
+	// Returns the size of the request header (up to and including the empty line that ends it) once it is complete,
+	// or 0 if more data is needed - the next call resumes where this one stopped.
+	bool isValid() const { return fValid; } // whether the complete header had a request line and a "CSeq:"
+
+	RTSPField const& method() const { return fMethod; }
+	RTSPField const& urlPreSuffix() const { return fURLPreSuffix; } // between "rtsp://host[:port]/" and the last '/' (still %-encoded)
+	RTSPField const& urlSuffix() const { return fURLSuffix; } // after the last '/'
+	RTSPField const& cseq() const { return fCSeq; }
+	RTSPField const& sessionId() const { return fSessionId; }
+	unsigned contentLength() const { return fContentLength; }
+
+	RTSPField const* header(char const* name) const;
+	// the value of the header "name" (case insensitive, without the ':'), or NULL if there is none
+	// (only the first RTSP_MAX_HEADERS headers are kept)
+
+private:
+	void parseRequestLine(char const* line, unsigned len);
+	void parseHeaderLine(char const* line, unsigned len);
+	void rebase(char const* buf);
+
+private:
+	char const*	fBase;			// "buf" of the last call
+	unsigned	fScanned;		// bytes of the request looked at so far
+	unsigned	fLineStart;
+	bool		fSawRequestLine;
+	bool		fSawCSeq;
+	int			fHeaderSize;	// once the header is complete
+	bool		fValid;
+
+	RTSPField	fMethod;
+	RTSPField	fURLPreSuffix;
+	RTSPField	fURLSuffix;
+	RTSPField	fCSeq;
+	RTSPField	fSessionId;
+	unsigned	fContentLength;
+
+	unsigned	fNumHeaders;
+	RTSPField	fHeaderNames[RTSP_MAX_HEADERS];
+	RTSPField	fHeaderValues[RTSP_MAX_HEADERS];
+};
+
+void decodeURL(char* url); // replaces (in place) any %<hex><hex> sequences with the character they stand for
 
 bool parseRangeParam(char const* paramStr, double& rangeStart, double& rangeEnd, char*& absStartTime, char*& absEndTime, bool& startTimeIsNow);
 bool parseRangeHeader(char const* buf, double& rangeStart, double& rangeEnd, char*& absStartTime, char*& absEndTime, bool& startTimeIsNow);
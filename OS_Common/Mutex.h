@@ -7,11 +7,20 @@
 
 #define MUTEX	HANDLE
 #define PTHREAD_MUTEX_INITIALIZER	CreateMutex(NULL, FALSE, NULL)
+
+#define ATOMIC_INC(ptr)		InterlockedIncrement((LONG volatile *)(ptr))
+#define ATOMIC_DEC(ptr)		InterlockedDecrement((LONG volatile *)(ptr))
+#define MEMORY_BARRIER()	MemoryBarrier()
 #else
 #include <pthread.h>
 
 #define MUTEX	pthread_mutex_t
+
+#define ATOMIC_INC(ptr)		__sync_add_and_fetch((ptr), 1)
+#define ATOMIC_DEC(ptr)		__sync_sub_and_fetch((ptr), 1)
+#define MEMORY_BARRIER()	__sync_synchronize()
 #endif
+// (ATOMIC_INC/ATOMIC_DEC return the new value)
 
 int MUTEX_INIT(MUTEX *mutex);
 int MUTEX_LOCK(MUTEX *mutex);
@@ -33,6 +33,7 @@ void BitVector::setup(unsigned char* baseBytePtr,
   fBaseBitOffset = baseBitOffset;
   fTotNumBits = totNumBits;
   fCurBitIndex = 0;
+  invalidateCache();
 }
 
 static unsigned char const singleBitMask[8]
@@ -43,6 +44,8 @@ static unsigned char const singleBitMask[8]
 void BitVector::putBits(unsigned from, unsigned numBits) {
   if (numBits == 0) return; 
 
+  invalidateCache(); // because we're about to change the bits that it holds
+
   unsigned char tmpBuf[4];
   unsigned overflowingBits = 0;
 
@@ -70,6 +73,7 @@ void BitVector::put1Bit(unsigned bit) {
   if (fCurBitIndex >= fTotNumBits) { /* overflow */
     return;
   } else {
+    invalidateCache();
     unsigned totBitOffset = fBaseBitOffset + fCurBitIndex++;
     unsigned char mask = singleBitMask[totBitOffset%8];
     if (bit) {
@@ -80,65 +84,140 @@ void BitVector::put1Bit(unsigned bit) {
   }
 }
 
+static inline uint64_t loadBigEndian64(unsigned char const* p) {
+  // (Compilers turn this into a single load + byte swap.)
+  return ((uint64_t)p[0]<<56) | ((uint64_t)p[1]<<48) | ((uint64_t)p[2]<<40) | ((uint64_t)p[3]<<32)
+    | ((uint64_t)p[4]<<24) | ((uint64_t)p[5]<<16) | ((uint64_t)p[6]<<8) | (uint64_t)p[7];
+}
+
+static inline unsigned countLeadingZeros64(uint64_t x) {
+  // ASSERT: x != 0
+#if defined(__GNUC__)
+  return __builtin_clzll(x);
+#else
+  unsigned n = 0;
+  if ((x & 0xFFFFFFFF00000000ULL) == 0) { n += 32; x <<= 32; }
+  if ((x & 0xFFFF000000000000ULL) == 0) { n += 16; x <<= 16; }
+  if ((x & 0xFF00000000000000ULL) == 0) { n += 8; x <<= 8; }
+  if ((x & 0xF000000000000000ULL) == 0) { n += 4; x <<= 4; }
+  if ((x & 0xC000000000000000ULL) == 0) { n += 2; x <<= 2; }
+  if ((x & 0x8000000000000000ULL) == 0) { n += 1; }
+  return n;
+#endif
+}
+
+void BitVector::refillCache() {
+  // Reload the cache, starting at the current bit position.  We never read past the
+  // last byte that contains any of our bits:
+  unsigned numBitsRemaining = fTotNumBits - fCurBitIndex;
+  if (numBitsRemaining == 0) {
+    invalidateCache();
+    return;
+  }
+
+  unsigned totBitOffset = fBaseBitOffset + fCurBitIndex;
+  unsigned char const* fromBytePtr = &fBaseBytePtr[totBitOffset/8];
+  unsigned fromBitRem = totBitOffset%8;
+  unsigned numBytesAvail = (fBaseBitOffset + fTotNumBits + 7)/8 - totBitOffset/8;
+
+  uint64_t word;
+  if (numBytesAvail >= 8) {
+    word = loadBigEndian64(fromBytePtr);
+    numBytesAvail = 8;
+  } else {
+    word = 0;
+    for (unsigned i = 0; i < numBytesAvail; ++i) {
+      word |= (uint64_t)fromBytePtr[i] << (56 - 8*i);
+    }
+  }
+
+  fCache = word << fromBitRem;
+  fCacheBits = 8*numBytesAvail - fromBitRem;
+  if (fCacheBits > numBitsRemaining) fCacheBits = numBitsRemaining;
+  if (fCacheBits < 64) fCache &= ~(~(uint64_t)0 >> fCacheBits); // so any bits past the end are 0
+}
+
 unsigned BitVector::getBits(unsigned numBits) {
   if (numBits == 0) return 0;
 
-  unsigned char tmpBuf[4];
-  unsigned overflowingBits = 0;
-
   if (numBits > MAX_LENGTH) {
     numBits = MAX_LENGTH;
   }
 
-  if (numBits > fTotNumBits - fCurBitIndex) {
-    overflowingBits = numBits - (fTotNumBits - fCurBitIndex);
-  }
+  if (fCacheBits < numBits) refillCache();
 
-  shiftBits(tmpBuf, 0, /* to */
-	    fBaseBytePtr, fBaseBitOffset + fCurBitIndex, /* from */
-	    numBits - overflowingBits /* num bits */);
-  fCurBitIndex += numBits - overflowingBits;
+  // Bits past the end of the vector are 0 in the cache, so any overflowing bits are returned as 0:
+  unsigned result = (unsigned)(fCache >> (64 - numBits));
+
+  unsigned numBitsConsumed = numBits <= fCacheBits ? numBits : fCacheBits;
+  fCache <<= numBitsConsumed;
+  fCacheBits -= numBitsConsumed;
+  fCurBitIndex += numBitsConsumed;
 
-  unsigned result
-    = (tmpBuf[0]<<24) | (tmpBuf[1]<<16) | (tmpBuf[2]<<8) | tmpBuf[3];
-  result >>= (MAX_LENGTH - numBits); // move into low-order part of word
-  result &= (0xFFFFFFFF << overflowingBits); // so any overflow bits are 0
   return result;
 }
 
 unsigned BitVector::get1Bit() {
   // The following is equivalent to "getBits(1)", except faster:
-
-  if (fCurBitIndex >= fTotNumBits) { /* overflow */
-    return 0;
-  } else {
-    unsigned totBitOffset = fBaseBitOffset + fCurBitIndex++;
-    unsigned char curFromByte = fBaseBytePtr[totBitOffset/8];
-    unsigned result = (curFromByte >> (7-(totBitOffset%8))) & 0x01;
-    return result;
+  if (fCacheBits == 0) {
+    refillCache();
+    if (fCacheBits == 0) return 0; /* overflow */
   }
+
+  unsigned result = (unsigned)(fCache >> 63);
+  fCache <<= 1;
+  --fCacheBits;
+  ++fCurBitIndex;
+  return result;
 }
 
 void BitVector::skipBits(unsigned numBits) {
   if (numBits > fTotNumBits - fCurBitIndex) { /* overflow */
     fCurBitIndex = fTotNumBits;
+    invalidateCache();
   } else {
     fCurBitIndex += numBits;
+    if (numBits < fCacheBits) {
+      fCache <<= numBits;
+      fCacheBits -= numBits;
+    } else {
+      invalidateCache();
+    }
   }
 }
 
+void BitVector::skipBytesAligned() {
+  unsigned totBitOffset = fBaseBitOffset + fCurBitIndex;
+  if (totBitOffset%8 != 0) skipBits(8 - totBitOffset%8);
+}
+
 unsigned BitVector::get_expGolomb() {
   unsigned numLeadingZeroBits = 0;
   unsigned codeStart = 1;
 
-  while (get1Bit() == 0 && fCurBitIndex < fTotNumBits) {
-    ++numLeadingZeroBits;
-    codeStart *= 2;
+  if (fCacheBits < MAX_LENGTH) refillCache();
+
+  if (fCache != 0) {
+    // Common case: the terminating '1' bit is already in our cache:
+    numLeadingZeroBits = countLeadingZeros64(fCache);
+    skipBits(numLeadingZeroBits + 1);
+    codeStart = numLeadingZeroBits < MAX_LENGTH ? codeStart << numLeadingZeroBits : 0;
+  } else {
+    while (get1Bit() == 0 && fCurBitIndex < fTotNumBits) {
+      ++numLeadingZeroBits;
+      codeStart *= 2;
+    }
   }
 
   return codeStart - 1 + getBits(numLeadingZeroBits);
 }
 
+int BitVector::get_expGolombSigned() {
+  unsigned codeNum = get_expGolomb();
+
+  if ((codeNum&1) == 0) return -(int)(codeNum/2);
+  return (int)((codeNum+1)/2);
+}
 
 void shiftBits(unsigned char* toBasePtr, unsigned toBitOffset,
 	       unsigned char const* fromBasePtr, unsigned fromBitOffset,
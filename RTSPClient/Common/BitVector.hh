@@ -21,6 +21,8 @@ along with this library; if not, write to the Free Software Foundation, Inc.,
 #ifndef _BIT_VECTOR_HH
 #define _BIT_VECTOR_HH
 
+#include <stdint.h>
+
 class BitVector {
 public:
   BitVector(unsigned char* baseBytePtr,
@@ -39,6 +41,7 @@ public:
   bool get1BitBoolean() { return get1Bit() != 0; }
 
   void skipBits(unsigned numBits);
+  void skipBytesAligned(); // skips to the next byte boundary (if not already on one)
 
   unsigned curBitIndex() const { return fCurBitIndex; }
   unsigned totNumBits() const { return fTotNumBits; }
@@ -46,12 +49,23 @@ public:
 
   unsigned get_expGolomb();
       // Returns the value of the next bits, assuming that they were encoded using an exponential-Golomb code of order 0
+  int get_expGolombSigned();
+      // Like "get_expGolomb()", but for a signed value (i.e., "se(v)" in the H.264/H.265 specs)
+
+private:
+  void refillCache();
+  void invalidateCache() { fCache = 0; fCacheBits = 0; }
 
 private:
   unsigned char* fBaseBytePtr;
   unsigned fBaseBitOffset;
   unsigned fTotNumBits;
   unsigned fCurBitIndex;
+
+  // Read-ahead cache: the bits starting at "fCurBitIndex", left-aligned (the next bit is the MSB).
+  // Only the top "fCacheBits" bits are valid; the rest are always 0.
+  uint64_t fCache;
+  unsigned fCacheBits;
 };
 
 // A general bit copy operation:
@@ -108,7 +108,7 @@ RTCPInstance::RTCPInstance(
     fAveRTCPSize(0), fIsInitial(1), fPrevNumMembers(0),
     fLastSentSize(0), fLastReceivedSize(0), fLastReceivedSSRC(0),
     fTypeOfEvent(EVENT_UNKNOWN), fTypeOfPacket(PACKET_UNKNOWN_TYPE),
-    fHaveJustSentPacket(false), fLastPacketSentSize(0)
+    fHaveJustSentPacket(false), fLastPacketSentSize(0), fFIRSeqNum(0)
 {
 #ifdef DEBUG
 	DPRINTF("RTCPInstance[%p]::RTCPInstance()\n", this);
@@ -520,6 +520,51 @@ void RTCPInstance::sendReport()
 	}
 }
 
+void RTCPInstance::sendKeyframeRequest(u_int32_t mediaSSRC)
+{
+#ifdef DEBUG
+	DPRINTF("sending PLI/FIR for SSRC 0x%08x\n", mediaSSRC);
+#endif
+
+	// Feedback messages go in a compound packet, after the usual report (RFC 4585, 3.1):
+	addRR();
+	addSDES();
+
+	// Ask with both messages, as servers that don't advertise "rtcp-fb" often act on only one of them:
+	addPLI(mediaSSRC);
+	addFIR(mediaSSRC);
+
+	sendBuiltPacket();
+}
+
+void RTCPInstance::addPLI(u_int32_t mediaSSRC)
+{
+	unsigned rtcpHdr = 0x80000000; // version 2, no padding
+	rtcpHdr |= (RTCP_PSFB_PLI<<24);
+	rtcpHdr |= (RTCP_PT_PSFB<<16);
+	rtcpHdr |= 2; // sender and media SSRCs; no FCI
+	fOutBuf->enqueueWord(rtcpHdr);
+
+	fOutBuf->enqueueWord(fSource->SSRC());
+	fOutBuf->enqueueWord(mediaSSRC);
+}
+
+void RTCPInstance::addFIR(u_int32_t mediaSSRC)
+{
+	unsigned rtcpHdr = 0x80000000; // version 2, no padding
+	rtcpHdr |= (RTCP_PSFB_FIR<<24);
+	rtcpHdr |= (RTCP_PT_PSFB<<16);
+	rtcpHdr |= 4; // sender and media SSRCs, plus one FCI entry
+	fOutBuf->enqueueWord(rtcpHdr);
+
+	fOutBuf->enqueueWord(fSource->SSRC());
+	fOutBuf->enqueueWord(0); // the media source is given in the FCI instead (RFC 5104, 4.3.1.2)
+
+	// FCI: the SSRC, and a sequence number that is new for each request:
+	fOutBuf->enqueueWord(mediaSSRC);
+	fOutBuf->enqueueWord((unsigned)(fFIRSeqNum++)<<24);
+}
+
 void RTCPInstance::sendBuiltPacket() 
 {
 #ifdef DEBUG
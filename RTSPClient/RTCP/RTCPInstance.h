@@ -33,12 +33,17 @@ public:
 
 	static void onExpire(RTCPInstance* instance);
 
+	void sendKeyframeRequest(u_int32_t mediaSSRC);
+	// Sends a PLI (RFC 4585) and a FIR (RFC 5104) for the media source "mediaSSRC", after a report.
+
 private:
 	void addRR();
 	void enqueueCommonReportPrefix(unsigned char packetType, u_int32_t SSRC, unsigned numExtraWords = 0);
     void enqueueCommonReportSuffix();
     void enqueueReportBlock(RTPReceptionStats* receptionStats);
 	void addSDES();
+	void addPLI(u_int32_t mediaSSRC);
+	void addFIR(u_int32_t mediaSSRC);
 
 	void sendBuiltPacket();
 
@@ -67,6 +72,7 @@ private:
 	int fTypeOfPacket;
 	bool fHaveJustSentPacket;
 	unsigned fLastPacketSentSize;
+	unsigned char fFIRSeqNum;
 
 public:	// because this stuff is used by an external "C" function
 	void sendReport();
@@ -85,6 +91,12 @@ const unsigned char RTCP_PT_RR = 201;
 const unsigned char RTCP_PT_SDES = 202;
 const unsigned char RTCP_PT_BYE = 203;
 const unsigned char RTCP_PT_APP = 204;
+const unsigned char RTCP_PT_RTPFB = 205;
+const unsigned char RTCP_PT_PSFB = 206;
+
+// payload-specific feedback message types (FMT):
+const unsigned char RTCP_PSFB_PLI = 1;
+const unsigned char RTCP_PSFB_FIR = 4;
 
 // SDES tags:
 const unsigned char RTCP_SDES_END = 0;
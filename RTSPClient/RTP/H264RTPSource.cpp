@@ -5,13 +5,44 @@
 #include "RTSPCommonEnv.h"
 
 H264RTPSource::H264RTPSource(int connType, MediaSubsession &subsession, TaskScheduler &task)
-: RTPSource(connType, subsession, task)
+: RTPSource(connType, subsession, task), fHaveParamSetTimestamp(false), fParamSetTimestamp(0), fInFragments(false)
 {
+	for (int i = 0; i < NUM_PARAM_SETS; i++) {
+		fParamSet[i] = NULL;
+		fParamSetSize[i] = fParamSetBufSize[i] = 0;
+	}
+
 	parseSpropParameterSets((char *)subsession.fmtp_spropparametersets());
 }
 
 H264RTPSource::~H264RTPSource()
 {
+	for (int i = 0; i < NUM_PARAM_SETS; i++)
+		DELETE_ARRAY(fParamSet[i]);
+}
+
+bool H264RTPSource::keepFragment(bool startBit, bool endBit, bool isKeyframe)
+{
+	// The start fragment decides for the whole NAL unit; the others are kept only if it was:
+	if (startBit) {
+		dropUnfinishedFragments();	// (the end of the one before was lost)
+		fInFragments = isKeyframe;
+	} else if (fPacketLossPreceded) {
+		dropUnfinishedFragments();	// (the start of this one, or more of it, was lost)
+	}
+
+	bool keep = fInFragments;
+	if (endBit)
+		fInFragments = false;
+	return keep;
+}
+
+void H264RTPSource::dropUnfinishedFragments()
+{
+	if (fInFragments) {
+		resetFrameBuf();
+		fInFragments = false;
+	}
 }
 
 void H264RTPSource::putStartCode()
@@ -22,6 +53,67 @@ void H264RTPSource::putStartCode()
 	fFrameBuf[fFrameBufPos++] = 0x01;
 }
 
+void H264RTPSource::saveParameterSet(int index, uint8_t *nal, unsigned len, uint32_t timestamp)
+{
+	if (!fInjectParameterSets)
+		return;
+
+	// This access unit carries its own parameter sets, so its keyframe doesn't get them injected:
+	fHaveParamSetTimestamp = true;
+	fParamSetTimestamp = timestamp;
+
+	if (len == 0)
+		return;
+
+	if (len > fParamSetBufSize[index]) {
+		DELETE_ARRAY(fParamSet[index]);
+		fParamSet[index] = new uint8_t[len];
+		fParamSetBufSize[index] = len;
+	}
+
+	memcpy(fParamSet[index], nal, len);
+	fParamSetSize[index] = len;
+}
+
+void H264RTPSource::injectParameterSets(uint32_t timestamp)
+{
+	if (!fInjectParameterSets)
+		return;
+
+	// Once per access unit (only the first slice of a keyframe gets them):
+	if (fHaveParamSetTimestamp && timestamp == fParamSetTimestamp)
+		return;
+
+	fHaveParamSetTimestamp = true;
+	fParamSetTimestamp = timestamp;
+
+	// The parameter sets ("sprop-parameter-sets", at the start) already precede this NAL unit in the frame buffer:
+	if (fFrameBufPos > 0)
+		return;
+
+	bool injected = false;
+	for (int i = 0; i < NUM_PARAM_SETS; i++) {
+		if (fParamSetSize[i] > 0) {
+			putStartCode();
+			copyToFrameBuffer(fParamSet[i], fParamSetSize[i]);
+			injected = true;
+		}
+	}
+
+	// No in-band parameter sets yet; use the ones from "sprop-parameter-sets" instead:
+	if (!injected && fExtraData) {
+		putStartCode();
+		int offset = trimStartCode(fExtraData, fExtraDataSize);
+		copyToFrameBuffer(&fExtraData[offset], fExtraDataSize - offset);
+	}
+}
+
+bool H264RTPSource::isKeyframeNalUnit(uint8_t nalUnitType)
+{
+	// IDR-Picture, SPS, PPS
+	return nalUnitType == 5 || nalUnitType == 7 || nalUnitType == 8;
+}
+
 void H264RTPSource::processFrame(RTPPacketBuffer *packet)
 {
 	uint8_t *buf = (uint8_t *)packet->payload();
@@ -41,6 +133,17 @@ void H264RTPSource::processFrame(RTPPacketBuffer *packet)
 	if (RTSPCommonEnv::nDebugFlag&DEBUG_FLAG_RTP_PAYLOAD)
 		DPRINTF("nal_type: %d, size: %d\n", nalUnitType, len);
 
+	if (fKeyframeOnly) {
+		if (nalUnitType == 28) {	// FU-A
+			if (!keepFragment(buf[1]&0x80, buf[1]&0x40, isKeyframeNalUnit(buf[1]&0x1F)))
+				return;
+		} else {
+			dropUnfinishedFragments();
+			if (nalUnitType != 24 && !isKeyframeNalUnit(nalUnitType))
+				return;
+		}
+	}
+
 	if (!fIsStartFrame) {
 		if (fExtraData) {
 			putStartCode();
@@ -57,6 +160,9 @@ void H264RTPSource::processFrame(RTPPacketBuffer *packet)
 		uint8_t endBit = buf[1]&0x40;
 
 		if (startBit) {
+			if ((buf[1]&0x1F) == 5)
+				injectParameterSets(packet->timestamp());
+
 			buf_ptr++; len--;
 			buf[1] = (buf[0]&0xE0) + (buf[1]&0x1F);
 			putStartCode();
@@ -69,18 +175,21 @@ void H264RTPSource::processFrame(RTPPacketBuffer *packet)
 		break;
 			 }
 	case 5: {	// IDR-Picture
+		injectParameterSets(packet->timestamp());
 		putStartCode();
 		copyToFrameBuffer(buf_ptr, len);
 		isCompleteFrame = true;
 		break;
 			}
 	case 7: {	// SPS
+		saveParameterSet(PARAM_SET_SPS, buf_ptr, len, packet->timestamp());
 		putStartCode();
 		copyToFrameBuffer(buf_ptr, len);
 		isCompleteFrame = false;
 		break;
 			}
 	case 8: {	// PPS
+		saveParameterSet(PARAM_SET_PPS, buf_ptr, len, packet->timestamp());
 		putStartCode();
 		copyToFrameBuffer(buf_ptr, len);
 		isCompleteFrame = false;
@@ -99,6 +208,18 @@ void H264RTPSource::processFrame(RTPPacketBuffer *packet)
 			buf_ptr += 2; len -= 2;
 			nalUnitType = buf_ptr[0]&0x1F;
 
+			if (fKeyframeOnly && !isKeyframeNalUnit(nalUnitType)) {
+				buf_ptr += staplen; len -= staplen;
+				continue;
+			}
+
+			if (nalUnitType == 7)
+				saveParameterSet(PARAM_SET_SPS, buf_ptr, staplen, packet->timestamp());
+			else if (nalUnitType == 8)
+				saveParameterSet(PARAM_SET_PPS, buf_ptr, staplen, packet->timestamp());
+			else if (nalUnitType == 5)
+				injectParameterSets(packet->timestamp());
+
 			putStartCode();
 			copyToFrameBuffer(buf_ptr, staplen);
 
@@ -14,6 +14,26 @@ protected:
 
 	void putStartCode();
 	int parseSpropParameterSets(char *spropParameterSets);	
+
+	enum { PARAM_SET_VPS, PARAM_SET_SPS, PARAM_SET_PPS, NUM_PARAM_SETS };
+	void saveParameterSet(int index, uint8_t *nal, unsigned len, uint32_t timestamp);
+	void injectParameterSets(uint32_t timestamp);
+
+	static bool isKeyframeNalUnit(uint8_t nalUnitType);
+
+	// keyframe-only mode: whether to keep a fragment of a FU, and dropping a kept one that's left unfinished
+	bool keepFragment(bool startBit, bool endBit, bool isKeyframe);
+	void dropUnfinishedFragments();
+
+protected:
+	// latest in-band parameter sets (without start codes), used by "injectParameterSets()"
+	uint8_t*	fParamSet[NUM_PARAM_SETS];
+	unsigned	fParamSetSize[NUM_PARAM_SETS];
+	unsigned	fParamSetBufSize[NUM_PARAM_SETS];
+	bool		fHaveParamSetTimestamp;
+	uint32_t	fParamSetTimestamp;	// of the last access unit that has its parameter sets (in-band or injected)
+
+	bool		fInFragments;	// in keyframe-only mode, a kept FU is being assembled (its end not yet seen)
 };
 
 #endif
@@ -13,6 +13,24 @@ H265RTPSource::~H265RTPSource()
 
 }
 
+bool H265RTPSource::isKeyframeNalUnit(uint8_t nalUnitType)
+{
+	// IRAP (BLA, IDR, CRA), VPS, SPS, PPS
+	return (nalUnitType >= 16 && nalUnitType <= 23) || (nalUnitType >= 32 && nalUnitType <= 34);
+}
+
+void H265RTPSource::handleNalUnit(uint8_t nalUnitType, uint8_t *nal, unsigned len, uint32_t timestamp)
+{
+	if (nalUnitType == 32)			// VPS
+		saveParameterSet(PARAM_SET_VPS, nal, len, timestamp);
+	else if (nalUnitType == 33)		// SPS
+		saveParameterSet(PARAM_SET_SPS, nal, len, timestamp);
+	else if (nalUnitType == 34)		// PPS
+		saveParameterSet(PARAM_SET_PPS, nal, len, timestamp);
+	else if (nalUnitType >= 16 && nalUnitType <= 23)	// IRAP (BLA, IDR, CRA)
+		injectParameterSets(timestamp);
+}
+
 void H265RTPSource::processFrame(RTPPacketBuffer* packet)
 {
 	uint8_t* buf = (uint8_t*)packet->payload();
@@ -29,6 +47,17 @@ void H265RTPSource::processFrame(RTPPacketBuffer* packet)
 	if (RTSPCommonEnv::nDebugFlag & DEBUG_FLAG_RTP_PAYLOAD)
 		DPRINTF("nal_type: %d, size: %d\n", nalUnitType, len);
 
+	if (fKeyframeOnly) {
+		if (nalUnitType == 49) {	// FU
+			if (!keepFragment(headerStart[2] & 0x80, headerStart[2] & 0x40, isKeyframeNalUnit(headerStart[2] & 0x3F)))
+				return;
+		} else {
+			dropUnfinishedFragments();
+			if (nalUnitType != 48 && !isKeyframeNalUnit(nalUnitType))
+				return;
+		}
+	}
+
 	switch (nalUnitType) {
 	case 48: {	// Aggregation Packet (AP)
 		buf_ptr += 2; len -= 2;
@@ -42,6 +71,12 @@ void H265RTPSource::processFrame(RTPPacketBuffer* packet)
 
 			buf_ptr += 2; len -= 2;
 			nalUnitType = (buf_ptr[0] & 0x7E) >> 1;
+			if (fKeyframeOnly && !isKeyframeNalUnit(nalUnitType)) {
+				buf_ptr += nalUSize; len -= nalUSize;
+				continue;
+			}
+
+			handleNalUnit(nalUnitType, buf_ptr, nalUSize, packet->timestamp());
 
 			putStartCode();
 			copyToFrameBuffer(buf_ptr, nalUSize);
@@ -58,6 +93,8 @@ void H265RTPSource::processFrame(RTPPacketBuffer* packet)
 		uint8_t endBit = headerStart[2] & 0x40;
 		if (startBit) {
 			uint8_t nal_unit_type = headerStart[2] & 0x3F;
+			handleNalUnit(nal_unit_type, NULL, 0, packet->timestamp());
+
 			uint8_t newNalHeader[2];
 			newNalHeader[0] = (headerStart[0] & 0x81) | (nal_unit_type << 1);
 			newNalHeader[1] = headerStart[1];
@@ -75,6 +112,7 @@ void H265RTPSource::processFrame(RTPPacketBuffer* packet)
 		isCompleteFrame = (endBit != 0);
 	} break;
 	default: {	// This packet contains one complete NAL unit:
+		handleNalUnit(nalUnitType, buf_ptr, len, packet->timestamp());
 		putStartCode();
 		copyToFrameBuffer(buf_ptr, len);
 		isCompleteFrame = true;
@@ -11,6 +11,9 @@ public:
 
 protected:
 	virtual void processFrame(RTPPacketBuffer* packet);
+
+	static bool isKeyframeNalUnit(uint8_t nalUnitType);
+	void handleNalUnit(uint8_t nalUnitType, uint8_t *nal, unsigned len, uint32_t timestamp);
 };
 
 #endif
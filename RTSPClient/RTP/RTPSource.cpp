@@ -12,7 +12,7 @@ RTPSource::RTPSource(int streamType, MediaSubsession &subsession, TaskScheduler
 : fStreamType(streamType), fRecvBuf(NULL), fRTPPayloadFormat(subsession.rtpPayloadFormat()), fTimestampFrequency(subsession.rtpTimestampFrequency()),
 fSSRC(rand()), fTask(&task), fSvrAddr(0), fRtspSock(NULL), fRtcpChannelId(subsession.rtcpChannelId), fCodecName(NULL),
 fReceptionStatsDB(NULL), fRtcpInstance(NULL),
-fFrameHandlerFunc(NULL), fFrameHandlerFuncData(NULL), fIsStartFrame(false), fBeginFrame(false), fExtraData(NULL), fExtraDataSize(0),
+fFrameHandlerFunc(NULL), fFrameHandlerFuncData(NULL), fIsStartFrame(false), fBeginFrame(false), fInjectParameterSets(false), fKeyframeOnly(false), fPacketLossPreceded(false), fExtraData(NULL), fExtraDataSize(0),
 fRtpHandlerFunc(NULL), fRtpHandlerFuncData(NULL), fRtcpHandlerFunc(NULL), fRtcpHandlerFuncData(NULL), fFrameType(FRAME_TYPE_ETC)
 {
 	fReorderingBuffer = new ReorderingPacketBuffer();
@@ -25,6 +25,11 @@ fRtpHandlerFunc(NULL), fRtpHandlerFuncData(NULL), fRtcpHandlerFunc(NULL), fRtcpH
 	fRtcpInstance = new RTCPInstance(25, (unsigned char const*)cname, this);
 	fLastRtcpSendTime = time(NULL);
 
+	fServerSSRC = 0;
+	fKeyframeRequested = false;
+	fLastKeyframeRequestTime.tv_sec = fLastKeyframeRequestTime.tv_usec = 0;
+	fKeyframeRequestsSent = fKeyframeRequestsSuppressed = 0;
+
 	fCodecName = strDup(subsession.codecName());
 
 	fTrackId = strDup(subsession.controlPath());
@@ -181,6 +186,7 @@ void RTPSource::rtpReadHandler(char *buf, int len, struct sockaddr_in &fromAddre
 		fReceptionStatsDB->noteIncomingPacket(rtpSSRC, seqnum, ts, fTimestampFrequency, true, presentationTime, hasBeenSyncedUsingRTCP, len);
 
 	readSuccess = fReorderingBuffer->storePacket(packet);
+	fServerSSRC = rtpSSRC;
 
 skip:
 	if (!readSuccess)
@@ -189,38 +195,93 @@ skip:
 	processNextPacket();
 
 	fLastTimestamp = ts;
+
+	if (fKeyframeRequested)
+		sendKeyframeRequest();
+}
+
+void RTPSource::requestKeyframe()
+{
+	// One already waiting to be sent will do for this one too:
+	if (fKeyframeRequested)
+		ATOMIC_INC(&fKeyframeRequestsSuppressed);
+	fKeyframeRequested = true;
+}
+
+void RTPSource::sendKeyframeRequest()
+{
+	fKeyframeRequested = false;
+
+	struct timeval timeNow;
+	gettimeofday(&timeNow, NULL);
+
+	if (fKeyframeRequestsSent > 0) {
+		int64_t elapsed = (int64_t)(timeNow.tv_sec - fLastKeyframeRequestTime.tv_sec)*1000
+			+ (timeNow.tv_usec - fLastKeyframeRequestTime.tv_usec)/1000;
+		if (elapsed < KEYFRAME_REQUEST_INTERVAL) {
+			ATOMIC_INC(&fKeyframeRequestsSuppressed);
+			return;
+		}
+	}
+
+	if (fRtcpInstance == NULL || fServerSSRC == 0) return;
+
+	fRtcpInstance->sendKeyframeRequest(fServerSSRC);
+	fLastKeyframeRequestTime = timeNow;
+	fKeyframeRequestsSent++;
+
+	DPRINTF("%s keyframe requested (PLI/FIR to SSRC 0x%08x), sent: %u, suppressed: %u\n",
+		fTrackId, fServerSSRC, fKeyframeRequestsSent, fKeyframeRequestsSuppressed);
 }
 
 void RTPSource::processNextPacket()
 {
+	// Choose the delivery mode once per batch, instead of testing the handlers for every packet:
+	if (fRtpHandlerFunc && fFrameHandlerFunc)
+		deliverCompletedPackets<DELIVER_RTP|DELIVER_FRAME>();
+	else if (fRtpHandlerFunc)
+		deliverCompletedPackets<DELIVER_RTP>();
+	else if (fFrameHandlerFunc)
+		deliverCompletedPackets<DELIVER_FRAME>();
+	else
+		deliverCompletedPackets<0>();
+}
+
+template <int deliveryMode>
+void RTPSource::deliverCompletedPackets()
+{
+	RTPHandlerFunc rtpHandler = fRtpHandlerFunc;
+	void *rtpHandlerData = fRtpHandlerFuncData;
+
 	while (1)
 	{
 		bool packetLossPrecededThis;
 		RTPPacketBuffer *nextPacket = fReorderingBuffer->getNextCompletedPacket(packetLossPrecededThis);
 		if (nextPacket == NULL) break;
 
-		// check sequence number
-		unsigned short seqnum = nextPacket->sequenceNum();
-		if (!nextPacket->isFirstPacket()) {
-			if (fLastSeqNum == 0xFFFF && seqnum == 0) ;
-			else if (fLastSeqNum+1 == seqnum) ;
-			else {
-				DPRINTF("pt: %d, rtp sequence error: %u, prev: %u\n", nextPacket->payloadType(), seqnum, fLastSeqNum);
-			}
-		}
-
-		fLastSeqNum = seqnum;
+		checkSequenceNum(nextPacket);
 
-		if (fRtpHandlerFunc)
-			fRtpHandlerFunc(fRtpHandlerFuncData, fTrackId, (char *)nextPacket->buf(), nextPacket->length());
+		if (deliveryMode&DELIVER_RTP)
+			rtpHandler(rtpHandlerData, fTrackId, (char *)nextPacket->buf(), nextPacket->length());
 
-		if (fFrameHandlerFunc)
+		if (deliveryMode&DELIVER_FRAME) {
+			fPacketLossPreceded = packetLossPrecededThis;
 			processFrame(nextPacket);
+		}
 
 		fReorderingBuffer->releaseUsedPacket(nextPacket);
 	}
 }
 
+void RTPSource::checkSequenceNum(RTPPacketBuffer *packet)
+{
+	unsigned short seqnum = packet->sequenceNum();
+	if (!packet->isFirstPacket() && (unsigned short)(fLastSeqNum+1) != seqnum)
+		DPRINTF("pt: %d, rtp sequence error: %u, prev: %u\n", packet->payloadType(), seqnum, fLastSeqNum);
+
+	fLastSeqNum = seqnum;
+}
+
 void RTPSource::setRtspSock(MySock *rtspSock)
 {
 	fRtspSock = rtspSock;
@@ -11,6 +11,11 @@
 #define FRAME_BUFFER_SIZE	(1024*1024*4)
 
 #define RTCP_SEND_DURATION	(2)
+#define KEYFRAME_REQUEST_INTERVAL	(1000)	// msec; requests closer together than this are sent as one
+
+// delivery modes of the depacketizing loop (see "RTPSource::deliverCompletedPackets()")
+#define DELIVER_RTP		(0x01)	// pass each reordered packet to the RTP handler (e.g. for relaying)
+#define DELIVER_FRAME	(0x02)	// depacketize each reordered packet for the frame handler
 
 typedef enum RTP_FRAME_TYPE { FRAME_TYPE_VIDEO, FRAME_TYPE_AUDIO, FRAME_TYPE_ETC };
 typedef void (*FrameHandlerFunc)(void *arg, RTP_FRAME_TYPE frame_type, int64_t timestamp, uint8_t *buf, int len);
@@ -34,6 +39,8 @@ public:
 
 	RTPReceptionStatsDB& receptionStatsDB() const { return *fReceptionStatsDB; }
 	u_int32_t SSRC() const { return fSSRC; }
+	char const* trackId() const { return fTrackId; }
+	// the same pointer is passed to the RTP/RTCP handlers, so it can be used as a key there
 
 	void setRtspSock(MySock *rtspSock);
 	void setServerPort(uint16_t serverPort);
@@ -42,6 +49,23 @@ public:
 
 	void changeDestination(struct in_addr const& newDestAddr, short newDestPort);
 
+	void requestKeyframe();
+	// Asks the server for a keyframe, with RTCP PLI/FIR (e.g. when a new viewer joins a relayed stream).
+	// It may be called from any thread: the request is sent by the reading thread when the next RTP packet
+	// comes in. A request within KEYFRAME_REQUEST_INTERVAL of the last one sent is dropped, since the
+	// keyframe asked for then will do for it too.
+	unsigned keyframeRequestsSent() const { return fKeyframeRequestsSent; }
+	unsigned keyframeRequestsSuppressed() const { return fKeyframeRequestsSuppressed; }
+
+	void setInjectParameterSets(bool enable) { fInjectParameterSets = enable; }
+	// If set, the latest parameter sets (VPS/SPS/PPS) are prepended to every keyframe (IDR/IRAP)
+	// delivered to the frame handler. (Used only by H.264 and H.265 sources)
+
+	void setKeyframeOnly(bool enable) { fKeyframeOnly = enable; }
+	// If set, only keyframes (IDR/IRAP pictures and parameter sets) are assembled and delivered to
+	// the frame handler; other NAL units are dropped before being copied. RTP/RTCP handlers and
+	// reception stats still see every packet. (Used only by H.264 and H.265 sources)
+
 protected:
 	static void incomingRtpPacketHandler(void*, int);
 	void incomingRtpPacketHandler1();	
@@ -52,6 +76,9 @@ protected:
 	virtual void processFrame(RTPPacketBuffer *packet);
 
 	void processNextPacket();
+	// Drains the reordering buffer, in one of the delivery modes (chosen once for the whole batch)
+	template <int deliveryMode> void deliverCompletedPackets();
+	void checkSequenceNum(RTPPacketBuffer *packet);
 
 protected:
 	void copyToFrameBuffer(uint8_t *buf, int len);
@@ -76,6 +103,9 @@ protected:
 
 	bool		fIsStartFrame;
 	bool		fBeginFrame;
+	bool		fInjectParameterSets;
+	bool		fKeyframeOnly;
+	bool		fPacketLossPreceded;	// packets were lost before the one "processFrame()" is given
 	uint8_t*	fExtraData;
 	unsigned	fExtraDataSize;
 
@@ -83,6 +113,14 @@ protected:
 	RTCPInstance*			fRtcpInstance;
 	uint32_t				fSvrAddr;
 	time_t					fLastRtcpSendTime;
+
+	void sendKeyframeRequest();
+
+	uint32_t				fServerSSRC;	// of the last RTP packet received
+	volatile bool			fKeyframeRequested;
+	struct timeval			fLastKeyframeRequestTime;
+	unsigned				fKeyframeRequestsSent;
+	volatile unsigned		fKeyframeRequestsSuppressed;
 	
 	uint8_t*			fFrameBuf;
 	int					fFrameBufPos;
@@ -13,9 +13,7 @@ RTSPClient::RTSPClient()
 {
 	fCSeq = 0;
 
-	fTCPReadingState = AWAITING_DOLLAR;
-	fNextTCPSource = NULL;
-	fNextTCPSourceType = 0;
+	memset(fChannelTable, 0, sizeof(fChannelTable));
 
 	fResponseBuffer = new char[RECV_BUF_SIZE];
 	fResponseBufferSize = RECV_BUF_SIZE;
@@ -23,6 +21,7 @@ RTSPClient::RTSPClient()
 
 	fRtpBuffer = new char[RECV_BUF_SIZE];
 	fRtpBufferSize = RECV_BUF_SIZE;
+	fRtpBufferIdx = fRtpBufferReadIdx = 0;
 
 	m_nTimeoutSecond = 2;
 
@@ -49,6 +48,9 @@ RTSPClient::RTSPClient()
 
 	fPlayStartTime = fPlayEndTime = 0.0f;
 
+	fInjectParameterSets = false;
+	fKeyframeOnly = false;
+
 	fIsSendGetParam = false;
 	fLastSendGetParam = 0;
 
@@ -97,9 +99,8 @@ void RTSPClient::reset()
 
 	fCSeq = 0;
 
-	fTCPReadingState = AWAITING_DOLLAR;
-	fNextTCPSource = NULL;
-	fNextTCPSourceType = 0;
+	memset(fChannelTable, 0, sizeof(fChannelTable));
+	fRtpBufferIdx = fRtpBufferReadIdx = 0;
 
 	fIsSendGetParam = false;
 	fLastSendGetParam = 0;
@@ -354,213 +355,129 @@ void RTSPClient::tcpReadHandler(void *instance, int)
 
 void RTSPClient::tcpReadHandler1()
 {
-	int result = 0;
-	unsigned char c;
-	struct sockaddr_in fromAddress;
-
-	if (fTCPReadingState != AWAITING_PACKET_DATA && fTCPReadingState != AWAITING_RTSP_MESSAGE) {
-		result = fRtspSock.readSocket1((char *)&c, 1, fromAddress);
-		if (result != 1) {
-			tcpReadError(result);
-			return;
-		}
-	}
-
-	switch (fTCPReadingState)
-	{
-	case AWAITING_DOLLAR: {
-		if (c == '$') {
-			fTCPReadingState = AWAITING_STREAM_CHANNEL_ID;
-		} else {
-			if (fResponseBufferIdx < fResponseBufferSize) {
-				fResponseBuffer[fResponseBufferIdx++] = c;
-
-				if (fResponseBufferIdx >= 4) {
-					if (fResponseBuffer[fResponseBufferIdx-4] == '\r' &&
-						fResponseBuffer[fResponseBufferIdx-3] == '\n' &&
-						fResponseBuffer[fResponseBufferIdx-2] == '\r' &&
-						fResponseBuffer[fResponseBufferIdx-1] == '\n')
-						parseRTSPMessage();
-				}
-			} else {
-				resetResponseBuffer();
-			}
-			return;
-		}
-						  } break;
-	case AWAITING_STREAM_CHANNEL_ID: {
-		if (lookupStreamChannelId(c)) {
-			fStreamChannelId = c;
-			fTCPReadingState = AWAITING_SIZE1;
-
-			if (RTSPCommonEnv::nDebugFlag&DEBUG_FLAG_RTP)
-				DPRINTF("channel id: %d\n", fStreamChannelId);
-		} else {
-			fTCPReadingState = AWAITING_DOLLAR;
-		}
-									 } break;
-	case AWAITING_SIZE1: {
-		fSizeByte1 = c;
-		fTCPReadingState = AWAITING_SIZE2;
-						 } break;
-	case AWAITING_SIZE2: {
-		fTCPReadSize = (fSizeByte1<<8) | c;
-		fTCPReadingState = AWAITING_PACKET_DATA;
-		fRtpBufferIdx = 0;
-
-		if (RTSPCommonEnv::nDebugFlag&DEBUG_FLAG_RTP)
-			DPRINTF("size: %d\n", fTCPReadSize);
-						 } break;
-	case AWAITING_PACKET_DATA: {
-		readRTPOverTCP();
-							   } break;
-	case AWAITING_RTSP_MESSAGE: {
-		readRTSPMessage();
-								} break;
-	}
-}
-
-bool RTSPClient::readRTSPMessage()
-{	
-	int len = fResponseBufferSize - fResponseBufferIdx - 1;
 	struct sockaddr_in fromAddress;
 
-	if (len <= 0) {
-		DPRINTF0("response buffer is full\n");
-		fTCPReadingState = AWAITING_DOLLAR;
-		return false;
+	// Make room for the next read by moving the remaining partial message to the front:
+	if (fRtpBufferSize - fRtpBufferIdx < MAX_INTERLEAVED_FRAME_SIZE && fRtpBufferReadIdx > 0) {
+		int remain = fRtpBufferIdx - fRtpBufferReadIdx;
+		memmove(fRtpBuffer, &fRtpBuffer[fRtpBufferReadIdx], remain);
+		fRtpBufferReadIdx = 0;
+		fRtpBufferIdx = remain;
 	}
 
-	int result = fRtspSock.readSocket1(&fResponseBuffer[fResponseBufferIdx], len, fromAddress);
+	int result = fRtspSock.readSocket1(&fRtpBuffer[fRtpBufferIdx], fRtpBufferSize - fRtpBufferIdx, fromAddress);
 	if (result <= 0) {
 		tcpReadError(result);
-		return false;
+		return;
 	}
-	
-	fResponseBufferIdx += result;
-	fResponseBuffer[fResponseBufferIdx] = 0;
-
-	return parseRTSPMessage();
-}
 
-bool RTSPClient::parseRTSPMessage()
-{
-	char *responseBuffer = fResponseBuffer;
-	char *p = fResponseBuffer;
-	bool haveSeenNonCRLF = false;
-	bool isCompleted = false;
+	fRtpBufferIdx += result;
 
-	for (; p <= fResponseBuffer+fResponseBufferIdx-4; ++p)
+	// Handle every complete interleaved frame and RTSP message that we have now:
+	while (fRtpBufferReadIdx < fRtpBufferIdx)
 	{
-		isCompleted = false;
-		// Check whether we have "\r\n\r\n" (or "\r\r" or "\n\n"):
-		if (*p != '\r' && *p != '\n') {
-			haveSeenNonCRLF = true;
-		} else {
-			if ((*p == '\r' && *(p+1) == '\n' && *(p+2) == '\r' && *(p+3) == '\n')
-				|| (*(p+2) == '\r' && *(p+3) == '\r')
-				|| (*(p+2) == '\n' && *(p+3) == '\n')) 
-			{
-				// Before returning, trim any \r or \n from the start:
-				while (*responseBuffer == '\r' || *responseBuffer == '\n')
-					++responseBuffer;
-
-				if (responseBuffer < p) {
-					// do parse RTSP Message
-					int sz = p+3-responseBuffer;
-					char *msg = new char[sz+1];
-					memcpy(msg, responseBuffer, sz);
-					*(msg+sz) = '\0';
-
-					delete[] msg;
-				}
+		char *buf = &fRtpBuffer[fRtpBufferReadIdx];
+		int len = fRtpBufferIdx - fRtpBufferReadIdx;
+		int consumed;
 
-				responseBuffer = p+4;
+		if (buf[0] == '$')
+			consumed = handleInterleavedFrame(buf, len, fromAddress);
+		else
+			consumed = handleRTSPMessage(buf, len);
 
-				isCompleted = true;
-				haveSeenNonCRLF = false;
-			}
-		}
+		if (consumed == 0) break;	// incomplete; wait for more data
+		fRtpBufferReadIdx += consumed;
 	}
 
-	if (!isCompleted) {
-		DPRINTF0("RTSP message was fragmented\n");
-		int sz = fResponseBuffer + fResponseBufferIdx - responseBuffer;
-		memmove(fResponseBuffer, responseBuffer, sz);
-		fResponseBufferIdx = sz;
-		fTCPReadingState = AWAITING_RTSP_MESSAGE;
-	} else {
-		if (RTSPCommonEnv::nDebugFlag&DEBUG_FLAG_RTSP)
-			DPRINTF("Received %d bytes response:\n%s\n", fResponseBufferIdx, fResponseBuffer);
-		resetResponseBuffer();
+	if (fRtpBufferReadIdx == fRtpBufferIdx) {
+		fRtpBufferReadIdx = fRtpBufferIdx = 0;
+	} else if (fRtpBufferReadIdx == 0 && fRtpBufferIdx == fRtpBufferSize) {
+		// A message bigger than our buffer: we can't tell where the next one starts, so we give up the connection
+		// (dropping the buffered bytes would have us take the rest of it for new messages)
+		DPRINTF0("response buffer is full; closing the connection\n");
+		fRtpBufferReadIdx = fRtpBufferIdx = 0;
+		tcpReadError(0);
 	}
-
-	return isCompleted;
 }
 
-void RTSPClient::handleCmd_notSupported(char const* cseq) 
+int RTSPClient::handleInterleavedFrame(char *buf, int len, struct sockaddr_in &fromAddress)
 {
-	char tmpBuf[512];
-	snprintf((char*)tmpBuf, sizeof tmpBuf,
-		"RTSP/1.0 405 Method Not Allowed\r\nCSeq: %s\r\n\r\n", cseq);
-	fRtspSock.writeSocket(tmpBuf, strlen(tmpBuf));
-}
+	if (len < 4)
+		return 0;
 
-bool RTSPClient::lookupStreamChannelId(unsigned char channel)
-{
-	MediaSubsessionIterator *iter = new MediaSubsessionIterator(*fMediaSession);
-	MediaSubsession *subsession = NULL;
-	while ((subsession=iter->next()) != NULL)
-	{
-		if (subsession->fRTPSource) { 
-			if (channel == subsession->rtpChannelId) {
-				fNextTCPSource = subsession->fRTPSource;
-				fNextTCPSourceType = 0;
-				break;
-			}
-			else if (channel == subsession->rtcpChannelId) {
-				fNextTCPSource = subsession->fRTPSource;
-				fNextTCPSourceType = 1;
-				break;
-			}
-		}
-	}
+	unsigned char channel = (unsigned char)buf[1];
+	int size = ((unsigned char)buf[2]<<8) | (unsigned char)buf[3];
+	if (len < 4+size)
+		return 0;
 
-	delete iter;
+	if (RTSPCommonEnv::nDebugFlag&DEBUG_FLAG_RTP)
+		DPRINTF("channel id: %d, size: %d\n", channel, size);
 
-	if (subsession == NULL) {
+	// The payload is passed straight from the read buffer:
+	RTPSource *source = fChannelTable[channel].source;
+	if (source == NULL) {
 		DPRINTF("channel id: %d not found handler\n", channel);
-		return false;
-	}	
+	} else if (fChannelTable[channel].isRtcp) {
+		source->rtcpReadHandler(&buf[4], size, fromAddress);
+	} else {
+		source->rtpReadHandler(&buf[4], size, fromAddress);
+	}
 
-	return true;
+	return 4+size;
 }
 
-void RTSPClient::readRTPOverTCP()
+int RTSPClient::handleRTSPMessage(char *buf, int len)
 {
-	int bytesRead = fTCPReadSize - fRtpBufferIdx;
-	struct sockaddr_in fromAddress;
+	// Skip any \r or \n between messages:
+	if (buf[0] == '\r' || buf[0] == '\n')
+		return 1;
 
-	int result = fRtspSock.readSocket1(&fRtpBuffer[fRtpBufferIdx], bytesRead, fromAddress);
-	if (result <= 0) {
-		tcpReadError(result);
-		return;
+	// Look for the end of the headers ("\r\n\r\n" or "\n\n"):
+	int headerSize = 0;
+	for (int i = 1; i < len; i++) {
+		if (buf[i] != '\n') continue;
+
+		if (buf[i-1] == '\n') {
+			headerSize = i+1;
+			break;
+		}
+		if (i >= 3 && buf[i-1] == '\r' && buf[i-2] == '\n' && buf[i-3] == '\r') {
+			headerSize = i+1;
+			break;
+		}
 	}
 
-	fRtpBufferIdx += result;
+	if (headerSize == 0)
+		return 0;
 
-	if (fRtpBufferIdx != fTCPReadSize) 
-		return;	
+	// Also look for "Content-Length:" (optional, case insensitive), so that any body is consumed too:
+	int contentLength = 0;
+	for (int i = 0; i+15 < headerSize; i++) {
+		if ((i == 0 || buf[i-1] == '\n') && _strcasecmp("Content-Length:", &buf[i], 15) == 0) {
+			contentLength = atoi(&buf[i+15]);
+			if (contentLength < 0) contentLength = 0;
+			break;
+		}
+	}
 
-	if (fNextTCPSource) {
-		if (fNextTCPSourceType == 0) 
-			fNextTCPSource->rtpReadHandler(fRtpBuffer, fRtpBufferIdx, fromAddress);
-		else
-			fNextTCPSource->rtcpReadHandler(fRtpBuffer, fRtpBufferIdx, fromAddress);
+	if (len < headerSize+contentLength) {
+		if (headerSize+contentLength > fRtpBufferSize)
+			DPRINTF("RTSP message is too large (%d bytes)\n", headerSize+contentLength);
+		return 0;	// (if it is too large, our buffer fills up, and the connection is closed)
 	}
 
-	fTCPReadingState = AWAITING_DOLLAR;	
-	fRtpBufferIdx = 0;
+	if (RTSPCommonEnv::nDebugFlag&DEBUG_FLAG_RTSP)
+		DPRINTF("Received %d bytes response:\n%.*s\n", headerSize+contentLength, headerSize+contentLength, buf);
+
+	return headerSize+contentLength;
+}
+
+void RTSPClient::handleCmd_notSupported(char const* cseq) 
+{
+	char tmpBuf[512];
+	snprintf((char*)tmpBuf, sizeof tmpBuf,
+		"RTSP/1.0 405 Method Not Allowed\r\nCSeq: %s\r\n\r\n", cseq);
+	fRtspSock.writeSocket(tmpBuf, strlen(tmpBuf));
 }
 
 char* RTSPClient::sendOptionsCmd(const char *url, char *username, char *password, Authenticator *authenticator)
@@ -1204,6 +1121,11 @@ bool RTSPClient::setupMediaSubsession(MediaSubsession& subsession, bool streamOu
 			if (subsession.fRTPSource) {
 				subsession.fRTPSource->setRtspSock(&fRtspSock);
 				subsession.fRTPSource->setRtcpChannelId(subsession.rtcpChannelId);
+
+				fChannelTable[subsession.rtpChannelId].source = subsession.fRTPSource;
+				fChannelTable[subsession.rtpChannelId].isRtcp = false;
+				fChannelTable[subsession.rtcpChannelId].source = subsession.fRTPSource;
+				fChannelTable[subsession.rtcpChannelId].isRtcp = true;
 			}
 		} else {
 			if (subsession.fRTPSource)
@@ -1614,14 +1536,15 @@ int RTSPClient::playURL(FrameHandlerFunc func, void *funcData,
 	MediaSubsession *subsession = NULL;
 	while ((subsession=iter->next()) != NULL)
 	{
-		if (subsession->fRTPSource)
+		if (subsession->fRTPSource) {
+			subsession->fRTPSource->setInjectParameterSets(fInjectParameterSets);
+			if (fKeyframeOnly && strcmp(subsession->mediumName(), "video") == 0)
+				subsession->fRTPSource->setKeyframeOnly(true);
 			subsession->fRTPSource->startNetworkReading(func, funcData, rtpHandlerCallback, this, rtcpHandlerCallback, this);
+		}
 	}
 
-	if (fTCPStreamIdCount > 0) fTCPReadingState = AWAITING_DOLLAR;
-	else fTCPReadingState = AWAITING_RTSP_MESSAGE;
-
-	resetResponseBuffer();
+	fRtpBufferIdx = fRtpBufferReadIdx = 0;
 
 	fTask->turnOnBackgroundReadHandling(fRtspSock.sock(), tcpReadHandler, this);
 
@@ -1765,6 +1688,7 @@ void RTSPClient::rtcpHandlerCallback(void *arg, char *trackId, char *buf, int le
 		client->fRTCPReceiveFunc(client->fRTCPReceiveFuncData, trackId, buf, len);
 }
 
+// (The keep-alive: it doesn't wait for the response; see "getMediaSessionParameter()".)
 void RTSPClient::sendGetParam()
 {
 	char *str = NULL;
@@ -1909,100 +1833,11 @@ bool RTSPClient::getMediaSessionParameter(MediaSession& /*session*/,
 		}
 		delete[] authenticatorStr;
 
-		if (!sendRequest(cmd, "GET_PARAMETER")) break;
-		
-#if 0	// no response
-		// Get the response from the server:
-		// This section was copied/modified from the RTSPClient::describeURL func
-		unsigned bytesRead; unsigned responseCode;
-		char* firstLine; char* nextLineStart;
-		if (!getResponse("GET_PARAMETER", bytesRead, responseCode, firstLine,
-			nextLineStart, false /*don't check for response code 200*/)) break;
-
-		// Inspect the first line to check whether it's a result code that
-		// we can handle.
-		if (responseCode != 200) {
-			DPRINTF("cannot handle GET_PARAMETER response: %s", firstLine);
-			break;
-		}
-
-		// Skip every subsequent header line, until we see a blank line
-		// The remaining data is assumed to be the parameter data that we want.
-		char* serverType = new char[fResponseBufferSize]; // ensures enough space
-		int contentLength = -1;
-		char* lineStart;
-		while (1) {
-			lineStart = nextLineStart;
-			if (lineStart == NULL) break;
-
-			nextLineStart = getLine(lineStart);
-			if (lineStart[0] == '\0') break; // this is a blank line
-
-			if (sscanf(lineStart, "Content-Length: %d", &contentLength) == 1
-				|| sscanf(lineStart, "Content-length: %d", &contentLength) == 1) {
-					if (contentLength < 0) {
-						DPRINTF("Bad \"Content-length:\" header: \"",
-							lineStart, "\"");
-						break;
-					}
-			}
-		}
-		delete[] serverType;
-
-		// We're now at the end of the response header lines
-		if (lineStart == NULL) {
-			DPRINTF("no content following header lines: %s",
-				fResponseBuffer);
-			break;
-		}
+		if (sendRequest(cmd, "GET_PARAMETER") <= 0) break;
 
-		// Use the remaining data as the parameter data, but first, check
-		// the "Content-length:" header (if any) that we saw.  We may need to
-		// read more data, or we may have extraneous data in the buffer.
-		char* bodyStart = nextLineStart;
-		if (contentLength >= 0) {
-			// We saw a "Content-length:" header
-			unsigned numBodyBytes = &firstLine[bytesRead] - bodyStart;
-			if (contentLength > (int)numBodyBytes) {
-				// We need to read more data.  First, make sure we have enough
-				// space for it:
-				unsigned numExtraBytesNeeded = contentLength - numBodyBytes;
-				unsigned remainingBufferSize
-					= fResponseBufferSize - (bytesRead + (firstLine - fResponseBuffer));
-				if (numExtraBytesNeeded > remainingBufferSize) {
-					char tmpBuf[200];
-					sprintf(tmpBuf, "Read buffer size (%d) is too small for \"Content-length:\" %d (need a buffer size of >= %d bytes\n",
-						fResponseBufferSize, contentLength,
-						fResponseBufferSize + numExtraBytesNeeded - remainingBufferSize);
-					DPRINTF0(tmpBuf);
-					break;
-				}
-
-				// Keep reading more data until we have enough:
-				//if (fVerbosityLevel >= 1) {
-					DPRINTF("Need to read %d extra bytes\n", numExtraBytesNeeded);
-				//}
-				while (numExtraBytesNeeded > 0) {
-					struct sockaddr_in fromAddress;
-					char* ptr = &firstLine[bytesRead];
-					int bytesRead2 = fRtspSock.readSocket(ptr, numExtraBytesNeeded, fromAddress);
-					if (bytesRead2 < 0) break;
-					ptr[bytesRead2] = '\0';
-					//if (fVerbosityLevel >= 1) {
-						DPRINTF("Read %d extra bytes: %s\n", bytesRead2, ptr);
-
-					//}
-
-					bytesRead += bytesRead2;
-					numExtraBytesNeeded -= bytesRead2;
-				}
-				if (numExtraBytesNeeded > 0) break; // one of the reads failed
-			}
-		}
-
-		//if (haveParameterName
-			//&& !parseGetParameterHeader(bodyStart, parameterName, parameterValue)) break;
-#endif
+		// The response isn't read here: this is sent as a keep-alive from the read handler, where the next bytes on
+		// the socket may be the rest of an interleaved frame that is already partly buffered. "tcpReadHandler1()"
+		// takes the response off the stream in turn, like any other RTSP message ("handleRTSPMessage()").
 		delete[] cmd;
 		return true;
 	} while (0);
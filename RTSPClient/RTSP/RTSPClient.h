@@ -9,6 +9,8 @@
 #define RECV_BUF_SIZE			(1024*1024)
 #define SEND_GET_PARAM_DURATION	(50)
 
+#define MAX_INTERLEAVED_FRAME_SIZE	(4+65535)	// '$', channel id, 16-bit size, packet
+
 typedef void (*OnCloseFunc)(void *arg, int err, int result);
 typedef void (*OnPacketReceiveFunc)(void *arg, const char *trackId, char *buf, int len);
 
@@ -31,6 +33,14 @@ public:
 	int sendPlay(double start = 0.0f, double end = -1.0f, float scale = 1.0f);
 	int sendSetParam(char *name, char *value);
 
+	void setInjectParameterSets(bool enable) { fInjectParameterSets = enable; }
+	// If set before "playURL()", the H.264/H.265 frame handler gets the latest in-band
+	// VPS/SPS/PPS prepended to every keyframe, so that a consumer can start on any of them.
+
+	void setKeyframeOnly(bool enable) { fKeyframeOnly = enable; }
+	// If set before "playURL()", the video frame handler gets keyframes only.
+	// (Use "mediaSession()" and "RTPSource::setKeyframeOnly()" to choose per subsession)
+
 public:
 	const char* videoCodec() { return fVideoCodec; }
 	const char* audioCodec() { return fAudioCodec; }
@@ -103,11 +113,9 @@ protected:
 	void tcpReadHandler1();
 	void tcpReadError(int result);
 
-	bool lookupStreamChannelId(unsigned char channel);
-	bool readRTSPMessage();
-	void readRTPOverTCP();
-
-	bool parseRTSPMessage();
+	int handleInterleavedFrame(char *buf, int len, struct sockaddr_in &fromAddress);
+	int handleRTSPMessage(char *buf, int len);
+	// return the number of bytes consumed from "buf", or 0 if the frame/message is not complete yet
 	void handleCmd_notSupported(char const* cseq);
 	
 	char const* sessionURL(MediaSession const& session) const;
@@ -130,12 +138,11 @@ protected:
 	static void rtcpHandlerCallback(void *arg, char *trackId, char *buf, int len);
 
 protected:
-	enum { AWAITING_DOLLAR, AWAITING_STREAM_CHANNEL_ID, AWAITING_SIZE1, AWAITING_SIZE2, AWAITING_PACKET_DATA,
-	AWAITING_RTSP_MESSAGE } fTCPReadingState;
-	unsigned char	fStreamChannelId, fSizeByte1;
-	unsigned		fTCPReadSize;
-	RTPSource*		fNextTCPSource;
-	int				fNextTCPSourceType;
+	// interleaved channel id -> source, filled in by "setupMediaSubsession()"
+	struct {
+		RTPSource*	source;
+		bool		isRtcp;
+	} fChannelTable[256];
 
 protected:
 	MySock			fRtspSock;
@@ -148,9 +155,11 @@ protected:
 	int				fResponseBufferSize;
 	int				fResponseBufferIdx;
 
+	// read buffer of "tcpReadHandler1()"; holds interleaved RTP/RTCP frames and RTSP messages
 	char*			fRtpBuffer;
 	int				fRtpBufferSize;
-	int				fRtpBufferIdx;
+	int				fRtpBufferIdx;		// end of the received data
+	int				fRtpBufferReadIdx;	// start of the data not handled yet
 
 	char*			fUserAgentHeaderStr;
 	unsigned		fUserAgentHeaderStrSize;
@@ -184,6 +193,9 @@ protected:
 	double			fPlayStartTime;
 	double			fPlayEndTime;
 
+	bool			fInjectParameterSets;
+	bool			fKeyframeOnly;
+
 	bool			fIsSendGetParam;
 	time_t			fLastSendGetParam;	// GET_PARAMETER polling time
 
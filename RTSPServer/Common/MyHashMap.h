@@ -0,0 +1,242 @@
+#ifndef __MY_HASH_MAP_H__
+#define __MY_HASH_MAP_H__
+
+#include "Mutex.h"
+#include "RTSPCommon.h"
+#include <string.h>
+
+// How "MyHashMap" hashes, compares and keeps its keys.
+// (String keys are copied into the map; the caller's string need not outlive the entry.)
+template <class KT>
+struct MyHashKey;
+
+template <>
+struct MyHashKey<uint64_t>
+{
+	static unsigned hash(uint64_t key) {
+		key ^= key >> 33; key *= 0xff51afd7ed558ccdULL;
+		key ^= key >> 33; key *= 0xc4ceb9fe1a85ec53ULL;
+		key ^= key >> 33;
+		return (unsigned)key;
+	}
+	static bool equals(uint64_t key1, uint64_t key2) { return key1 == key2; }
+	static uint64_t copy(uint64_t key) { return key; }
+	static void release(uint64_t) {}
+};
+
+template <>
+struct MyHashKey<char const*>
+{
+	static unsigned hash(char const* key) {
+		unsigned h = 2166136261U; // FNV-1a
+		while (*key) { h ^= (unsigned char)*key++; h *= 16777619U; }
+		return h ^ (h >> 16);
+	}
+	static bool equals(char const* key1, char const* key2) { return strcmp(key1, key2) == 0; }
+	static char const* copy(char const* key) {
+		size_t len = strlen(key) + 1;
+		char* copy = new char[len];
+		memcpy(copy, key, len);
+		return copy;
+	}
+	static void release(char const* key) { delete[] key; }
+};
+
+#define MY_HASH_MAP_SHARDS			(16)	// a power of 2
+#define MY_HASH_MAP_INITIAL_BUCKETS	(8)		// per shard; a power of 2
+
+// A hash map from keys to (not owned) "DT" objects, that threads can use at the same time.
+// The entries are spread over MY_HASH_MAP_SHARDS shards, each with a mutex of its own,
+// so an operation locks only the shard that its key falls into, never the whole map.
+template <class KT, class DT>
+class MyHashMap
+{
+public:
+	MyHashMap();
+	~MyHashMap();
+
+	bool insert(KT key, DT *data);
+	// returns false (and changes nothing) if "key" is already in the map
+	DT* lookup(KT key);
+	// returns NULL if "key" isn't in the map
+	DT* remove(KT key, DT *data = NULL);
+	// if "data" is given, the entry is removed only if "key" maps to it; returns the removed data, or NULL
+	int count() { return fCount; }
+
+	typedef void (*ForEachFunc)(DT *data, void *arg);
+	void forEach(ForEachFunc func, void *arg);
+	// calls "func" for each entry, a shard at a time, with that shard locked
+	// ("func" must not insert into or remove from this map)
+
+private:
+	struct Entry {
+		KT		key;
+		DT*		data;
+		Entry*	next;
+	};
+
+	struct Shard {
+		MUTEX		mutex;
+		Entry**		buckets;
+		unsigned	numBuckets;
+		unsigned	numEntries;
+	};
+
+	Shard& shardFor(unsigned hash) { return fShards[hash >> 28 & (MY_HASH_MAP_SHARDS-1)]; }
+	static Entry** bucketFor(Shard& shard, unsigned hash) { return &shard.buckets[hash & (shard.numBuckets-1)]; }
+	static void rehash(Shard& shard);
+
+private:
+	Shard			fShards[MY_HASH_MAP_SHARDS];
+	long volatile	fCount;
+};
+
+template <class KT, class DT>
+MyHashMap<KT, DT>::MyHashMap() : fCount(0)
+{
+	for (int i = 0; i < MY_HASH_MAP_SHARDS; i++) {
+		MUTEX_INIT(&fShards[i].mutex);
+		fShards[i].numBuckets = MY_HASH_MAP_INITIAL_BUCKETS;
+		fShards[i].buckets = new Entry*[MY_HASH_MAP_INITIAL_BUCKETS];
+		memset(fShards[i].buckets, 0, MY_HASH_MAP_INITIAL_BUCKETS*sizeof(Entry*));
+		fShards[i].numEntries = 0;
+	}
+}
+
+template <class KT, class DT>
+MyHashMap<KT, DT>::~MyHashMap()
+{
+	for (int i = 0; i < MY_HASH_MAP_SHARDS; i++) {
+		for (unsigned b = 0; b < fShards[i].numBuckets; b++) {
+			Entry* entry = fShards[i].buckets[b];
+			while (entry != NULL) {
+				Entry* next = entry->next;
+				MyHashKey<KT>::release(entry->key);
+				delete entry;
+				entry = next;
+			}
+		}
+		delete[] fShards[i].buckets;
+		MUTEX_DESTROY(&fShards[i].mutex);
+	}
+}
+
+template <class KT, class DT>
+bool MyHashMap<KT, DT>::insert(KT key, DT *data)
+{
+	unsigned hash = MyHashKey<KT>::hash(key);
+	Shard& shard = shardFor(hash);
+
+	MUTEX_LOCK(&shard.mutex);
+
+	Entry** bucket = bucketFor(shard, hash);
+	for (Entry* entry = *bucket; entry != NULL; entry = entry->next) {
+		if (MyHashKey<KT>::equals(entry->key, key)) {
+			MUTEX_UNLOCK(&shard.mutex);
+			return false;
+		}
+	}
+
+	Entry* entry = new Entry;
+	entry->key = MyHashKey<KT>::copy(key);
+	entry->data = data;
+	entry->next = *bucket;
+	*bucket = entry;
+
+	if (++shard.numEntries > 2*shard.numBuckets)
+		rehash(shard);
+
+	MUTEX_UNLOCK(&shard.mutex);
+
+	ATOMIC_INC(&fCount);
+	return true;
+}
+
+template <class KT, class DT>
+DT* MyHashMap<KT, DT>::lookup(KT key)
+{
+	unsigned hash = MyHashKey<KT>::hash(key);
+	Shard& shard = shardFor(hash);
+	DT* data = NULL;
+
+	MUTEX_LOCK(&shard.mutex);
+
+	for (Entry* entry = *bucketFor(shard, hash); entry != NULL; entry = entry->next) {
+		if (MyHashKey<KT>::equals(entry->key, key)) {
+			data = entry->data;
+			break;
+		}
+	}
+
+	MUTEX_UNLOCK(&shard.mutex);
+
+	return data;
+}
+
+template <class KT, class DT>
+DT* MyHashMap<KT, DT>::remove(KT key, DT *data)
+{
+	unsigned hash = MyHashKey<KT>::hash(key);
+	Shard& shard = shardFor(hash);
+	DT* removed = NULL;
+
+	MUTEX_LOCK(&shard.mutex);
+
+	for (Entry** link = bucketFor(shard, hash); *link != NULL; link = &(*link)->next) {
+		Entry* entry = *link;
+		if (MyHashKey<KT>::equals(entry->key, key)) {
+			if (data == NULL || entry->data == data) {
+				removed = entry->data;
+				*link = entry->next;
+				MyHashKey<KT>::release(entry->key);
+				delete entry;
+				shard.numEntries--;
+			}
+			break;
+		}
+	}
+
+	MUTEX_UNLOCK(&shard.mutex);
+
+	if (removed != NULL) ATOMIC_DEC(&fCount);
+	return removed;
+}
+
+template <class KT, class DT>
+void MyHashMap<KT, DT>::forEach(ForEachFunc func, void *arg)
+{
+	for (int i = 0; i < MY_HASH_MAP_SHARDS; i++) {
+		MUTEX_LOCK(&fShards[i].mutex);
+		for (unsigned b = 0; b < fShards[i].numBuckets; b++) {
+			for (Entry* entry = fShards[i].buckets[b]; entry != NULL; entry = entry->next)
+				func(entry->data, arg);
+		}
+		MUTEX_UNLOCK(&fShards[i].mutex);
+	}
+}
+
+template <class KT, class DT>
+void MyHashMap<KT, DT>::rehash(Shard& shard)
+{
+	// Double the number of buckets (the caller has the shard locked):
+	unsigned newNumBuckets = shard.numBuckets*2;
+	Entry** newBuckets = new Entry*[newNumBuckets];
+	memset(newBuckets, 0, newNumBuckets*sizeof(Entry*));
+
+	for (unsigned b = 0; b < shard.numBuckets; b++) {
+		Entry* entry = shard.buckets[b];
+		while (entry != NULL) {
+			Entry* next = entry->next;
+			Entry** bucket = &newBuckets[MyHashKey<KT>::hash(entry->key) & (newNumBuckets-1)];
+			entry->next = *bucket;
+			*bucket = entry;
+			entry = next;
+		}
+	}
+
+	delete[] shard.buckets;
+	shard.buckets = newBuckets;
+	shard.numBuckets = newNumBuckets;
+}
+
+#endif
@@ -0,0 +1,190 @@
+#ifndef __MY_SLOT_LIST_H__
+#define __MY_SLOT_LIST_H__
+
+#include <string.h>
+
+#define MY_SLOT_LIST_INDEX_BITS		(20)
+#define MY_SLOT_LIST_INDEX_MASK		((1U<<MY_SLOT_LIST_INDEX_BITS)-1)
+#define MY_SLOT_LIST_MAX_ITEMS		(MY_SLOT_LIST_INDEX_MASK)
+#define MY_SLOT_LIST_INITIAL_SIZE	(8)
+
+// A list of (not owned) "DT" objects, kept in one array, so that walking it reads consecutive memory.
+// "insert()" returns a handle, by which the item is found or removed in constant time; a handle
+// doesn't refer to anything any more once its item is removed (even if the slot is reused since).
+// Removing an item moves the last one into its place: the order of the items isn't kept.
+// (The list has no lock of its own; see "MySnapshotSet" for one that threads share.)
+template <class DT>
+class MySlotList
+{
+public:
+	typedef unsigned Handle;	// 0 is never a handle
+
+	MySlotList();
+	~MySlotList();
+
+	Handle insert(DT *item);
+	// returns 0 if the list is full (MY_SLOT_LIST_MAX_ITEMS items)
+	DT* get(Handle handle);
+	// returns NULL if the item of "handle" is no longer in the list
+	DT* remove(Handle handle);
+	// returns the removed item, or NULL
+	Handle find(DT *item);
+	// (a linear search) returns 0 if "item" isn't in the list
+
+	int count() { return fCount; }
+	DT* at(int i) { return fItems[i]; }
+	// for walking the list, with 0 <= "i" < "count()"
+
+	void clear();		// deletes the items too
+	void clearList();
+
+private:
+	bool grow();
+	void freeSlot(unsigned slot);
+
+	DT**		fItems;			// "fCount" of them
+	unsigned*	fItemSlots;		// the slot of each item
+	unsigned*	fSlots;			// generation << MY_SLOT_LIST_INDEX_BITS | the index of its item (or, if free, the next free slot)
+	int			fCount;
+	int			fSize;			// of each of the above
+	unsigned	fFreeSlot;		// the first free slot; MY_SLOT_LIST_INDEX_MASK if none
+};
+
+template <class DT>
+MySlotList<DT>::MySlotList()
+: fItems(NULL), fItemSlots(NULL), fSlots(NULL), fCount(0), fSize(0), fFreeSlot(MY_SLOT_LIST_INDEX_MASK)
+{
+}
+
+template <class DT>
+MySlotList<DT>::~MySlotList()
+{
+	delete[] fItems;
+	delete[] fItemSlots;
+	delete[] fSlots;
+}
+
+template <class DT>
+typename MySlotList<DT>::Handle MySlotList<DT>::insert(DT *item)
+{
+	if (fFreeSlot == MY_SLOT_LIST_INDEX_MASK && !grow())
+		return 0;
+
+	unsigned slot = fFreeSlot;
+	unsigned generation = fSlots[slot] & ~MY_SLOT_LIST_INDEX_MASK;
+	fFreeSlot = fSlots[slot] & MY_SLOT_LIST_INDEX_MASK;
+
+	fItems[fCount] = item;
+	fItemSlots[fCount] = slot;
+	fSlots[slot] = generation | fCount;
+	fCount++;
+
+	return generation | (slot+1);
+}
+
+template <class DT>
+DT* MySlotList<DT>::get(Handle handle)
+{
+	unsigned slot = (handle & MY_SLOT_LIST_INDEX_MASK) - 1;
+	if (slot >= (unsigned)fSize) return NULL;	// (also for a "handle" of 0)
+
+	unsigned entry = fSlots[slot];
+	if ((entry & ~MY_SLOT_LIST_INDEX_MASK) != (handle & ~MY_SLOT_LIST_INDEX_MASK)) return NULL;
+
+	unsigned index = entry & MY_SLOT_LIST_INDEX_MASK;
+	if (index >= (unsigned)fCount || fItemSlots[index] != slot) return NULL;	// a free slot
+
+	return fItems[index];
+}
+
+template <class DT>
+DT* MySlotList<DT>::remove(Handle handle)
+{
+	DT *item = get(handle);
+	if (item == NULL) return NULL;
+
+	unsigned slot = (handle & MY_SLOT_LIST_INDEX_MASK) - 1;
+	unsigned index = fSlots[slot] & MY_SLOT_LIST_INDEX_MASK;
+
+	// Move the last item into the hole:
+	int last = --fCount;
+	if (index != (unsigned)last) {
+		fItems[index] = fItems[last];
+		fItemSlots[index] = fItemSlots[last];
+		unsigned movedSlot = fItemSlots[index];
+		fSlots[movedSlot] = (fSlots[movedSlot] & ~MY_SLOT_LIST_INDEX_MASK) | index;
+	}
+
+	freeSlot(slot);
+	return item;
+}
+
+template <class DT>
+typename MySlotList<DT>::Handle MySlotList<DT>::find(DT *item)
+{
+	for (int i = 0; i < fCount; i++) {
+		if (fItems[i] == item) {
+			unsigned slot = fItemSlots[i];
+			return (fSlots[slot] & ~MY_SLOT_LIST_INDEX_MASK) | (slot+1);
+		}
+	}
+	return 0;
+}
+
+template <class DT>
+void MySlotList<DT>::clear()
+{
+	for (int i = 0; i < fCount; i++)
+		delete fItems[i];
+	clearList();
+}
+
+template <class DT>
+void MySlotList<DT>::clearList()
+{
+	for (int i = 0; i < fCount; i++)
+		freeSlot(fItemSlots[i]);
+	fCount = 0;
+}
+
+template <class DT>
+bool MySlotList<DT>::grow()
+{
+	if ((unsigned)fSize >= MY_SLOT_LIST_MAX_ITEMS) return false;
+
+	int newSize = fSize == 0 ? MY_SLOT_LIST_INITIAL_SIZE : fSize*2;
+	if ((unsigned)newSize > MY_SLOT_LIST_MAX_ITEMS) newSize = MY_SLOT_LIST_MAX_ITEMS;
+
+	DT **items = new DT*[newSize];
+	unsigned *itemSlots = new unsigned[newSize];
+	unsigned *slots = new unsigned[newSize];
+
+	if (fSize > 0) {
+		memcpy(items, fItems, fCount*sizeof(DT*));
+		memcpy(itemSlots, fItemSlots, fCount*sizeof(unsigned));
+		memcpy(slots, fSlots, fSize*sizeof(unsigned));
+	}
+
+	// The new slots are all free (there were no others):
+	for (int i = fSize; i < newSize; i++)
+		slots[i] = i+1 < newSize ? i+1 : MY_SLOT_LIST_INDEX_MASK;
+	fFreeSlot = fSize;
+
+	delete[] fItems; fItems = items;
+	delete[] fItemSlots; fItemSlots = itemSlots;
+	delete[] fSlots; fSlots = slots;
+	fSize = newSize;
+
+	return true;
+}
+
+template <class DT>
+void MySlotList<DT>::freeSlot(unsigned slot)
+{
+	// A new generation, so that the handles of the slot's former item no longer match:
+	unsigned generation = (fSlots[slot] & ~MY_SLOT_LIST_INDEX_MASK) + (1U<<MY_SLOT_LIST_INDEX_BITS);
+	fSlots[slot] = generation | fFreeSlot;
+	fFreeSlot = slot;
+}
+
+#endif
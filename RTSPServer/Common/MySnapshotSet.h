@@ -0,0 +1,329 @@
+#ifndef __MY_SNAPSHOT_SET_H__
+#define __MY_SNAPSHOT_SET_H__
+
+#include "MySlotList.h"
+#include "Mutex.h"
+#include <stdlib.h>
+
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+// A set of (not owned) "DT" objects, that some threads change while others walk it.
+// A reader walks an immutable "Snapshot" of the set, so it neither locks the set nor holds up
+// its writers meanwhile. A change makes the current snapshot an older one; the next "acquire()"
+// makes a new one, so that a run of changes costs a single copy.
+// An item that was removed may still be in an older snapshot: "synchronize()" waits until it isn't.
+template <class DT>
+class MySnapshotSet
+{
+public:
+	struct Snapshot {
+		int		count;
+		DT**	items;		// arranged as given to "setOrder()"
+		int*	groupStart;	// if grouped: where the items of each group begin, then "count"; otherwise NULL
+		int		refCount;	// the readers using it, plus one while it is the current one
+	};
+
+	typedef typename MySlotList<DT>::Handle Handle;
+
+	typedef int (*CompareFunc)(const void *item1, const void *item2);
+	// as for "qsort()", on "DT*"s
+	typedef int (*GroupFunc)(DT *item, void *arg);
+	// returns the group of "item", from 0 to "numGroups"-1
+
+	MySnapshotSet();
+	~MySnapshotSet();
+
+	Handle insert(DT *item);
+	// returns 0 if "item" is in the set already (or the set is full)
+	DT* remove(DT *item);
+	DT* remove(Handle handle, DT *item);
+	// return "item" if it was removed; NULL if it isn't in the set (under "handle", for the latter)
+	bool contains(Handle handle, DT *item);
+	int count() { return fItems.count(); }
+
+	void setOrder(CompareFunc compare, GroupFunc group = NULL, void *groupArg = NULL, int numGroups = 0);
+	// The snapshots from now on have their items split into "numGroups" groups by "group" (if not NULL),
+	// and sorted by "compare" (if not NULL) within each group.
+
+	Snapshot* acquire();
+	// never returns NULL
+	void release(Snapshot *snapshot);
+	void synchronize();
+	// returns once no reader uses a snapshot older than the current contents of the set
+	// (e.g. before deleting an item that was removed)
+
+	void clear();		// deletes the items too, once no reader has them
+	void clearList();
+
+	void lock();
+	void unlock();
+	// for what must happen together with an "insert()" or "remove()" (the lock is recursive, and readers don't take it)
+
+private:
+	Snapshot* makeSnapshot();
+	void dropCurrentSnapshot();
+	// (both are called with "fMutex" locked)
+
+private:
+	MySlotList<DT>	fItems;
+	MUTEX			fMutex;			// of "fItems" and the order
+
+	CompareFunc		fCompareFunc;
+	GroupFunc		fGroupFunc;
+	void*			fGroupArg;
+	int				fNumGroups;
+
+	Snapshot*		fSnapshot;		// the current one; NULL after a change, until the next "acquire()"
+	int				fNumSnapshots;	// the current one, and older ones still in use
+	MUTEX			fSnapshotMutex;
+};
+
+template <class DT>
+MySnapshotSet<DT>::MySnapshotSet()
+: fCompareFunc(NULL), fGroupFunc(NULL), fGroupArg(NULL), fNumGroups(0), fSnapshot(NULL), fNumSnapshots(0)
+{
+	MUTEX_INIT(&fMutex);
+	MUTEX_INIT(&fSnapshotMutex);
+}
+
+template <class DT>
+MySnapshotSet<DT>::~MySnapshotSet()
+{
+	MUTEX_LOCK(&fMutex);
+	dropCurrentSnapshot();
+	MUTEX_UNLOCK(&fMutex);
+	synchronize();
+
+	MUTEX_DESTROY(&fSnapshotMutex);
+	MUTEX_DESTROY(&fMutex);
+}
+
+template <class DT>
+void MySnapshotSet<DT>::lock()
+{
+	MUTEX_LOCK(&fMutex);
+}
+
+template <class DT>
+void MySnapshotSet<DT>::unlock()
+{
+	MUTEX_UNLOCK(&fMutex);
+}
+
+template <class DT>
+typename MySnapshotSet<DT>::Handle MySnapshotSet<DT>::insert(DT *item)
+{
+	Handle handle = 0;
+
+	MUTEX_LOCK(&fMutex);
+	if (fItems.find(item) == 0) {
+		handle = fItems.insert(item);
+		if (handle != 0) dropCurrentSnapshot();
+	}
+	MUTEX_UNLOCK(&fMutex);
+
+	return handle;
+}
+
+template <class DT>
+DT* MySnapshotSet<DT>::remove(DT *item)
+{
+	MUTEX_LOCK(&fMutex);
+	DT *removed = fItems.remove(fItems.find(item));
+	if (removed != NULL) dropCurrentSnapshot();
+	MUTEX_UNLOCK(&fMutex);
+
+	return removed;
+}
+
+template <class DT>
+DT* MySnapshotSet<DT>::remove(Handle handle, DT *item)
+{
+	DT *removed = NULL;
+
+	MUTEX_LOCK(&fMutex);
+	if (fItems.get(handle) == item) {
+		removed = fItems.remove(handle);
+		if (removed != NULL) dropCurrentSnapshot();
+	}
+	MUTEX_UNLOCK(&fMutex);
+
+	return removed;
+}
+
+template <class DT>
+bool MySnapshotSet<DT>::contains(Handle handle, DT *item)
+{
+	MUTEX_LOCK(&fMutex);
+	bool found = item != NULL && fItems.get(handle) == item;
+	MUTEX_UNLOCK(&fMutex);
+
+	return found;
+}
+
+template <class DT>
+void MySnapshotSet<DT>::setOrder(CompareFunc compare, GroupFunc group, void *groupArg, int numGroups)
+{
+	MUTEX_LOCK(&fMutex);
+	fCompareFunc = compare;
+	fGroupFunc = group;
+	fGroupArg = groupArg;
+	fNumGroups = group != NULL ? numGroups : 0;
+	dropCurrentSnapshot();
+	MUTEX_UNLOCK(&fMutex);
+}
+
+template <class DT>
+typename MySnapshotSet<DT>::Snapshot* MySnapshotSet<DT>::acquire()
+{
+	MUTEX_LOCK(&fSnapshotMutex);
+	Snapshot *snapshot = fSnapshot;
+	if (snapshot) snapshot->refCount++;
+	MUTEX_UNLOCK(&fSnapshotMutex);
+
+	if (snapshot) return snapshot;
+
+	// The set changed since the last one (only a writer, holding "fMutex", drops the current snapshot):
+	MUTEX_LOCK(&fMutex);
+
+	MUTEX_LOCK(&fSnapshotMutex);
+	snapshot = fSnapshot;
+	if (snapshot) snapshot->refCount++;
+	MUTEX_UNLOCK(&fSnapshotMutex);
+
+	if (snapshot == NULL) {
+		snapshot = makeSnapshot();
+		snapshot->refCount = 2;
+
+		MUTEX_LOCK(&fSnapshotMutex);
+		fSnapshot = snapshot;
+		fNumSnapshots++;
+		MUTEX_UNLOCK(&fSnapshotMutex);
+	}
+
+	MUTEX_UNLOCK(&fMutex);
+
+	return snapshot;
+}
+
+template <class DT>
+void MySnapshotSet<DT>::release(Snapshot *snapshot)
+{
+	MUTEX_LOCK(&fSnapshotMutex);
+	bool unused = --snapshot->refCount == 0;
+	if (unused) fNumSnapshots--;
+	MUTEX_UNLOCK(&fSnapshotMutex);
+
+	if (unused) {
+		delete[] snapshot->items;
+		delete[] snapshot->groupStart;
+		delete snapshot;
+	}
+}
+
+template <class DT>
+void MySnapshotSet<DT>::synchronize()
+{
+	while (1) {
+		MUTEX_LOCK(&fSnapshotMutex);
+		int numOlder = fNumSnapshots - (fSnapshot ? 1 : 0);
+		MUTEX_UNLOCK(&fSnapshotMutex);
+		if (numOlder <= 0) break;
+#ifdef WIN32
+		Sleep(1);
+#else
+		usleep(1000);
+#endif
+	}
+}
+
+template <class DT>
+void MySnapshotSet<DT>::clear()
+{
+	MUTEX_LOCK(&fMutex);
+	int count = fItems.count();
+	DT **items = new DT*[count+1];
+	for (int i = 0; i < count; i++)
+		items[i] = fItems.at(i);
+	fItems.clearList();
+	dropCurrentSnapshot();
+	MUTEX_UNLOCK(&fMutex);
+
+	synchronize();
+
+	for (int i = 0; i < count; i++)
+		delete items[i];
+	delete[] items;
+}
+
+template <class DT>
+void MySnapshotSet<DT>::clearList()
+{
+	MUTEX_LOCK(&fMutex);
+	fItems.clearList();
+	dropCurrentSnapshot();
+	MUTEX_UNLOCK(&fMutex);
+}
+
+template <class DT>
+typename MySnapshotSet<DT>::Snapshot* MySnapshotSet<DT>::makeSnapshot()
+{
+	int count = fItems.count();
+
+	Snapshot *snapshot = new Snapshot;
+	snapshot->count = count;
+	snapshot->items = new DT*[count+1];
+	snapshot->groupStart = NULL;
+	snapshot->refCount = 0;
+
+	if (fNumGroups > 0) {
+		// Lay the groups out one after the other:
+		int *groups = new int[count+1];
+		snapshot->groupStart = new int[fNumGroups+1];
+		memset(snapshot->groupStart, 0, (fNumGroups+1)*sizeof(int));
+
+		for (int i = 0; i < count; i++) {
+			groups[i] = fGroupFunc(fItems.at(i), fGroupArg);
+			snapshot->groupStart[groups[i]+1]++;
+		}
+		for (int g = 0; g < fNumGroups; g++)
+			snapshot->groupStart[g+1] += snapshot->groupStart[g];
+
+		int *next = new int[fNumGroups];
+		memcpy(next, snapshot->groupStart, fNumGroups*sizeof(int));
+		for (int i = 0; i < count; i++)
+			snapshot->items[next[groups[i]]++] = fItems.at(i);
+
+		delete[] next;
+		delete[] groups;
+
+		if (fCompareFunc != NULL) {
+			for (int g = 0; g < fNumGroups; g++) {
+				int begin = snapshot->groupStart[g];
+				qsort(&snapshot->items[begin], snapshot->groupStart[g+1] - begin, sizeof(DT*), fCompareFunc);
+			}
+		}
+	} else {
+		for (int i = 0; i < count; i++)
+			snapshot->items[i] = fItems.at(i);
+		if (fCompareFunc != NULL)
+			qsort(snapshot->items, count, sizeof(DT*), fCompareFunc);
+	}
+
+	return snapshot;
+}
+
+template <class DT>
+void MySnapshotSet<DT>::dropCurrentSnapshot()
+{
+	MUTEX_LOCK(&fSnapshotMutex);
+	Snapshot *snapshot = fSnapshot;
+	fSnapshot = NULL;
+	MUTEX_UNLOCK(&fSnapshotMutex);
+
+	if (snapshot) release(snapshot);
+}
+
+#endif
@@ -1,48 +1,454 @@
 #include "ClientSocket.h"
+#include "RTSPCommonEnv.h"
+
+#include <time.h>
+#include <string.h>
+#ifdef WIN32
+#include <intrin.h>
+#endif
 
 ClientSocket::ClientSocket(MySock& rtspSock, unsigned char rtpChannelId, unsigned char rtcpChannelId) 
-: fRtpSock(&rtspSock), fRtcpSock(&rtspSock), fRtpChannelId(rtpChannelId), fRtcpChannelId(rtcpChannelId), fIsTCP(true), fActive(false)
+: fRtpSock(&rtspSock), fRtcpSock(&rtspSock), fRtpChannelId(rtpChannelId), fRtcpChannelId(rtcpChannelId), fIsTCP(true), fOwnSockets(false), fActive(false), fFanoutKey(0), fSubsessionHandle(0), fSkipThroughSeq(-1)
+, fRtcpPacketCount(0), fLastRtcpTime(0), fFractionLost(0), fCumulativeLost(0), fJitter(0)
 {
+	initSendQueue();
 }
 
-ClientSocket::ClientSocket(MySock& rtpSock, sockaddr_in& rtpDestAddr, MySock& rtcpSock, sockaddr_in& rtcpDestAddr) 
-: fRtpSock(&rtpSock), fRtpDestAddr(rtpDestAddr), fRtcpSock(&rtcpSock), fRtcpDestAddr(rtcpDestAddr), fIsTCP(false), fActive(false)
+ClientSocket::ClientSocket(MySock& rtpSock, sockaddr_in& rtpDestAddr, MySock& rtcpSock, sockaddr_in& rtcpDestAddr, bool ownSockets) 
+: fRtpSock(&rtpSock), fRtpDestAddr(rtpDestAddr), fRtcpSock(&rtcpSock), fRtcpDestAddr(rtcpDestAddr), fRtpChannelId(0xFF), fRtcpChannelId(0xFF), fIsTCP(false), fOwnSockets(ownSockets), fActive(false), fFanoutKey(0), fSubsessionHandle(0), fSkipThroughSeq(-1)
+, fRtcpPacketCount(0), fLastRtcpTime(0), fFractionLost(0), fCumulativeLost(0), fJitter(0)
 {
+	initSendQueue();
 }
 
 ClientSocket::~ClientSocket()
 {
-	if (!fIsTCP) {
-		if (fRtpSock) {
-			fRtpSock->closeSock();
-			delete fRtpSock;
-		}
-		if (fRtcpSock) {
-			fRtcpSock->closeSock();
-			delete fRtcpSock;
-		}
-	}
+	while (fSendQueueHead)
+		dequeue();
+	MUTEX_DESTROY(&fSendQueueMutex);
+
+	if (fOwnSockets)
+		ServerPortAllocator::releasePortPair(fRtpSock, fRtcpSock);
+}
+
+void ClientSocket::initSendQueue()
+{
+	MUTEX_INIT(&fSendQueueMutex);
+	fSendQueueHead = fSendQueueTail = NULL;
+	fSendQueueCount = fSendQueueBytes = 0;
+	fSendQueueSince = 0;
+
+	fSendQueueMaxBytes = SEND_QUEUE_DEFAULT_MAX_BYTES;
+	fSendQueuePolicy = SEND_QUEUE_DROP_UNTIL_KEYFRAME;
+	fMaxBacklogSeconds = 0;
+
+	fTask = NULL;
+	fWriteHandlerProc = NULL;
+	fWriteHandlerData = NULL;
+
+	fDropUntilKeyframe = false;
+	fDisconnected = false;
+	fDroppedPackets = 0;
+}
+
+void ClientSocket::setSendQueuePolicy(unsigned maxBytes, SEND_QUEUE_POLICY policy, unsigned maxBacklogSeconds)
+{
+	MUTEX_LOCK(&fSendQueueMutex);
+	fSendQueueMaxBytes = maxBytes;
+	fSendQueuePolicy = policy;
+	fMaxBacklogSeconds = maxBacklogSeconds;
+	MUTEX_UNLOCK(&fSendQueueMutex);
 }
 
-int ClientSocket::sendRTP(char *buf, int len)
+void ClientSocket::setWriteHandler(TaskScheduler *task, TaskScheduler::BackgroundHandlerProc *handlerProc, void *clientData)
 {
+	MUTEX_LOCK(&fSendQueueMutex);
+	fTask = task;
+	fWriteHandlerProc = handlerProc;
+	fWriteHandlerData = clientData;
+	MUTEX_UNLOCK(&fSendQueueMutex);
+}
+
+int ClientSocket::sendRTP(char *buf, int len, bool isKeyframe)
+{
+	if (fSkipThroughSeq >= 0 && len >= 4) {
+		unsigned short seq = ((unsigned char)buf[2]<<8)|(unsigned char)buf[3];
+		if ((unsigned short)(fSkipThroughSeq - seq) < 0x8000) return 0;
+		fSkipThroughSeq = -1;
+	}
+
 	if (fIsTCP) {
-		return fRtpSock->sendRTPOverTCP(buf, len, fRtpChannelId);
+		return sendOverTCP(buf, len, fRtpChannelId, true, isKeyframe);
 	} else {
-		return fRtpSock->writeSocket(buf, len, fRtpDestAddr);
+		int err = fRtpSock->writeSocket(buf, len, fRtpDestAddr);
+		if (err < 0) fDroppedPackets++;
+		return err;
 	}
 }
 
 int ClientSocket::sendRTCP(char *buf, int len)
 {
 	if (fIsTCP) {
-		return fRtcpSock->sendRTPOverTCP(buf, len, fRtcpChannelId);
+		return sendOverTCP(buf, len, fRtcpChannelId, false, false);
 	} else {
 		return fRtcpSock->writeSocket(buf, len, fRtcpDestAddr);
 	}
 }
 
+int ClientSocket::sendOverTCP(char *buf, int len, unsigned char channelId, bool isRtp, bool isKeyframe)
+{
+	int ret = 0;
+
+	MUTEX_LOCK(&fSendQueueMutex);
+
+	if (fDisconnected) {
+		ret = -1;
+		goto exit;
+	}
+
+	if (isRtp && fDropUntilKeyframe) {
+		if (!isKeyframe) {
+			fDroppedPackets++;
+			goto exit;
+		}
+		fDropUntilKeyframe = false;
+	}
+
+	// Packets must leave in order, so send directly only if nothing is waiting:
+	if ((fSendQueueHead == NULL || flushSendQueue1() == 0) && !fDisconnected) {
+		if (fRtpSock->sendRTPOverTCP1(buf, len, channelId) == 0) {
+			// The rest of a partly sent frame goes out when the socket is writable again:
+			if (fRtpSock->hasPendingFrame()) armWriteHandler();
+			goto exit;
+		}
+
+		int err = WSAGetLastError();
+		if (err != EWOULDBLOCK && err != EINTR) {
+			fDroppedPackets++;
+			ret = -1;
+			goto exit;
+		}
+	}
+
+	if (fDisconnected) {
+		ret = -1;
+		goto exit;
+	}
+
+	if (!enqueue(buf, len, channelId)) {
+		fDroppedPackets++;
+		if (fSendQueuePolicy == SEND_QUEUE_DISCONNECT) {
+			disconnect("send queue overflow");
+			ret = -1;
+		} else if (fSendQueuePolicy == SEND_QUEUE_DROP_UNTIL_KEYFRAME && isRtp) {
+			fDropUntilKeyframe = true;
+		}
+		goto exit;
+	}
+
+	// Have the server's event loop send the queued packets once the socket is writable again:
+	armWriteHandler();
+
+exit:
+	MUTEX_UNLOCK(&fSendQueueMutex);
+	return ret;
+}
+
+int ClientSocket::flushSendQueue()
+{
+	MUTEX_LOCK(&fSendQueueMutex);
+	int count = flushSendQueue1();
+	MUTEX_UNLOCK(&fSendQueueMutex);
+	return count;
+}
+
+int ClientSocket::flushSendQueue1()
+{
+	while (fSendQueueHead && !fDisconnected) {
+		if (fRtpSock->sendRTPOverTCP1(fSendQueueHead->buf, fSendQueueHead->len, fSendQueueHead->channelId) == 0) {
+			dequeue();
+			continue;
+		}
+
+		int err = WSAGetLastError();
+		if (err != EWOULDBLOCK && err != EINTR)
+			disconnect("send error");
+		break;
+	}
+
+	if (fSendQueueHead && fMaxBacklogSeconds > 0 && time(NULL) - fSendQueueSince >= (time_t)fMaxBacklogSeconds)
+		disconnect("send queue backlog timeout");
+
+	return fSendQueueCount;
+}
+
+void ClientSocket::armWriteHandler()
+{
+	if (fTask && fWriteHandlerProc)
+		fTask->turnOnBackgroundWriteHandling(fRtpSock->sock(), fWriteHandlerProc, fWriteHandlerData);
+}
+
+bool ClientSocket::enqueue(char *buf, int len, unsigned char channelId)
+{
+	if (fSendQueueBytes + len > fSendQueueMaxBytes)
+		return false;
+
+	SendQueueItem *item = new SendQueueItem;
+	item->buf = new char[len];
+	memcpy(item->buf, buf, len);
+	item->len = len;
+	item->channelId = channelId;
+	item->next = NULL;
+
+	if (fSendQueueTail) {
+		fSendQueueTail->next = item;
+	} else {
+		fSendQueueHead = item;
+		fSendQueueSince = time(NULL);
+	}
+	fSendQueueTail = item;
+
+	fSendQueueCount++;
+	fSendQueueBytes += len;
+
+	return true;
+}
+
+void ClientSocket::dequeue()
+{
+	SendQueueItem *item = fSendQueueHead;
+	if (item == NULL) return;
+
+	fSendQueueHead = item->next;
+	if (fSendQueueHead == NULL) fSendQueueTail = NULL;
+
+	fSendQueueCount--;
+	fSendQueueBytes -= item->len;
+
+	delete[] item->buf;
+	delete item;
+}
+
+void ClientSocket::disconnect(char const *reason)
+{
+	if (fDisconnected) return;
+
+	DPRINTF("disconnecting slow rtp/tcp client (%s), %u packets (%u bytes) queued, %u packets dropped\n", 
+		reason, fSendQueueCount, fSendQueueBytes, fDroppedPackets);
+
+	fDisconnected = true;
+	fDroppedPackets += fSendQueueCount;
+	while (fSendQueueHead)
+		dequeue();
+
+	// The server's event loop sees the connection closing, and deletes the client session:
+	fRtpSock->shutdown();
+}
+
 void ClientSocket::activate()
 {
 	fActive = true;
 }
+
+void ClientSocket::activate(unsigned short skipThroughSeq)
+{
+	fSkipThroughSeq = skipThroughSeq;
+	MEMORY_BARRIER();
+	fActive = true;
+}
+
+void ClientSocket::handleRtcpPacket(char *buf, int len)
+{
+	unsigned char *ptr = (unsigned char *)buf;
+
+	fRtcpPacketCount++;
+	fLastRtcpTime = time(NULL);
+
+	// Walk through the compound packet, looking for a SR or RR with a reception report block:
+	while (len >= 4)
+	{
+		unsigned char rc = ptr[0]&0x1F;
+		unsigned char pt = ptr[1];
+		int size = 4*(((ptr[2]<<8)|ptr[3])+1);
+		if ((ptr[0]>>6) != 2 || size > len) {
+			DPRINTF("invalid rtcp packet from client, pt: %d, size: %d, len: %d\n", pt, size, len);
+			break;
+		}
+
+		int offset = 0;
+		if (pt == 200) offset = 28;			// SR: header, SSRC, sender info
+		else if (pt == 201) offset = 8;		// RR: header, SSRC
+
+		if (offset > 0 && rc > 0 && offset+24 <= size) {
+			unsigned char *report = &ptr[offset];
+			fFractionLost = report[4];
+			fCumulativeLost = (report[5]<<16)|(report[6]<<8)|report[7];
+			fJitter = (report[12]<<24)|(report[13]<<16)|(report[14]<<8)|report[15];
+		}
+
+		ptr += size; len -= size;
+	}
+}
+
+#define MAX_PORT_BIND_FAILURES	16
+
+static MUTEX hPortMutex = PTHREAD_MUTEX_INITIALIZER;
+
+unsigned short ServerPortAllocator::fBasePort = 0;
+int ServerPortAllocator::fNumPairs = 0;
+unsigned* ServerPortAllocator::fBitmap = NULL;
+unsigned* ServerPortAllocator::fFullWords = NULL;
+int ServerPortAllocator::fNumUsed = 0;
+int ServerPortAllocator::fNextWord = 0;
+
+bool ServerPortAllocator::initBitmap()
+{
+	unsigned short basePort = (RTSPCommonEnv::nServerPortRangeMin+1)&~1;
+	int numPairs = ((int)RTSPCommonEnv::nServerPortRangeMax - basePort + 1)/2;
+
+	if (fBitmap != NULL) {
+		if (basePort == fBasePort && numPairs == fNumPairs) return true;
+		if (fNumUsed > 0) return true;	// the range changed, but ports of the old one are still in use
+		DELETE_ARRAY(fBitmap);
+		DELETE_ARRAY(fFullWords);
+	}
+
+	if (numPairs <= 0) {
+		DPRINTF("invalid server port range %d-%d\n", RTSPCommonEnv::nServerPortRangeMin, RTSPCommonEnv::nServerPortRangeMax);
+		return false;
+	}
+
+	int numWords = (numPairs+31)/32;
+	fBitmap = new unsigned[numWords];
+	memset(fBitmap, 0, numWords*sizeof(unsigned));
+	if (numPairs%32)
+		fBitmap[numWords-1] = ~0U << (numPairs%32);	// the bits past the end of the range are never free
+
+	int numSummaryWords = (numWords+31)/32;
+	fFullWords = new unsigned[numSummaryWords];
+	memset(fFullWords, 0, numSummaryWords*sizeof(unsigned));
+	if (numWords%32)
+		fFullWords[numSummaryWords-1] = ~0U << (numWords%32);
+
+	fBasePort = basePort;
+	fNumPairs = numPairs;
+	fNumUsed = 0;
+	fNextWord = 0;
+
+	return true;
+}
+
+static inline int lowestClearBit(unsigned bits)
+{
+	// ASSERT: bits != ~0U
+#if defined(__GNUC__)
+	return __builtin_ctz(~bits);
+#elif defined(WIN32)
+	unsigned long index;
+	_BitScanForward(&index, ~bits);
+	return (int)index;
+#else
+	int bit = 0;
+	while (bits&(1U<<bit)) bit++;
+	return bit;
+#endif
+}
+
+int ServerPortAllocator::findFreePair()
+{
+	if (fNumUsed >= fNumPairs)
+		return -1;
+
+	int numWords = (fNumPairs+31)/32;
+	int numSummaryWords = (numWords+31)/32;
+
+	// The first word that isn't full, from "fNextWord" on (the summary word it is in comes again last,
+	// for the words before it):
+	for (int i = 0; i <= numSummaryWords; i++) {
+		int summaryWord = (fNextWord/32 + i)%numSummaryWords;
+		unsigned full = fFullWords[summaryWord];
+		if (i == 0)
+			full |= (1U<<(fNextWord%32)) - 1;
+		if (full == ~0U) continue;
+
+		int word = summaryWord*32 + lowestClearBit(full);
+		fNextWord = word;
+		return word*32 + lowestClearBit(fBitmap[word]);
+	}
+
+	return -1;
+}
+
+void ServerPortAllocator::setPairUsed(int index, bool used)
+{
+	int word = index/32;
+	if (used) {
+		fBitmap[word] |= 1U<<(index%32);
+		if (fBitmap[word] == ~0U)
+			fFullWords[word/32] |= 1U<<(word%32);
+		fNumUsed++;
+	} else {
+		fBitmap[word] &= ~(1U<<(index%32));
+		fFullWords[word/32] &= ~(1U<<(word%32));
+		fNumUsed--;
+	}
+}
+
+bool ServerPortAllocator::allocPortPair(MySock*& rtpSock, MySock*& rtcpSock)
+{
+	int failed[MAX_PORT_BIND_FAILURES];
+	int numFailed = 0;
+
+	rtpSock = rtcpSock = NULL;
+
+	MUTEX_LOCK(&hPortMutex);
+
+	if (initBitmap()) {
+		while (numFailed < MAX_PORT_BIND_FAILURES) {
+			int index = findFreePair();
+			if (index < 0) {
+				DPRINTF("no free server port in range %d-%d\n", RTSPCommonEnv::nServerPortRangeMin, RTSPCommonEnv::nServerPortRangeMax);
+				break;
+			}
+			setPairUsed(index, true);
+
+			// A port may still be taken by another process:
+			unsigned short port = fBasePort + 2*index;
+			rtpSock = new MySock();
+			rtcpSock = new MySock();
+			if (rtpSock->setupDatagramSock(port, true) >= 0 && rtcpSock->setupDatagramSock(port+1, true) >= 0)
+				break;
+
+			DPRINTF("Rtp port(%d) already used by another process\n", port);
+			DELETE_OBJECT(rtpSock);
+			DELETE_OBJECT(rtcpSock);
+			failed[numFailed++] = index;
+		}
+
+		// The pairs that failed to bind are tried again later:
+		for (int i = 0; i < numFailed; i++)
+			setPairUsed(failed[i], false);
+		if (numFailed > 0)
+			fNextWord = (failed[numFailed-1]/32 + 1)%((fNumPairs+31)/32);
+	}
+
+	MUTEX_UNLOCK(&hPortMutex);
+
+	return rtpSock != NULL;
+}
+
+void ServerPortAllocator::releasePortPair(MySock* rtpSock, MySock* rtcpSock)
+{
+	if (rtpSock == NULL) return;
+
+	MUTEX_LOCK(&hPortMutex);
+
+	int index = (rtpSock->port() - fBasePort)/2;
+	if (fBitmap != NULL && rtpSock->port() >= fBasePort && index < fNumPairs)
+		setPairUsed(index, false);
+
+	MUTEX_UNLOCK(&hPortMutex);
+
+	delete rtpSock;
+	delete rtcpSock;
+}
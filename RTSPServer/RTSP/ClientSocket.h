@@ -2,19 +2,92 @@
 #define __CLIENT_SOCKET_H__
 
 #include "MySock.h"
+#include "TaskScheduler.h"
+
+// What a RTP/TCP client gets when its send queue is full:
+typedef enum {
+	SEND_QUEUE_DROP_PACKETS,		// the packets that don't fit are dropped
+	SEND_QUEUE_DROP_UNTIL_KEYFRAME,	// packets are dropped until the next keyframe begins
+	SEND_QUEUE_DISCONNECT			// the client is disconnected
+} SEND_QUEUE_POLICY;
+
+#define SEND_QUEUE_DEFAULT_MAX_BYTES	(2*1024*1024)
+
+// Hands out bound RTP/RTCP socket pairs from the server port range ("RTSPCommonEnv::nServerPortRangeMin/Max").
+// The pairs in use are kept in a bitmap, so finding a free one takes no system calls beyond binding it;
+// a second bitmap, of the words of the first that are full, keeps the search short when few pairs are free.
+class ServerPortAllocator
+{
+public:
+	static bool allocPortPair(MySock*& rtpSock, MySock*& rtcpSock);
+	static void releasePortPair(MySock* rtpSock, MySock* rtcpSock);
+	// closes and deletes the sockets, and makes their ports available again
+
+protected:
+	static bool initBitmap();
+	static int findFreePair();
+	static void setPairUsed(int index, bool used);
+
+	static unsigned short	fBasePort;
+	static int				fNumPairs;
+	static unsigned*		fBitmap;	// one bit per pair, set while in use
+	static unsigned*		fFullWords;	// one bit per word of "fBitmap", set while it has no free pair
+	static int				fNumUsed;
+	static int				fNextWord;	// where the search for a free pair begins
+};
 
 class ClientSocket
 {
 public:
 	ClientSocket(MySock& rtspSock, unsigned char rtpChannelId, unsigned char rtcpChannelId);
-	ClientSocket(MySock& rtpSock, struct sockaddr_in& rtpDestAddr, MySock& rtcpSock, struct sockaddr_in& rtcpDestAddr);
+	ClientSocket(MySock& rtpSock, struct sockaddr_in& rtpDestAddr, MySock& rtcpSock, struct sockaddr_in& rtcpDestAddr, bool ownSockets = true);
+	// (the UDP sockets - taken from "ServerPortAllocator" - are released with us, unless they are shared with other clients)
 	virtual ~ClientSocket();
 
-	int sendRTP(char *buf, int len);
+	int sendRTP(char *buf, int len, bool isKeyframe = true);
+	// "isKeyframe" tells whether the packet begins a keyframe (used by SEND_QUEUE_DROP_UNTIL_KEYFRAME)
 	int sendRTCP(char *buf, int len);
 	void activate();
+	void activate(unsigned short skipThroughSeq);
+	// starts sending, but skips RTP packets up to sequence number "skipThroughSeq" (which the client got already)
+
+	// RTP/TCP only: packets that can't be sent right away wait in a bounded queue,
+	// which is drained by "flushSendQueue()" when the socket becomes writable again.
+	// If the queue stays non-empty for "maxBacklogSeconds" (0 means forever), the client is disconnected.
+	void setSendQueuePolicy(unsigned maxBytes, SEND_QUEUE_POLICY policy, unsigned maxBacklogSeconds);
+	void setWriteHandler(TaskScheduler *task, TaskScheduler::BackgroundHandlerProc *handlerProc, void *clientData);
+	int flushSendQueue();
+	// returns the number of packets still queued
+
+	unsigned sendQueueCount() { return fSendQueueCount; }
+	unsigned sendQueueBytes() { return fSendQueueBytes; }
+	unsigned droppedPackets() { return fDroppedPackets; }
+	bool isDisconnected() { return fDisconnected; }
 
 	bool isActivated() { return fActive; }
+	bool isTCP() { return fIsTCP; }
+	unsigned char rtpChannelId() { return fRtpChannelId; }
+	unsigned char rtcpChannelId() { return fRtcpChannelId; }
+	MySock* rtpSock() { return fRtpSock; }
+	struct sockaddr_in& rtpDestAddr() { return fRtpDestAddr; }
+	MySock* rtcpSock() { return fRtcpSock; }
+	struct sockaddr_in& rtcpDestAddr() { return fRtcpDestAddr; }
+
+	unsigned fanoutKey() { return fFanoutKey; }
+	void setFanoutKey(unsigned key) { fFanoutKey = key; }
+	// the fan-out worker of the subsession that sends to us (see "ServerMediaSubsession::startFanoutWorkers()")
+	unsigned subsessionHandle() { return fSubsessionHandle; }
+	void setSubsessionHandle(unsigned handle) { fSubsessionHandle = handle; }
+	// where the subsession that sends to us keeps us in its set of clients
+
+	void handleRtcpPacket(char *buf, int len);
+	// notes a RTCP packet from the client; the last reception report is kept below
+
+	unsigned rtcpPacketCount() { return fRtcpPacketCount; }
+	time_t lastRtcpTime() { return fLastRtcpTime; }
+	unsigned char fractionLost() { return fFractionLost; }
+	unsigned cumulativeLost() { return fCumulativeLost; }
+	unsigned jitter() { return fJitter; }
 
 protected:
 	MySock*				fRtpSock;
@@ -25,7 +98,53 @@ protected:
 	unsigned char		fRtpChannelId;
 	unsigned char		fRtcpChannelId;
 	bool				fIsTCP;
+	bool				fOwnSockets;
 	bool				fActive;
+	unsigned			fFanoutKey;
+	unsigned			fSubsessionHandle;
+	int					fSkipThroughSeq;	// -1 if none
+
+	// from the client's RTCP reports
+	unsigned			fRtcpPacketCount;
+	time_t				fLastRtcpTime;
+	unsigned char		fFractionLost;
+	unsigned			fCumulativeLost;
+	unsigned			fJitter;
+
+protected:
+	void initSendQueue();
+	int sendOverTCP(char *buf, int len, unsigned char channelId, bool isRtp, bool isKeyframe);
+	int flushSendQueue1();
+	bool enqueue(char *buf, int len, unsigned char channelId);
+	void dequeue();
+	void disconnect(char const *reason);
+	void armWriteHandler();
+
+	struct SendQueueItem {
+		char*			buf;
+		int				len;
+		unsigned char	channelId;
+		SendQueueItem*	next;
+	};
+
+	MUTEX				fSendQueueMutex;
+	SendQueueItem*		fSendQueueHead;
+	SendQueueItem*		fSendQueueTail;
+	unsigned			fSendQueueCount;
+	unsigned			fSendQueueBytes;
+	time_t				fSendQueueSince;	// when the queue last became non-empty
+
+	unsigned			fSendQueueMaxBytes;
+	SEND_QUEUE_POLICY	fSendQueuePolicy;
+	unsigned			fMaxBacklogSeconds;
+
+	TaskScheduler*		fTask;
+	TaskScheduler::BackgroundHandlerProc*	fWriteHandlerProc;
+	void*				fWriteHandlerData;
+
+	bool				fDropUntilKeyframe;
+	bool				fDisconnected;
+	unsigned			fDroppedPackets;
 };
 
 #endif
\ No newline at end of file
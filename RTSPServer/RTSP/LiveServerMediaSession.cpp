@@ -1,5 +1,7 @@
 #include "LiveServerMediaSession.h"
 #include "util.h"
+#include "SockCommon.h"
+#include "RTSPCommonEnv.h"
 
 LiveServerMediaSession::LiveServerMediaSession(
 	const char *streamName, const char *info, const char *description, bool isSSM, const char *miscSDPLines,
@@ -13,11 +15,32 @@ LiveServerMediaSession::~LiveServerMediaSession()
 {
 }
 
+bool LiveServerMediaSession::setMulticast(char const* groupAddress, unsigned short basePort, unsigned char ttl)
+{
+	unsigned int address = inet_addr(groupAddress);
+	if (!isMulticastAddress(address)) {
+		DPRINTF("%s is not a multicast address\n", groupAddress);
+		return false;
+	}
+
+	unsigned short port = basePort&~1;
+
+	ServerMediaSubsessionIterator iter(*this);
+	ServerMediaSubsession* subsession;
+	while ((subsession = iter.next()) != NULL) {
+		subsession->setMulticast(address, port, ttl);
+		port += 2;
+	}
+
+	return true;
+}
+
 LiveServerMediaSubsession::LiveServerMediaSubsession(char const* trackId, char const* sdp, 
 													 char const* codec, unsigned char rtpPayloadType, unsigned timestampFrequency) 
 : ServerMediaSubsession(trackId, codec, rtpPayloadType, timestampFrequency)
 {
 	fSDPLines = strDup(sdp);
+	setGopCache(GOP_CACHE_DEFAULT_MAX_BYTES);
 }
 
 LiveServerMediaSubsession::~LiveServerMediaSubsession()
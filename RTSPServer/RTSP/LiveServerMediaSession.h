@@ -3,6 +3,8 @@
 
 #include "ServerMediaSession.h"
 
+#define GOP_CACHE_DEFAULT_MAX_BYTES	(2*1024*1024)
+
 class LiveServerMediaSession : public ServerMediaSession
 {
 public:
@@ -15,6 +17,10 @@ public:
 		StreamControl* streamControl = NULL);	
 
 	virtual ~LiveServerMediaSession();
+
+	bool setMulticast(char const* groupAddress, unsigned short basePort, unsigned char ttl = 255);
+	// Has the UDP clients of each subsession (added so far) join one multicast stream instead of getting
+	// their own copy. The subsessions are sent to "groupAddress", on ports "basePort", "basePort"+2, ... in turn.
 };
 
 class LiveServerMediaSubsession : public ServerMediaSubsession
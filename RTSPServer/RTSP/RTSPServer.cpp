@@ -4,32 +4,45 @@
 #include "ServerMediaSession.h"
 #include "ClientSocket.h"
 #include "util.h"
-#include "NetAddress.h"
 
 #include <stdio.h>
+#include <stdarg.h>
 
-RTSPServer* RTSPServer::fInstance = new RTSPServer();
+RTSPServer* RTSPServer::fInstance = NULL;
+static MUTEX hInstanceMutex = PTHREAD_MUTEX_INITIALIZER;
 
 RTSPServer* RTSPServer::instance()
 {
-	return fInstance;
+	MUTEX_LOCK(&hInstanceMutex);
+	if (fInstance == NULL)
+		fInstance = new RTSPServer();
+	RTSPServer *server = fInstance;
+	MUTEX_UNLOCK(&hInstanceMutex);
+
+	return server;
 }
 
 void RTSPServer::destroy()
 {
-	if (fInstance) {
-		delete fInstance;
-		fInstance = NULL;
-	}
+	MUTEX_LOCK(&hInstanceMutex);
+	RTSPServer *server = fInstance;
+	fInstance = NULL;
+	MUTEX_UNLOCK(&hInstanceMutex);
+
+	if (server) delete server;
 }
 
 char const* RTSPServer::allowedCommandNames() {
 	return "OPTIONS, DESCRIBE, SETUP, TEARDOWN, PLAY, PAUSE, GET_PARAMETER, SET_PARAMETER";
 }
 
-RTSPServer::RTSPServer() : fIsServerRunning(false), fServerCallbackFunc(NULL)
+RTSPServer::RTSPServer() : fIsServerRunning(false), fServerPort(0), fServerCallbackFunc(NULL), fServerCallbackArg(NULL)
+, fListenAddress(INADDR_ANY), fTask(NULL), fMaxClientSessions(0)
+, fSendQueueMaxBytes(SEND_QUEUE_DEFAULT_MAX_BYTES), fSendQueuePolicy(SEND_QUEUE_DROP_UNTIL_KEYFRAME), fMaxBacklogSeconds(0)
+, fSharedUdpSockets(false), fFanoutWorkers(0)
+, fDateHeaderTime(0), fDateHeaderLength(0)
+, fResponse(fResponseBuffer, sizeof fResponseBuffer)
 {
-	fTask = new TaskScheduler();
 #ifdef WIN32
 	srand(GetTickCount());
 #else
@@ -48,11 +61,14 @@ int RTSPServer::startServer(unsigned short port, RTSPServerCallback func, void *
 	if (!fIsServerRunning) {
 		fServerPort = port;
 
-		if (fServerSock.setupServerSock(fServerPort, true) < 0) {
+		if (fServerSock.setupServerSock(fServerPort, true, fListenAddress) < 0) {
 			DPRINTF("failed to start RTSP Server (%d)\n", fServerPort);
 			return -9;
 		}
 
+		if (fTask == NULL)
+			fTask = new TaskScheduler();
+
 		fServerSock.setSendBufferTo(1024*50);
 		
 		fTask->turnOnBackgroundReadHandling(fServerSock.sock(), &incomingConnectionHandlerRTSP, this);
@@ -93,85 +109,57 @@ void RTSPServer::stopServer()
 	}
 }
 
-void RTSPServer::addServerMediaSession(ServerMediaSession *serverMediaSession)
+bool RTSPServer::addServerMediaSession(ServerMediaSession *serverMediaSession)
 {
-	if (serverMediaSession == NULL) return;
-
-	removeServerMediaSession(serverMediaSession);
-
-	fServerMediaSessions.lock();
-	fServerMediaSessions.insert(serverMediaSession);
-	fServerMediaSessions.unlock();
+	if (serverMediaSession == NULL) return false;
+
+	char const* streamName = serverMediaSession->streamName();
+	if (!fServerMediaSessions.insert(streamName, serverMediaSession)) {
+		// There's already a session with this name:
+		if (fServerMediaSessions.lookup(streamName) == serverMediaSession) return true; // already added
+		DPRINTF("server session %s not added: the stream name is in use\n", streamName);
+		return false;
+	}
 
-	DPRINTF("server session %s added, count : %d\n", serverMediaSession->streamName(), fServerMediaSessions.count());
+	DPRINTF("server session %s added, count : %d\n", streamName, fServerMediaSessions.count());
+	return true;
 }
 
 void RTSPServer::removeServerMediaSession(ServerMediaSession *serverMediaSession)
 {
 	if (serverMediaSession == NULL) return;
 
-	fServerMediaSessions.lock();
-
-	fServerMediaSessions.gotoBeginCursor();
-	ServerMediaSession *cursor = fServerMediaSessions.getCursor();
-	while (cursor) {
-		if (cursor == serverMediaSession) {
-			DPRINTF("server session %s being removed\n", serverMediaSession->streamName());
-			if (serverMediaSession->referenceCount() == 0) {
-				fServerMediaSessions.remove();
-			} else {
-				serverMediaSession->deleteWhenUnreferenced() = true;
-			}
-			DPRINTF("server session count : %d\n", fServerMediaSessions.count());
-			break;
-		}
-		fServerMediaSessions.getNext();
-		cursor = fServerMediaSessions.getCursor();
+	// Take it out of the registry first (unless another session has replaced it there already), so that no new client finds it:
+	if (fServerMediaSessions.remove(serverMediaSession->streamName(), serverMediaSession) != NULL) {
+		DPRINTF("server session %s being removed\n", serverMediaSession->streamName());
+		DPRINTF("server session count : %d\n", fServerMediaSessions.count());
 	}
 
-	fServerMediaSessions.unlock();
+	if (serverMediaSession->referenceCount() == 0) {
+		delete serverMediaSession;
+	} else {
+		serverMediaSession->deleteWhenUnreferenced() = true;
+	}
 }
 
 ServerMediaSession* RTSPServer::lookupServerMediaSession(const char *streamName)
 {
 	if (streamName == NULL) return NULL;
 
-	ServerMediaSession *session = NULL;
-
-	fServerMediaSessions.lock();
-
-	fServerMediaSessions.gotoBeginCursor();
-	ServerMediaSession *cursor = fServerMediaSessions.getCursor();
-	while (cursor) {
-		if (strcmp(cursor->streamName(), streamName) == 0) {
-			session = cursor;
-			break;
-		}
-		cursor = fServerMediaSessions.getNextCursor();
-	}
-
-	fServerMediaSessions.unlock();
+	return fServerMediaSessions.lookup(streamName);
+}
 
-	return session;
+void RTSPServer::shutdownClientSessionOf(RTSPClientSession *clientSession, void *serverMediaSession)
+{
+	if (clientSession->fOurServerMediaSession == serverMediaSession)
+		clientSession->shutdown();
 }
 
 void RTSPServer::closeAllClientSessionsForServerMediaSession(ServerMediaSession *serverMediaSession)
 {
 	if (serverMediaSession == NULL) return;
 
-	fClientSessions.lock();
-
-	fClientSessions.gotoBeginCursor();
-	RTSPClientSession *cursor = fClientSessions.getCursor();
-	while (cursor) {
-		if (cursor->fOurServerMediaSession == serverMediaSession)
-			cursor->shutdown();
-		
-		fClientSessions.getNext();
-		cursor = fClientSessions.getCursor();
-	}
-
-	fClientSessions.unlock();
+	fClientSessions.forEach(shutdownClientSessionOf, serverMediaSession);
 }
 
 void RTSPServer::deleteServerMediaSession(ServerMediaSession *serverMediaSession)
@@ -182,6 +170,13 @@ void RTSPServer::deleteServerMediaSession(ServerMediaSession *serverMediaSession
 	removeServerMediaSession(serverMediaSession);
 }
 
+void RTSPServer::setClientSendQueue(unsigned maxBytes, SEND_QUEUE_POLICY policy, unsigned maxBacklogSeconds)
+{
+	fSendQueueMaxBytes = maxBytes;
+	fSendQueuePolicy = policy;
+	fMaxBacklogSeconds = maxBacklogSeconds;
+}
+
 char* RTSPServer::rtspURL(ServerMediaSession const* serverMediaSession, int clientSocket) 
 {
 	char* urlPrefix = rtspURLPrefix(clientSocket);
@@ -198,23 +193,44 @@ char* RTSPServer::rtspURLPrefix(int clientSocket)
 {
 	struct sockaddr_in ourAddress;
 	if (clientSocket < 0) {
-		// Use our default IP address in the URL:
-		ourAddress.sin_addr.s_addr = ReceivingInterfaceAddr != 0 ? ReceivingInterfaceAddr : ourIPAddress(); // hack
+		// Use the address we listen on, or else our default IP address, in the URL:
+		if (fListenAddress != INADDR_ANY)
+			ourAddress.sin_addr.s_addr = fListenAddress;
+		else
+			ourAddress.sin_addr.s_addr = ReceivingInterfaceAddr != 0 ? ReceivingInterfaceAddr : ourIPAddress(); // hack
 	} else {
 		socklen_t namelen = sizeof ourAddress;
 		getsockname(clientSocket, (struct sockaddr*)&ourAddress, &namelen);
 	}
 
 	char urlBuffer[100]; // more than big enough for "rtsp://<ip-address>:<port>/"
+	ResponseWriter writer(urlBuffer, sizeof urlBuffer);
+	appendRTSPURLPrefix(writer, ourAddress.sin_addr.s_addr);
+
+	return strDup(urlBuffer);
+}
+
+void RTSPServer::appendRTSPURLPrefix(ResponseWriter& writer, unsigned int ourAddress)
+{
+	writer.appendFragment("rtsp://");
+	writer.appendAddress(ourAddress);
 
 	unsigned short port = fServerSock.port();
-	if (port == 554 /* the default port number */) {
-		sprintf(urlBuffer, "rtsp://%s/", inet_ntoa(ourAddress.sin_addr));
-	} else {
-		sprintf(urlBuffer, "rtsp://%s:%hu/", inet_ntoa(ourAddress.sin_addr), port);
+	if (port != 554 /* the default port number */) {
+		writer.appendFragment(":");
+		writer.appendUnsigned(port);
 	}
+	writer.appendFragment("/");
+}
 
-	return strDup(urlBuffer);
+void RTSPServer::appendDateHeader(ResponseWriter& writer)
+{
+	time_t tt = time(NULL);
+	if (tt != fDateHeaderTime || fDateHeaderLength == 0) {
+		fDateHeaderLength = strftime(fDateHeader, sizeof fDateHeader, "Date: %a, %b %d %Y %H:%M:%S GMT\r\n", gmtime(&tt));
+		fDateHeaderTime = tt;
+	}
+	writer.append(fDateHeader, fDateHeaderLength);
 }
 
 void RTSPServer::incomingConnectionHandlerRTSP(void *instance, int)
@@ -236,54 +252,53 @@ void RTSPServer::incomingConnectionHandler(int serverSocket)
 		return;
 	}
 
+	if (fMaxClientSessions > 0 && fClientSessions.count() >= fMaxClientSessions) {
+		DPRINTF("client session limit (%d) reached, connection from %s refused\n",
+			fMaxClientSessions, inet_ntoa(clientSock->clientAddress().sin_addr));
+		delete clientSock;
+		return;
+	}
+
 	addClientSession(createNewClientSession(*clientSock));
 }
 
 RTSPServer::RTSPClientSession* RTSPServer::createNewClientSession(MySock &clientSock)
 {
-	return new RTSPClientSession(*this, clientSock, rand());
+	return new RTSPClientSession(*this, clientSock, newClientSessionId());
 }
 
-void RTSPServer::addClientSession(RTSPClientSession *clientSession)
+u_int64_t RTSPServer::newClientSessionId()
 {
-	fClientSessions.lock();
-	fClientSessions.insert(clientSession);
+	// (Client sessions are created only on the thread of "fTask", so the id is still unused when it gets added.)
+	u_int64_t sessionId;
+	do {
+		sessionId = secureRandom64();
+	} while (sessionId == 0 || fClientSessions.lookup(sessionId) != NULL);
 
-	//DPRINTF("client session %u added, count : %d\n", clientSession->fOurSessionId, fClientSessions.count());
+	return sessionId;
+}
 
-	fClientSessions.unlock();
+void RTSPServer::addClientSession(RTSPClientSession *clientSession)
+{
+	fClientSessions.insert(clientSession->fOurSessionId, clientSession);
 }
 
 void RTSPServer::removeClientSession(RTSPClientSession *clientSession)
 {
-	fClientSessions.lock();
-
-	fClientSessions.gotoBeginCursor();
-	RTSPClientSession *cursor = fClientSessions.getCursor();
-	while (cursor) {
-		if (cursor == clientSession) {
-			fClientSessions.deleteCursor();
-			//DPRINTF("client session %u removed, count : %d\n", clientSession->fOurSessionId, fClientSessions.count());
-			break;
-		}
-		fClientSessions.getNext();
-		cursor = fClientSessions.getCursor();
-	}
-
-	fClientSessions.unlock();
+	fClientSessions.remove(clientSession->fOurSessionId, clientSession);
 }
 
-RTSPServer::RTSPClientSession::RTSPClientSession(RTSPServer &ourServer, MySock &clientSock, unsigned int sessionId)
+RTSPServer::RTSPClientSession::RTSPClientSession(RTSPServer &ourServer, MySock &clientSock, u_int64_t sessionId)
 : fOurServer(ourServer), fOurSessionId(sessionId), fOurServerMediaSession(NULL), fClientSock(&clientSock), fIsActive(true)
+, fResponse(ourServer.fResponse)
 , fIsMulticast(false), fTCPStreamIdCount(0)
 , fNumStreamStates(0), fStreamStates(NULL)
 {
-	fTCPReadingState = AWAITING_DOLLAR;
-	fRtpBuffer = new char[1024*1024];
-	fRtpBufferIdx = 0;
-	fRtpBufferSize = 1024*1024;
+	fRtpBuffer = NULL;	// until something arrives
+	fRtpBufferSize = fRtpBufferIdx = fRtpBufferReadIdx = 0;
+	fCurrentCSeq.str = "";
+	fCurrentCSeq.len = 0;
 
-	resetRequestBuffer();
 	fOurServer.fTask->turnOnBackgroundReadHandling(fClientSock->sock(), incomingRequestHandler, this);
 }
 
@@ -298,11 +313,14 @@ RTSPServer::RTSPClientSession::~RTSPClientSession()
 		fOurServer.fServerCallbackFunc(fOurServer.fServerCallbackArg, param);
 	}
 
+	// Remove our client sockets from the subsessions first, so that nothing is queued for us any more:
+	reclaimStreamStates();
+
+	fOurServer.fTask->turnOffBackgroundWriteHandling(fClientSock->sock());
+
 	if (fClientSock)
 		delete fClientSock;
 
-	reclaimStreamStates();
-
 	if (fOurServerMediaSession != NULL) {
 		fOurServerMediaSession->decrementReferenceCount();
 		if (fOurServerMediaSession->referenceCount() == 0 && fOurServerMediaSession->deleteWhenUnreferenced()) {
@@ -320,15 +338,20 @@ RTSPServer::RTSPClientSession::~RTSPClientSession()
 
 void RTSPServer::RTSPClientSession::reclaimStreamStates()
 {
+	for (unsigned i = 0; i < fNumStreamStates; i++) {
+		if (fStreamStates[i].isMulticastMember && fOurServerMediaSession)
+			fStreamStates[i].subsession->removeMulticastMember();
+	}
+
 	delete[] fStreamStates; fStreamStates = NULL;
 	fNumStreamStates = 0;
 
-	fClientSockList.gotoBeginCursor();
-	ClientSocket *cursor = fClientSockList.getNextCursor();
-	while (cursor) {
+	for (int i = 0; i < fClientSockList.count(); i++) {
+		ClientSocket *cursor = fClientSockList.at(i);
+		if (cursor->droppedPackets() > 0)
+			DPRINTF("client session %016llX: %u packets dropped on channel %d\n", (unsigned long long)fOurSessionId, cursor->droppedPackets(), cursor->rtpChannelId());
 		if (fOurServerMediaSession)
 			fOurServerMediaSession->removeClientSocket(cursor);
-		cursor = fClientSockList.getNextCursor();
 	}
 
 	fClientSockList.clearList();
@@ -339,24 +362,32 @@ void RTSPServer::RTSPClientSession::shutdown()
 	fClientSock->shutdown();
 }
 
-void RTSPServer::RTSPClientSession::resetRequestBuffer()
-{
-	fRequestBytesAlreadySeen = 0;
-	fRequestBufferBytesLeft = sizeof(fRequestBuffer);
-	fLastCRLF = &fRequestBuffer[-3];
-	fBase64RemainderCount = 0;
-}
-
 typedef enum StreamingMode {
 	RTP_UDP,
 	RTP_TCP,
 	RAW_UDP
 } StreamingMode;
 
-static void parseTransportHeader(char const* buf,
+static unsigned parseNumberRange(char const* str, unsigned len, unsigned& n1, unsigned& n2)
+{
+	// Parses "<n1>[-<n2>]"; returns how many of the numbers there were:
+	unsigned* n = &n1;
+	unsigned i = 0, count = 0;
+	while (count < 2) {
+		unsigned start = i;
+		for (*n = 0; i < len && str[i] >= '0' && str[i] <= '9'; i++) *n = *n*10 + (str[i]-'0');
+		if (i == start) break;
+		++count;
+		if (i == len || str[i] != '-') break;
+		++i;
+		n = &n2;
+	}
+	return count;
+}
+
+static void parseTransportHeader(RTSPField const* transport,
 								 StreamingMode& streamingMode,
-								 char*& streamingModeString,
-								 char*& destinationAddressStr,
+								 char const*& streamingModeString,
 								 u_int8_t& destinationTTL,
 								 unsigned short& clientRTPPortNum, // if UDP
 								 unsigned short& clientRTCPPortNum, // if UDP
@@ -367,55 +398,51 @@ static void parseTransportHeader(char const* buf,
 	// Initialize the result parameters to default values:
 	streamingMode = RTP_UDP;
 	streamingModeString = NULL;
-	destinationAddressStr = NULL;
 	destinationTTL = 255;
 	clientRTPPortNum = 0;
 	clientRTCPPortNum = 1;
 	rtpChannelId = rtcpChannelId = 0xFF;
 
-	unsigned short p1, p2;
-	unsigned ttl, rtpCid, rtcpCid;
+	if (transport == NULL) return; // there was no "Transport:" header
 
-	// First, find "Transport:"
-	while (1) {
-		if (*buf == '\0') return; // not found
-		if (*buf == '\r' && *(buf+1) == '\n' && *(buf+2) == '\r') return; // end of the headers => not found
-		if (_strcasecmp(buf, "Transport:", 10) == 0) break;
-		++buf;
-	}
+	// Run through each of the fields, looking for ones we handle:
+	char const* fields = transport->str;
+	char const* end = fields + transport->len;
+	while (fields < end) {
+		RTSPField field;
+		field.str = fields;
+		while (fields < end && *fields != ';') ++fields;
+		field.len = fields - field.str;
+		while (fields < end && (*fields == ';' || *fields == ' ' || *fields == '\t')) ++fields; // skip over separating ';' chars or whitespace
 
-	// Then, run through each of the fields, looking for ones we handle:
-	char const* fields = buf + 10;
-	while (*fields == ' ') ++fields;
-	char* field = strDupSize(fields);
-	while (sscanf(fields, "%[^;\r\n]", field) == 1) {
-		if (strcmp(field, "RTP/AVP/TCP") == 0) {
+		unsigned n1, n2;
+		if (field.equals("RTP/AVP/TCP")) {
 			streamingMode = RTP_TCP;
-		} else if (strcmp(field, "RAW/RAW/UDP") == 0 ||
-			strcmp(field, "MP2T/H2221/UDP") == 0) {
-				streamingMode = RAW_UDP;
-				streamingModeString = strDup(field);
-		} else if (_strcasecmp(field, "destination=", 12) == 0) {
-			delete[] destinationAddressStr;
-			destinationAddressStr = strDup(field+12);
-		} else if (sscanf(field, "ttl%u", &ttl) == 1) {
-			destinationTTL = (u_int8_t)ttl;
-		} else if (sscanf(field, "client_port=%hu-%hu", &p1, &p2) == 2) {
-			clientRTPPortNum = p1;
-			clientRTCPPortNum = streamingMode == RAW_UDP ? 0 : p2; // ignore the second port number if the client asked for raw UDP
-		} else if (sscanf(field, "client_port=%hu", &p1) == 1) {
-			clientRTPPortNum = p1;
-			clientRTCPPortNum = streamingMode == RAW_UDP ? 0 : p1 + 1;
-		} else if (sscanf(field, "interleaved=%u-%u", &rtpCid, &rtcpCid) == 2) {
-			rtpChannelId = (unsigned char)rtpCid;
-			rtcpChannelId = (unsigned char)rtcpCid;
+		} else if (field.equals("RAW/RAW/UDP")) {
+			streamingMode = RAW_UDP;
+			streamingModeString = "RAW/RAW/UDP";
+		} else if (field.equals("MP2T/H2221/UDP")) {
+			streamingMode = RAW_UDP;
+			streamingModeString = "MP2T/H2221/UDP";
+		} else if (field.startsWith("ttl=")) {
+			if (parseNumberRange(field.str+4, field.len-4, n1, n2) >= 1)
+				destinationTTL = (u_int8_t)n1;
+		} else if (field.startsWith("client_port=")) {
+			unsigned count = parseNumberRange(field.str+12, field.len-12, n1, n2);
+			if (count == 2) {
+				clientRTPPortNum = (unsigned short)n1;
+				clientRTCPPortNum = streamingMode == RAW_UDP ? 0 : (unsigned short)n2; // ignore the second port number if the client asked for raw UDP
+			} else if (count == 1) {
+				clientRTPPortNum = (unsigned short)n1;
+				clientRTCPPortNum = streamingMode == RAW_UDP ? 0 : (unsigned short)(n1 + 1);
+			}
+		} else if (field.startsWith("interleaved=")) {
+			if (parseNumberRange(field.str+12, field.len-12, n1, n2) == 2) {
+				rtpChannelId = (unsigned char)n1;
+				rtcpChannelId = (unsigned char)n2;
+			}
 		}
-
-		fields += strlen(field);
-		while (*fields == ';' || *fields == ' ' || *fields == '\t') ++fields; // skip over separating ';' chars or whitespace
-		if (*fields == '\0' || *fields == '\r' || *fields == '\n') break;
 	}
-	delete[] field;
 }
 
 void RTSPServer::RTSPClientSession::incomingRequestHandler(void *instance, int)
@@ -424,236 +451,257 @@ void RTSPServer::RTSPClientSession::incomingRequestHandler(void *instance, int)
 	session->tcpReadHandler1();
 }
 
-void RTSPServer::RTSPClientSession::incomingRequestHandler1(unsigned char requestByte)
+void RTSPServer::RTSPClientSession::outgoingDataHandler(void *instance, int)
 {
-	if (fRequestBufferBytesLeft == 0 || fRequestBytesAlreadySeen >= RTSP_BUFFER_SIZE)
-		return;
+	RTSPClientSession *session = (RTSPClientSession *)instance;
+	session->flushSendQueues();
+}
 
-	fRequestBuffer[fRequestBytesAlreadySeen] = requestByte;
-	handleRequestBytes(1);
+void RTSPServer::RTSPClientSession::flushSendQueues()
+{
+	// Turn the handler off before flushing, so that a packet queued meanwhile turns it on again:
+	fOurServer.fTask->turnOffBackgroundWriteHandling(fClientSock->sock());
+
+	// The rest of a partly sent frame goes first; then the queued packets of each track:
+	bool pending = fClientSock->flushPendingFrame() > 0;
+	if (!pending) {
+		for (int i = 0; i < fClientSockList.count(); i++) {
+			if (fClientSockList.at(i)->flushSendQueue() > 0)
+				pending = true;
+		}
+		if (fClientSock->hasPendingFrame())
+			pending = true;
+	}
 
-	struct sockaddr_in dummy;
-	int bytesRead = fClientSock->readSocket1((char *)&fRequestBuffer[fRequestBytesAlreadySeen], fRequestBufferBytesLeft, dummy);
-	handleRequestBytes(bytesRead);
+	if (pending)
+		fOurServer.fTask->turnOnBackgroundWriteHandling(fClientSock->sock(), outgoingDataHandler, this);
 }
 
-void RTSPServer::RTSPClientSession::handleRequestBytes(int newBytesRead)
+void RTSPServer::RTSPClientSession::tcpReadHandler1()
 {
-	int numBytesRemaining = 0;
+	struct sockaddr_in fromAddress;
 
-	do
-	{
-		if (newBytesRead <= 0 || (unsigned)newBytesRead >= fRequestBufferBytesLeft) {
-			// Either the client socket has died, or the request was too big for us.
-			// Terminate this connection:
-			DPRINTF("RTSPClientConnection[%p]::handleRequestBytes() read %d new bytes (of %d); terminating connection!\n", this, newBytesRead, fRequestBufferBytesLeft);
-			fIsActive = false;
-			break;
-		}
+	if (fRtpBuffer == NULL) {
+		fRtpBufferSize = RTSP_READ_BUFFER_INITIAL_SIZE;
+		fRtpBuffer = new char[fRtpBufferSize+1];	// +1 for '\0' after a request
+	}
 
-		bool endOfMsg = false;
-		unsigned char *ptr = &fRequestBuffer[fRequestBytesAlreadySeen];
+	// Make room for the next read by moving the remaining partial message to the front:
+	if (fRtpBufferSize - fRtpBufferIdx < fRtpBufferSize/2 && fRtpBufferReadIdx > 0) {
+		int remain = fRtpBufferIdx - fRtpBufferReadIdx;
+		memmove(fRtpBuffer, &fRtpBuffer[fRtpBufferReadIdx], remain);
+		fRtpBufferReadIdx = 0;
+		fRtpBufferIdx = remain;
+	}
 
-		if (RTSPCommonEnv::nDebugFlag&DEBUG_FLAG_RTSP) {
-			ptr[newBytesRead] = '\0';
-			DPRINTF("RTSPClientConnection[%p]::handleRequestBytes() %s %d new bytes:\n%s\n",
-				this, numBytesRemaining > 0 ? "processing" : "read", newBytesRead, ptr);
+	// If a partial message fills the buffer, then grow it:
+	if (fRtpBufferIdx == fRtpBufferSize) {
+		if (fRtpBufferSize >= RTSP_READ_BUFFER_MAX_SIZE) {
+			DPRINTF("RTSPClientConnection[%p]::tcpReadHandler1() %d bytes without a complete message; terminating connection!\n", this, fRtpBufferIdx);
+			delete this;
+			return;
 		}
+		int newSize = fRtpBufferSize*2 < RTSP_READ_BUFFER_MAX_SIZE ? fRtpBufferSize*2 : RTSP_READ_BUFFER_MAX_SIZE;
+		char *newBuffer = new char[newSize+1];
+		memcpy(newBuffer, fRtpBuffer, fRtpBufferIdx);
+		delete[] fRtpBuffer;
+		fRtpBuffer = newBuffer;
+		fRtpBufferSize = newSize;
+	}
 
-		unsigned char *tmpPtr = fLastCRLF + 2;
-		if (fBase64RemainderCount == 0) { // no more Base-64 bytes remain to be read/decoded
-			// Look for the end of the message: <CR><LF><CR><LF>
-			if (tmpPtr < fRequestBuffer) tmpPtr = fRequestBuffer;
-			while (tmpPtr < &ptr[newBytesRead-1]) {
-				if (*tmpPtr == '\r' && *(tmpPtr+1) == '\n') {
-					if (tmpPtr - fLastCRLF == 2) { // This is it:
-						endOfMsg = true;
-						break;
-					}
-					fLastCRLF = tmpPtr;
-				}
-				++tmpPtr;
-			}
-		}
+	int result = fClientSock->readSocket1(&fRtpBuffer[fRtpBufferIdx], fRtpBufferSize - fRtpBufferIdx, fromAddress);
+	if (result <= 0) {
+		// The client socket has died; terminate this connection:
+		DPRINTF("RTSPClientConnection[%p]::tcpReadHandler1() read %d new bytes; terminating connection!\n", this, result);
+		delete this;
+		return;
+	}
 
-		fRequestBufferBytesLeft -= newBytesRead;
-		fRequestBytesAlreadySeen += newBytesRead;
+	fRtpBufferIdx += result;
 
-		if (!endOfMsg) break; // subsequent reads will be needed to complete the request
+	// Handle every complete (pipelined) request and interleaved frame that we have now:
+	while (fIsActive && fRtpBufferReadIdx < fRtpBufferIdx)
+	{
+		char *buf = &fRtpBuffer[fRtpBufferReadIdx];
+		int len = fRtpBufferIdx - fRtpBufferReadIdx;
+		int consumed;
 
-		// Parse the request string into command name and 'CSeq', then handle the command:
-		fRequestBuffer[fRequestBytesAlreadySeen] = '\0';
-		char cmdName[RTSP_PARAM_STRING_MAX];
-		char urlPreSuffix[RTSP_PARAM_STRING_MAX];
-		char urlSuffix[RTSP_PARAM_STRING_MAX];
-		char cseq[RTSP_PARAM_STRING_MAX];
-		char sessionIdStr[RTSP_PARAM_STRING_MAX];
-		unsigned contentLength = 0;
+		if (buf[0] == '$')
+			consumed = handleInterleavedFrame(buf, len);
+		else
+			consumed = handleRequest(buf, len);
 
-		fLastCRLF[2] = '\0'; // temporarily, for parsing
+		if (consumed == 0) break;	// incomplete; wait for more data
+		fRtpBufferReadIdx += consumed;
+	}
 
-		bool parseSucceeded = parseRTSPRequestString((char*)fRequestBuffer, fLastCRLF+2 - fRequestBuffer,
-			cmdName, sizeof cmdName,
-			urlPreSuffix, sizeof urlPreSuffix,
-			urlSuffix, sizeof urlSuffix,
-			cseq, sizeof cseq,
-			sessionIdStr, sizeof sessionIdStr,
-			contentLength);
+	if (!fIsActive) {
+		delete this;
+		return;
+	}
 
-		fLastCRLF[2] = '\r'; // restore its value
-		bool playAfterSetup = false;
+	if (fRtpBufferReadIdx == fRtpBufferIdx) {
+		fRtpBufferReadIdx = fRtpBufferIdx = 0;
 
-		if (parseSucceeded) {
-#ifdef _DEBUG
-			//DPRINTF("parseRTSPRequestString() succeeded, returning cmdName \"%s\", urlPreSuffix \"%s\", urlSuffix \"%s\", CSeq \"%s\", Content-Length %u, with %ld bytes following the message.\n", cmdName, urlPreSuffix, urlSuffix, cseq, contentLength, ptr + newBytesRead - (tmpPtr + 2));
-#endif
-			// If there was a "Content-Length:" header, then make sure we've received all of the data that it specified:
-			if (ptr + newBytesRead < tmpPtr + 2 + contentLength) 
-				break; // we still need more data; subsequent reads will give it to us
-
-			// We now have a complete RTSP request.
-			// Handle the specified command (beginning with commands that are session-independent):
-			fCurrentCSeq = cseq;
-			if (strcmp(cmdName, "OPTIONS") == 0) {
-				handleCmd_OPTIONS();
-			} else if (urlPreSuffix[0] == '\0' && urlSuffix[0] == '*' && urlSuffix[1] == '\0') {
-				// The special "*" URL means: an operation on the entire server.  This works only for GET_PARAMETER and SET_PARAMETER:
-				if (strcmp(cmdName, "GET_PARAMETER") == 0) {
-					handleCmd_notSupported();
-				} else if (strcmp(cmdName, "SET_PARAMETER") == 0) {
-					handleCmd_notSupported();
-				}
-			} else if (strcmp(cmdName, "DESCRIBE") == 0) {
-				handleCmd_DESCRIBE(urlPreSuffix, urlSuffix, (const char*)fRequestBuffer);
-			} else if (strcmp(cmdName, "SETUP") == 0) {
-				handleCmd_SETUP(urlPreSuffix, urlSuffix, (const char*)fRequestBuffer);
-			} else if (strcmp(cmdName, "TEARDOWN") == 0
-				|| strcmp(cmdName, "PLAY") == 0
-				|| strcmp(cmdName, "PAUSE") == 0
-				|| strcmp(cmdName, "GET_PARAMETER") == 0
-				|| strcmp(cmdName, "SET_PARAMETER") == 0) 
-			{
-				handleCmd_withinSession(cmdName, urlPreSuffix, urlSuffix, (char const*)fRequestBuffer);
-			} else {
-				handleCmd_notSupported();
-			}
-		} else {
-			handleCmd_bad();
+		// Don't keep a buffer that was grown for a big message:
+		if (fRtpBufferSize > RTSP_READ_BUFFER_INITIAL_SIZE) {
+			delete[] fRtpBuffer; fRtpBuffer = NULL;
+			fRtpBufferSize = 0;
 		}
+	}
+}
 
-		if (RTSPCommonEnv::nDebugFlag&DEBUG_FLAG_RTSP)
-			DPRINTF("sending response:\n%s\n", fResponseBuffer);
+int RTSPServer::RTSPClientSession::handleInterleavedFrame(char *buf, int len)
+{
+	if (len < 4)
+		return 0;
 
-		fClientSock->writeSocket((char *)fResponseBuffer, strlen((char *)fResponseBuffer));
+	unsigned char channel = (unsigned char)buf[1];
+	int size = ((unsigned char)buf[2]<<8) | (unsigned char)buf[3];
+	if (len < 4+size)
+		return 0;
 
-		// Check whether there are extra bytes remaining in the buffer, after the end of the request (a rare case).
-		// If so, move them to the front of our buffer, and keep processing it, because it might be a following, pipelined request.
-		unsigned requestSize = (fLastCRLF+4-fRequestBuffer) + contentLength;
-		numBytesRemaining = fRequestBytesAlreadySeen - requestSize;
-		resetRequestBuffer(); // to prepare for any subsequent request
+	if (RTSPCommonEnv::nDebugFlag&DEBUG_FLAG_RTP)
+		DPRINTF("channel id: %d, size: %d\n", channel, size);
 
-		if (numBytesRemaining > 0) {
-			memmove(fRequestBuffer, &fRequestBuffer[requestSize], numBytesRemaining);
-			newBytesRead = numBytesRemaining;
-		}
-	} while (numBytesRemaining > 0);
+	ClientSocket *clientSock = lookupStreamChannelId(channel);
+	if (clientSock != NULL && channel == clientSock->rtcpChannelId())
+		clientSock->handleRtcpPacket(&buf[4], size);
 
-	if (!fIsActive) {
-		delete this;
-	}
+	return 4+size;
 }
 
-void RTSPServer::RTSPClientSession::tcpReadHandler1()
+ClientSocket* RTSPServer::RTSPClientSession::lookupStreamChannelId(unsigned char channel)
 {
-	int result = 0;
-	unsigned char c;
-	struct sockaddr_in fromAddress;
+	for (int i = 0; i < fClientSockList.count(); i++) {
+		ClientSocket *clientSock = fClientSockList.at(i);
+		if (clientSock->isTCP() && (channel == clientSock->rtpChannelId() || channel == clientSock->rtcpChannelId()))
+			return clientSock;
+	}
 
-	if (fTCPReadingState != AWAITING_PACKET_DATA) {
-		result = fClientSock->readSocket1((char *)&c, 1, fromAddress);
-		if (result != 1) {
-			handleRequestBytes(result);
-			return;
+	return NULL;
+}
+
+int RTSPServer::RTSPClientSession::handleRequest(char *buf, int len)
+{
+	// Skip any <CR><LF> between requests:
+	if (buf[0] == '\r' || buf[0] == '\n')
+		return 1;
+
+	// Carry on parsing the request from where the previous read left off:
+	int headerSize = fRequestParser.parse(buf, len);
+	if (headerSize == 0) {
+		if (len >= RTSP_BUFFER_SIZE) {
+			// The request was too big for us. Terminate this connection:
+			DPRINTF("RTSPClientConnection[%p]::handleRequest() %d bytes without the end of a request; terminating connection!\n", this, len);
+			fIsActive = false;
+			return len;
 		}
+		return 0;	// subsequent reads will be needed to complete the request
 	}
 
-	switch (fTCPReadingState)
-	{
-	case AWAITING_DOLLAR: {
-		if (c == '$') {
-			fTCPReadingState = AWAITING_STREAM_CHANNEL_ID;
-		} else {
-			incomingRequestHandler1(c);
-		}
-						  } break;
-	case AWAITING_STREAM_CHANNEL_ID: {
-		if (lookupStreamChannelId(c)) {
-			fStreamChannelId = c;
-			fTCPReadingState = AWAITING_SIZE1;
-
-			if (RTSPCommonEnv::nDebugFlag&DEBUG_FLAG_RTP)
-				DPRINTF("channel id: %d\n", fStreamChannelId);
-		} else {
-			fTCPReadingState = AWAITING_DOLLAR;
+	bool parseSucceeded = fRequestParser.isValid();
+
+	int requestSize = headerSize;
+	if (parseSucceeded) {
+		// If there was a "Content-Length:" header, then make sure we've received all of the data that it specified:
+		requestSize += fRequestParser.contentLength();
+		if (requestSize > RTSP_READ_BUFFER_MAX_SIZE) {
+			DPRINTF("RTSPClientConnection[%p]::handleRequest() request of %d bytes is too big; terminating connection!\n", this, requestSize);
+			fIsActive = false;
+			return len;
 		}
-									 } break;
-	case AWAITING_SIZE1: {
-		fSizeByte1 = c;
-		fTCPReadingState = AWAITING_SIZE2;
-						 } break;
-	case AWAITING_SIZE2: {
-		fTCPReadSize = (fSizeByte1<<8) | c;
-		fTCPReadingState = AWAITING_PACKET_DATA;
-		fRtpBufferIdx = 0;
-
-		if (RTSPCommonEnv::nDebugFlag&DEBUG_FLAG_RTP)
-			DPRINTF("size: %d\n", fTCPReadSize);
-						 } break;
-	case AWAITING_PACKET_DATA: {
-		readRTPOverTCP();
-							   } break;
+		if (len < requestSize)
+			return 0; // we still need more data; subsequent reads will give it to us
 	}
-}
 
-bool RTSPServer::RTSPClientSession::lookupStreamChannelId(unsigned char channel)
-{	
-	return true;	// dummy
-}
+	// We now have a complete RTSP request; terminate it (temporarily) for the handlers:
+	char savedByte = buf[requestSize];
+	buf[requestSize] = '\0';
 
-void RTSPServer::RTSPClientSession::readRTPOverTCP()
-{
-	int bytesRead = fTCPReadSize - fRtpBufferIdx;
-	struct sockaddr_in fromAddress;
+	if (RTSPCommonEnv::nDebugFlag&DEBUG_FLAG_RTSP)
+		DPRINTF("RTSPClientConnection[%p]::handleRequest() %d bytes:\n%s\n", this, requestSize, buf);
 
-	int result = fClientSock->readSocket1(&fRtpBuffer[fRtpBufferIdx], bytesRead, fromAddress);
-	if (result <= 0) {
-		handleRequestBytes(result);
-		return;
+	// The handlers want the URL as strings (with any %<hex><hex> decoded):
+	char urlPreSuffix[RTSP_PARAM_STRING_MAX];
+	char urlSuffix[RTSP_PARAM_STRING_MAX];
+	if (fRequestParser.urlPreSuffix().len >= sizeof urlPreSuffix || fRequestParser.urlSuffix().len >= sizeof urlSuffix) {
+		parseSucceeded = false; // there's no room
+	} else {
+		fRequestParser.urlPreSuffix().copyTo(urlPreSuffix, sizeof urlPreSuffix);
+		decodeURL(urlPreSuffix);
+		fRequestParser.urlSuffix().copyTo(urlSuffix, sizeof urlSuffix);
 	}
 
-	fRtpBufferIdx += result;
+	fResponse.reset();
+
+	if (parseSucceeded) {
+		// Handle the specified command (beginning with commands that are session-independent):
+		RTSPField const& cmdName = fRequestParser.method();
+		fCurrentCSeq = fRequestParser.cseq();
+		if (cmdName.equals("OPTIONS")) {
+			handleCmd_OPTIONS();
+		} else if (urlPreSuffix[0] == '\0' && urlSuffix[0] == '*' && urlSuffix[1] == '\0') {
+			// The special "*" URL means: an operation on the entire server.  This works only for GET_PARAMETER and SET_PARAMETER:
+			if (cmdName.equals("GET_PARAMETER")) {
+				handleCmd_notSupported();
+			} else if (cmdName.equals("SET_PARAMETER")) {
+				handleCmd_notSupported();
+			}
+		} else if (cmdName.equals("DESCRIBE")) {
+			handleCmd_DESCRIBE(urlPreSuffix, urlSuffix);
+		} else if (cmdName.equals("SETUP")) {
+			handleCmd_SETUP(urlPreSuffix, urlSuffix);
+		} else if (cmdName.equals("TEARDOWN")
+			|| cmdName.equals("PLAY")
+			|| cmdName.equals("PAUSE")
+			|| cmdName.equals("GET_PARAMETER")
+			|| cmdName.equals("SET_PARAMETER")) 
+		{
+			handleCmd_withinSession(cmdName, urlPreSuffix, urlSuffix, &buf[headerSize]);
+		} else {
+			handleCmd_notSupported();
+		}
+	} else {
+		handleCmd_bad();
+	}
 
-	if (fRtpBufferIdx != fTCPReadSize) 
-		return;
+	buf[requestSize] = savedByte;
+	fRequestParser.reset();
 
-	fTCPReadingState = AWAITING_DOLLAR;	
-	fRtpBufferIdx = 0;
+	if (fResponse.overflowed())
+		DPRINTF("RTSPClientConnection[%p]::handleRequest() response cut off at %u bytes\n", this, fResponse.length());
+
+	if (RTSPCommonEnv::nDebugFlag&DEBUG_FLAG_RTSP)
+		DPRINTF("sending response:\n%s\n", fResponse.data());
+
+	// (What can't be sent now - e.g. behind the rest of a partly sent RTP/TCP frame - goes out from "flushSendQueues()")
+	if (fResponse.length() > 0) {
+		if (fClientSock->writeSocket1((char *)fResponse.data(), fResponse.length()) < 0) {
+			DPRINTF("RTSPClientConnection[%p]::handleRequest() failed to send the response; terminating connection!\n", this);
+			fClientSock->shutdown();
+		} else if (fClientSock->hasPendingFrame()) {
+			fOurServer.fTask->turnOnBackgroundWriteHandling(fClientSock->sock(), outgoingDataHandler, this);
+		}
+	}
+
+	return requestSize;
 }
 
 // Handler routines for specific RTSP commands:
 
 void RTSPServer::RTSPClientSession::handleCmd_OPTIONS() 
 {
-	snprintf((char*)fResponseBuffer, sizeof fResponseBuffer,
-		"RTSP/1.0 200 OK\r\nCSeq: %s\r\n%sPublic: %s\r\n\r\n",
-		fCurrentCSeq, dateHeader(), fOurServer.allowedCommandNames());
+	startResponse("200 OK");
+	fResponse.appendFragment("Public: ");
+	fResponse.append(fOurServer.allowedCommandNames());
+	fResponse.appendFragment("\r\n\r\n");
 }
 
-void RTSPServer::RTSPClientSession::handleCmd_DESCRIBE(const char *urlPreSuffix, const char *urlSuffix, const char *fullRequestStr)
+void RTSPServer::RTSPClientSession::handleCmd_DESCRIBE(const char *urlPreSuffix, const char *urlSuffix)
 {
 	ServerMediaSession* session = NULL;
-	char* sdpDescription = NULL;
-	char* rtspURL = NULL;
+	ServerMediaSession::SDPDescription* sdpDescription = NULL;
 	do {
 		char urlTotalSuffix[RTSP_PARAM_STRING_MAX];
 		if (strlen(urlPreSuffix) + strlen(urlSuffix) + 2 > sizeof urlTotalSuffix) {
@@ -695,39 +743,36 @@ void RTSPServer::RTSPClientSession::handleCmd_DESCRIBE(const char *urlPreSuffix,
 			}
 		}
 
-		// Then, assemble a SDP description for this session:
-		sdpDescription = session->generateSDPDescription();
+		// Then, get the SDP description for this session, as seen through the interface the client connected to
+		// (it's generated once, and then kept until the session's subsessions change):
+		struct sockaddr_in ourAddress;
+		socklen_t namelen = sizeof ourAddress;
+		if (getsockname(fClientSock->sock(), (struct sockaddr*)&ourAddress, &namelen) < 0)
+			ourAddress.sin_addr.s_addr = 0;
+		sdpDescription = session->acquireSDPDescription(ourAddress.sin_addr.s_addr);
 		if (sdpDescription == NULL) {
 			// This usually means that a file name that was specified for a
 			// "ServerMediaSubsession" does not exist.
 			setRTSPResponse("404 File Not Found, Or In Incorrect Format");
 			break;
 		}
-		unsigned sdpDescriptionSize = strlen(sdpDescription);
+		startResponse("200 OK");
 
-		// Also, generate our RTSP URL, for the "Content-Base:" header
+		// Also, give our RTSP URL, in the "Content-Base:" header
 		// (which is necessary to ensure that the correct URL gets used in subsequent "SETUP" requests).
-		rtspURL = fOurServer.rtspURL(session, fClientSock->sock());
-
-		snprintf((char*)fResponseBuffer, sizeof fResponseBuffer,
-			"RTSP/1.0 200 OK\r\nCSeq: %s\r\n"
-			"%s"
-			"Content-Base: %s/\r\n"
-			"Content-Type: application/sdp\r\n"
-			"Content-Length: %d\r\n\r\n"
-			"%s",
-			fCurrentCSeq,
-			dateHeader(),
-			rtspURL,
-			sdpDescriptionSize,
-			sdpDescription);
+		fResponse.appendFragment("Content-Base: ");
+		fOurServer.appendRTSPURLPrefix(fResponse, ourAddress.sin_addr.s_addr);
+		fResponse.append(session->streamName());
+		fResponse.appendFragment("/\r\nContent-Type: application/sdp\r\nContent-Length: ");
+		fResponse.appendUnsigned(sdpDescription->length);
+		fResponse.appendFragment("\r\n\r\n");
+		fResponse.append(sdpDescription->sdp, sdpDescription->length);
 	} while (0);
 
-	delete[] sdpDescription;
-	delete[] rtspURL;
+	if (sdpDescription) session->releaseSDPDescription(sdpDescription);
 }
 
-void RTSPServer::RTSPClientSession::handleCmd_SETUP(char const* urlPreSuffix, char const* urlSuffix, char const* fullRequestStr)
+void RTSPServer::RTSPClientSession::handleCmd_SETUP(char const* urlPreSuffix, char const* urlSuffix)
 {
 	// Normally, "urlPreSuffix" should be the session (stream) name, and "urlSuffix" should be the subsession (track) name.
 	// However (being "liberal in what we accept"), we also handle 'aggregate' SETUP requests (i.e., without a track name),
@@ -736,7 +781,7 @@ void RTSPServer::RTSPClientSession::handleCmd_SETUP(char const* urlPreSuffix, ch
 	//    "urlPreSuffix" concatenated with "urlSuffix" (with "/" inbetween) is the session (stream) name.
 	char const* streamName = urlPreSuffix; // in the normal case
 	char const* trackId = urlSuffix; // in the normal case
-	char* concatenatedStreamName = NULL; // in the normal case
+	char concatenatedStreamName[2*RTSP_PARAM_STRING_MAX]; // used in the special case (below)
 
 	do {
 		// First, make sure the specified stream name exists:
@@ -746,8 +791,7 @@ void RTSPServer::RTSPClientSession::handleCmd_SETUP(char const* urlPreSuffix, ch
 			if (urlPreSuffix[0] == '\0') {
 				streamName = urlSuffix;
 			} else {
-				concatenatedStreamName = new char[strlen(urlPreSuffix) + strlen(urlSuffix) + 2]; // allow for the "/" and the trailing '\0'
-				sprintf(concatenatedStreamName, "%s/%s", urlPreSuffix, urlSuffix);
+				snprintf(concatenatedStreamName, sizeof concatenatedStreamName, "%s/%s", urlPreSuffix, urlSuffix);
 				streamName = concatenatedStreamName;
 			}
 			trackId = NULL;
@@ -794,6 +838,7 @@ void RTSPServer::RTSPClientSession::handleCmd_SETUP(char const* urlPreSuffix, ch
 			for (unsigned i = 0; i < fNumStreamStates; ++i) {
 				subsession = iter.next();
 				fStreamStates[i].subsession = subsession;
+				fStreamStates[i].isMulticastMember = false;
 			}
 		}
 
@@ -822,17 +867,16 @@ void RTSPServer::RTSPClientSession::handleCmd_SETUP(char const* urlPreSuffix, ch
 		}
 		// ASSERT: subsession != NULL
 
-		// Look for a "Transport:" header in the request string, to extract client parameters:
+		// Look for a "Transport:" header in the request, to extract client parameters:
 		StreamingMode streamingMode;
 
-		char* streamingModeString = NULL; // set when RAW_UDP streaming is specified
-		char* clientsDestinationAddressStr;
+		char const* streamingModeString = NULL; // set when RAW_UDP streaming is specified
 		unsigned char clientsDestinationTTL;
 		unsigned short clientRTPPortNum, clientRTCPPortNum;
 		unsigned char rtpChannelId, rtcpChannelId;
 
-		parseTransportHeader(fullRequestStr, streamingMode, streamingModeString,
-			clientsDestinationAddressStr, clientsDestinationTTL,
+		parseTransportHeader(fRequestParser.header("Transport"), streamingMode, streamingModeString,
+			clientsDestinationTTL,
 			clientRTPPortNum, clientRTCPPortNum,
 			rtpChannelId, rtcpChannelId);
 
@@ -850,27 +894,49 @@ void RTSPServer::RTSPClientSession::handleCmd_SETUP(char const* urlPreSuffix, ch
 		unsigned int destinationAddress = 0;
 		unsigned char destinationTTL = 255;
 
-		delete[] clientsDestinationAddressStr;
 		unsigned short serverRTPPort = 0;
 		unsigned short serverRTCPPort = 0;
+		MySock *rtpSock = NULL, *rtcpSock = NULL;
 
 		struct sockaddr_in sourceAddr; socklen_t namelen = sizeof sourceAddr;
 		getsockname(fClientSock->sock(), (struct sockaddr*)&sourceAddr, &namelen);
 
+		if (streamingMode == RTP_UDP && fOurServer.fSharedUdpSockets)
+			subsession->setupSharedSockets(fOurServer.fTask);
+		if (fOurServer.fFanoutWorkers > 0)
+			subsession->startFanoutWorkers(fOurServer.fFanoutWorkers);
+
 		subsession->getStreamParameters(fOurSessionId, fClientSock->clientAddress().sin_addr.s_addr,
 			clientRTPPort, clientRTCPPort,
 			tcpSocketNum, rtpChannelId, rtcpChannelId,
 			destinationAddress, destinationTTL, fIsMulticast,
-			serverRTPPort, serverRTCPPort);
+			serverRTPPort, serverRTCPPort, rtpSock, rtcpSock);
 
 		// add client socket
-		if (streamingMode == RTP_UDP) {
-			MySock *rtpSock = new MySock();
-			rtpSock->setupDatagramSock(serverRTPPort, true);
-			if (rtpSock->sock() < 0) {
-				DPRINTF("failed to setup rtp udp socket %d !!!\n", rtpSock->sock());
-				delete rtpSock;
-				delete[] streamingModeString;
+		if (fIsMulticast) {
+			// UDP clients of a multicast subsession just join its stream:
+			if (!fStreamStates[streamNum].isMulticastMember) {
+				if (!subsession->addMulticastMember()) {
+					handleCmd_notFound();
+					break;
+				}
+				fStreamStates[streamNum].isMulticastMember = true;
+			}
+		} else if (streamingMode == RTP_UDP && subsession->sharedRtpSock() != NULL) {
+			struct sockaddr_in rtpDestAddr, rtcpDestAddr;
+			memset(&rtpDestAddr, 0, sizeof(struct sockaddr_in));
+			rtpDestAddr.sin_family = AF_INET;
+			rtpDestAddr.sin_addr.s_addr = destinationAddress;
+			rtpDestAddr.sin_port = htons(clientRTPPort);
+			rtcpDestAddr = rtpDestAddr;
+			rtcpDestAddr.sin_port = htons(clientRTCPPort);
+
+			ClientSocket *clientSock = new ClientSocket(*subsession->sharedRtpSock(), rtpDestAddr, *subsession->sharedRtcpSock(), rtcpDestAddr, false);
+			fClientSockList.insert(clientSock);
+			subsession->addClientSock(clientSock);
+		} else if (streamingMode == RTP_UDP) {
+			if (rtpSock == NULL) {
+				DPRINTF("failed to setup rtp/rtcp udp sockets !!!\n");
 				handleCmd_notFound();
 				break;
 			}
@@ -882,17 +948,6 @@ void RTSPServer::RTSPClientSession::handleCmd_SETUP(char const* urlPreSuffix, ch
 			rtpDestAddr.sin_addr.s_addr = destinationAddress;
 			rtpDestAddr.sin_port = htons(clientRTPPort);
 
-			MySock *rtcpSock = new MySock();
-			rtcpSock->setupDatagramSock(serverRTCPPort, true);
-			if (rtpSock->sock() < 0) {
-				DPRINTF("failed to setup rtcp udp socket %d !!!\n", rtpSock->sock());
-				delete rtpSock;
-				delete rtcpSock;
-				delete[] streamingModeString;
-				handleCmd_notFound();
-				break;
-			}
-
 			struct sockaddr_in rtcpDestAddr;
 			memset(&rtcpDestAddr, 0, sizeof(struct sockaddr_in));
 			rtcpDestAddr.sin_family = AF_INET;
@@ -905,120 +960,91 @@ void RTSPServer::RTSPClientSession::handleCmd_SETUP(char const* urlPreSuffix, ch
 		} else if (streamingMode == RTP_TCP) {
 			fClientSock->setSendBufferTo(1024*1024*5);
 			ClientSocket *clientSock = new ClientSocket(*fClientSock, rtpChannelId, rtcpChannelId);
+			clientSock->setSendQueuePolicy(fOurServer.fSendQueueMaxBytes, fOurServer.fSendQueuePolicy, fOurServer.fMaxBacklogSeconds);
+			clientSock->setWriteHandler(fOurServer.fTask, outgoingDataHandler, this);
 			fClientSockList.insert(clientSock);
 			subsession->addClientSock(clientSock);
+		} else {
+			ServerPortAllocator::releasePortPair(rtpSock, rtcpSock);
 		}
 
-		AddressString destAddrStr(destinationAddress);
-		AddressString sourceAddrStr(sourceAddr);
+		startResponse("200 OK");
+		fResponse.appendFragment("Transport: ");
+		if (streamingMode == RAW_UDP)
+			fResponse.append(streamingModeString);
+		else if (streamingMode == RTP_TCP)
+			fResponse.appendFragment("RTP/AVP/TCP");
+		else
+			fResponse.appendFragment("RTP/AVP");
+		if (fIsMulticast)
+			fResponse.appendFragment(";multicast;destination=");
+		else
+			fResponse.appendFragment(";unicast;destination=");
+		fResponse.appendAddress(destinationAddress);
+		fResponse.appendFragment(";source=");
+		fResponse.appendAddress(sourceAddr.sin_addr.s_addr);
 
 		if (fIsMulticast) {
-			switch (streamingMode) {
-		  case RTP_UDP: {
-			  snprintf((char*)fResponseBuffer, sizeof fResponseBuffer,
-				  "RTSP/1.0 200 OK\r\n"
-				  "CSeq: %s\r\n"
-				  "%s"
-				  "Transport: RTP/AVP;multicast;destination=%s;source=%s;port=%d-%d;ttl=%d\r\n"
-				  "Session: %08X\r\n\r\n",
-				  fCurrentCSeq,
-				  dateHeader(),				  
-				  destAddrStr.val(), sourceAddrStr.val(), serverRTPPort, serverRTCPPort, destinationTTL,
-				  fOurSessionId);
-			  break;
-						}
-		  case RTP_TCP: {
-			  // multicast streams can't be sent via TCP
-			  handleCmd_unsupportedTransport();
-			  break;
-						}
-		  case RAW_UDP: {
-			  snprintf((char*)fResponseBuffer, sizeof fResponseBuffer,
-				  "RTSP/1.0 200 OK\r\n"
-				  "CSeq: %s\r\n"
-				  "%s"
-				  "Transport: %s;multicast;destination=%s;source=%s;port=%d;ttl=%d\r\n"
-				  "Session: %08X\r\n\r\n",
-				  fCurrentCSeq,
-				  dateHeader(),
-				  streamingModeString, destAddrStr.val(), sourceAddrStr.val(), serverRTPPort, destinationTTL,
-				  fOurSessionId);
-			  break;
-						}
+			fResponse.appendFragment(";port=");
+			fResponse.appendUnsigned(serverRTPPort);
+			if (streamingMode == RTP_UDP) {
+				fResponse.appendFragment("-");
+				fResponse.appendUnsigned(serverRTCPPort);
 			}
+			fResponse.appendFragment(";ttl=");
+			fResponse.appendUnsigned(destinationTTL);
+		} else if (streamingMode == RTP_TCP) {
+			fResponse.appendFragment(";interleaved=");
+			fResponse.appendUnsigned(rtpChannelId);
+			fResponse.appendFragment("-");
+			fResponse.appendUnsigned(rtcpChannelId);
 		} else {
-			switch (streamingMode) {
-		  case RTP_UDP: {
-			  snprintf((char*)fResponseBuffer, sizeof fResponseBuffer,
-				  "RTSP/1.0 200 OK\r\n"
-				  "CSeq: %s\r\n"
-				  "%s"
-				  "Transport: RTP/AVP;unicast;destination=%s;source=%s;client_port=%d-%d;server_port=%d-%d\r\n"
-				  "Session: %08X\r\n\r\n",
-				  fCurrentCSeq,
-				  dateHeader(),
-				  destAddrStr.val(), sourceAddrStr.val(), clientRTPPort, clientRTCPPort, serverRTPPort, serverRTCPPort,
-				  fOurSessionId);
-			  break;
-						}
-		  case RTP_TCP: {
-			  snprintf((char*)fResponseBuffer, sizeof fResponseBuffer,
-				  "RTSP/1.0 200 OK\r\n"
-				  "CSeq: %s\r\n"
-				  "%s"
-				  "Transport: RTP/AVP/TCP;unicast;destination=%s;source=%s;interleaved=%d-%d\r\n"
-				  "Session: %08X\r\n\r\n",
-				  fCurrentCSeq,
-				  dateHeader(),
-				  destAddrStr.val(), sourceAddrStr.val(), rtpChannelId, rtcpChannelId,
-				  fOurSessionId);			  
-			  break;
-						}
-		  case RAW_UDP: {
-			  snprintf((char*)fResponseBuffer, sizeof fResponseBuffer,
-				  "RTSP/1.0 200 OK\r\n"
-				  "CSeq: %s\r\n"
-				  "%s"
-				  "Transport: %s;unicast;destination=%s;source=%s;client_port=%d;server_port=%d\r\n"
-				  "Session: %08X\r\n\r\n",
-				  fCurrentCSeq,
-				  dateHeader(),
-				  streamingModeString, destAddrStr.val(), sourceAddrStr.val(), clientRTPPort, serverRTPPort,
-				  fOurSessionId);
-			  break;
-						}
+			fResponse.appendFragment(";client_port=");
+			fResponse.appendUnsigned(clientRTPPort);
+			if (streamingMode == RTP_UDP) {
+				fResponse.appendFragment("-");
+				fResponse.appendUnsigned(clientRTCPPort);
+			}
+			fResponse.appendFragment(";server_port=");
+			fResponse.appendUnsigned(serverRTPPort);
+			if (streamingMode == RTP_UDP) {
+				fResponse.appendFragment("-");
+				fResponse.appendUnsigned(serverRTCPPort);
 			}
 		}
-		delete[] streamingModeString;
+		fResponse.appendFragment("\r\n");
+		appendSessionHeader(fOurSessionId);
+		fResponse.appendFragment("\r\n");
 	} while (0);
-
-	delete[] concatenatedStreamName;
 }
 
-void RTSPServer::RTSPClientSession::handleCmd_PLAY(ServerMediaSubsession* subsession, char const* fullRequestStr)
+void RTSPServer::RTSPClientSession::handleCmd_PLAY(ServerMediaSubsession* subsession)
 {
-	char* rtspURL = fOurServer.rtspURL(fOurServerMediaSession, fClientSock->sock());
-	unsigned rtspURLSize = strlen(rtspURL);
-
 	// Parse the client's "Scale:" header, if any:
-	float scale;
-	bool sawScaleHeader = parseScaleHeader(fullRequestStr, scale);
-
-	char buf[100];
-	char* scaleHeader;
-	if (!sawScaleHeader) {
-		buf[0] = '\0'; // Because we didn't see a Scale: header, don't send one back
-	} else {
-		sprintf(buf, "Scale: %f\r\n", scale);
+	// (Because we didn't see a Scale: header, we don't send one back)
+	float scale = 1.0;
+	bool sawScaleHeader = false;
+	RTSPField const* scaleValue = fRequestParser.header("Scale");
+	if (scaleValue != NULL) {
+		char value[32];
+		scaleValue->copyTo(value, sizeof value);
+		sawScaleHeader = sscanf(value, "%f", &scale) == 1;
 	}
-	scaleHeader = strDup(buf);
+
+	char rangeHeader[100];
 
 	// Parse the client's "Range:" header, if any:
 	float duration = 0.0;
 	double rangeStart = 0.0, rangeEnd = 0.0;
 	char* absStart = NULL; char* absEnd = NULL;
 	bool startTimeIsNow;
-	bool sawRangeHeader = parseRangeHeader(fullRequestStr, rangeStart, rangeEnd, absStart, absEnd, startTimeIsNow);
+	bool sawRangeHeader = false;
+	RTSPField const* rangeValue = fRequestParser.header("Range");
+	if (rangeValue != NULL) {
+		char value[RTSP_PARAM_STRING_MAX];
+		rangeValue->copyTo(value, sizeof value);
+		sawRangeHeader = parseRangeParam(value, rangeStart, rangeEnd, absStart, absEnd, startTimeIsNow);
+	}
 
 	if (sawRangeHeader && absStart == NULL/*not seeking by 'absolute' time*/) {
 		// Use this information, plus the stream's duration (if known), to create our own "Range:" header, for the response:
@@ -1045,26 +1071,17 @@ void RTSPServer::RTSPClientSession::handleCmd_PLAY(ServerMediaSubsession* subses
 		}
 	}
 
-	// Create a "RTP-Info:" line.  It will get filled in from each subsession's state:
-	char const* rtpInfoFmt =
-		"%s" // "RTP-Info:", plus any preceding rtpInfo items
-		"%s" // comma separator, if needed
-		"url=%s/%s"
-		";seq=%d"
-		";rtptime=%u"
-		;
-	unsigned rtpInfoFmtSize = strlen(rtpInfoFmt);
-	char* rtpInfo = strDup("RTP-Info: ");
-	unsigned i, numRTPInfoItems = 0;
+	// (No "RTP-Info:" line is sent, as we don't keep the subsessions' RTP state)
+	unsigned i;
 
 	// Create the "Range:" header that we'll send back in our response.
 	// (Note that we do this after seeking, in case the seeking operation changed the range start time.)
 	if (absStart != NULL) {
 		// We're seeking by 'absolute' time:
 		if (absEnd == NULL) {
-			sprintf(buf, "Range: clock=%s-\r\n", absStart);
+			snprintf(rangeHeader, sizeof rangeHeader, "Range: clock=%s-\r\n", absStart);
 		} else {
-			sprintf(buf, "Range: clock=%s-%s\r\n", absStart, absEnd);
+			snprintf(rangeHeader, sizeof rangeHeader, "Range: clock=%s-%s\r\n", absStart, absEnd);
 		}
 		delete[] absStart; delete[] absEnd;
 	} else {
@@ -1088,23 +1105,24 @@ void RTSPServer::RTSPClientSession::handleCmd_PLAY(ServerMediaSubsession* subses
 		}
 
 		if (rangeEnd == 0.0 && scale >= 0.0) {
-			sprintf(buf, "Range: npt=%.3f-\r\n", rangeStart);
+			snprintf(rangeHeader, sizeof rangeHeader, "Range: npt=%.3f-\r\n", rangeStart);
 		} else {
-			sprintf(buf, "Range: npt=%.3f-%.3f\r\n", rangeStart, rangeEnd);
+			snprintf(rangeHeader, sizeof rangeHeader, "Range: npt=%.3f-%.3f\r\n", rangeStart, rangeEnd);
 		}
 	}
-	char* rangeHeader = strDup(buf);
 
 	STREAM_STATE currentState = STREAM_STATE_STOPPED;
 
 	// Now, start streaming:
 	if (fOurServerMediaSession) {		
-		// activate all client sockets
-		fClientSockList.gotoBeginCursor();
-		ClientSocket *cursor = fClientSockList.getNextCursor();
-		while (cursor) {
-			cursor->activate();
-			cursor = fClientSockList.getNextCursor();
+		// activate all client sockets (a live one gets the packets since the last keyframe first)
+		for (int i = 0; i < fClientSockList.count(); i++)
+			fOurServerMediaSession->activateClientSocket(fClientSockList.at(i));
+
+		// a multicast member has no client socket of its own, and just waits for the next keyframe of the stream
+		for (i = 0; i < fNumStreamStates; ++i) {
+			if (fStreamStates[i].isMulticastMember && (subsession == NULL || subsession == fStreamStates[i].subsession))
+				fStreamStates[i].subsession->requestKeyframe();
 		}
 
 		currentState = fOurServerMediaSession->streamState();
@@ -1120,32 +1138,13 @@ void RTSPServer::RTSPClientSession::handleCmd_PLAY(ServerMediaSubsession* subses
 		return;
 	}
 
-	if (numRTPInfoItems == 0) {
-		rtpInfo[0] = '\0';
-	} else {
-		unsigned rtpInfoLen = strlen(rtpInfo);
-		rtpInfo[rtpInfoLen] = '\r';
-		rtpInfo[rtpInfoLen+1] = '\n';
-		rtpInfo[rtpInfoLen+2] = '\0';
-	}
-
 	// Fill in the response:
-	snprintf((char*)fResponseBuffer, sizeof fResponseBuffer,
-		"RTSP/1.0 200 OK\r\n"
-		"CSeq: %s\r\n"
-		"%s"
-		"%s"
-		"%s"
-		"Session: %08X\r\n"
-		"%s\r\n",
-		fCurrentCSeq,
-		dateHeader(),
-		scaleHeader,
-		rangeHeader,
-		fOurSessionId,
-		rtpInfo);
-	delete[] rtpInfo; delete[] rangeHeader;
-	delete[] scaleHeader; delete[] rtspURL;
+	startResponse("200 OK");
+	if (sawScaleHeader)
+		fResponse.appendFormat("Scale: %f\r\n", scale);
+	fResponse.append(rangeHeader);
+	appendSessionHeader(fOurSessionId);
+	fResponse.appendFragment("\r\n");
 
 	if (fOurServer.fServerCallbackFunc) {
 		if (fOurServerMediaSession->sessionType() == SESSION_ONDEMAND && currentState != STREAM_STATE_STOPPED) {
@@ -1177,14 +1176,14 @@ void RTSPServer::RTSPClientSession::handleCmd_PAUSE(ServerMediaSubsession *subse
 	setRTSPResponse("200 OK", fOurSessionId);
 }
 
-void RTSPServer::RTSPClientSession::handleCmd_GET_PARAMETER(ServerMediaSubsession *subsession, const char *fullRequestStr)
+void RTSPServer::RTSPClientSession::handleCmd_GET_PARAMETER(ServerMediaSubsession *subsession)
 {
 	setRTSPResponse("200 OK", fOurSessionId);
 }
 
-void RTSPServer::RTSPClientSession::handleCmd_SET_PARAMETER(ServerMediaSubsession *subsession, const char *fullRequestStr)
+void RTSPServer::RTSPClientSession::handleCmd_SET_PARAMETER(ServerMediaSubsession *subsession, char *body)
 {			
-	char* nextLineStart = getLine((char *)fullRequestStr);
+	char* nextLineStart = body;
 	char* lineStart;
 	while (1) {
 		lineStart = nextLineStart;
@@ -1194,7 +1193,7 @@ void RTSPServer::RTSPClientSession::handleCmd_SET_PARAMETER(ServerMediaSubsessio
 		nextLineStart = getLine(lineStart);
 
 		if (strncmp(lineStart, "command: ", 9) == 0) {
-			char *strCommand = strDup(&lineStart[9]);
+			char const* strCommand = &lineStart[9]; // (the line is '\0'-terminated by "getLine()")
 
 			if (strcmp(strCommand, "playforward") == 0) {
 				fOurServerMediaSession->forwardStream();	
@@ -1205,18 +1204,13 @@ void RTSPServer::RTSPClientSession::handleCmd_SET_PARAMETER(ServerMediaSubsessio
 			} else if (strcmp(strCommand, "playbackwardnext") == 0) {
 				fOurServerMediaSession->backwardNextStream();
 			} else if (strncmp(strCommand, "seek=", 5) == 0) {
-				char *seektime = strDup(&strCommand[5]);
-				int timestamp = atoi(seektime);
-				delete[] seektime;
+				int timestamp = atoi(&strCommand[5]);
 				fOurServerMediaSession->seekStream(timestamp);
 			} else if (strncmp(strCommand, "speed=", 6) == 0) {
-				char *speedbuf = strDup(&strCommand[6]);
-				float speed = atof(speedbuf);
-				delete[] speedbuf;
+				float speed = atof(&strCommand[6]);
 				fOurServerMediaSession->speedStream(speed);
 			}
 
-			delete[] strCommand;
 			break;
 		}
 	}
@@ -1225,9 +1219,9 @@ void RTSPServer::RTSPClientSession::handleCmd_SET_PARAMETER(ServerMediaSubsessio
 }
 
 void RTSPServer::RTSPClientSession::handleCmd_withinSession(
-			  char const* cmdName,
+			  RTSPField const& cmdName,
 			  char const* urlPreSuffix, char const* urlSuffix,
-			  char const* fullRequestStr) 
+			  char* body) 
 {
 	// This will either be:
 	// - a non-aggregated operation, if "urlPreSuffix" is the session (stream)
@@ -1272,32 +1266,36 @@ void RTSPServer::RTSPClientSession::handleCmd_withinSession(
 		return;
 	}
 
-	if (strcmp(cmdName, "TEARDOWN") == 0) {
+	if (cmdName.equals("TEARDOWN")) {
 		handleCmd_TEARDOWN(subsession);
-	} else if (strcmp(cmdName, "PLAY") == 0) {
-		handleCmd_PLAY(subsession, fullRequestStr);
-	} else if (strcmp(cmdName, "PAUSE") == 0) {
+	} else if (cmdName.equals("PLAY")) {
+		handleCmd_PLAY(subsession);
+	} else if (cmdName.equals("PAUSE")) {
 		handleCmd_PAUSE(subsession);
-	} else if (strcmp(cmdName, "GET_PARAMETER") == 0) {
-		handleCmd_GET_PARAMETER(subsession, fullRequestStr);
-	} else if (strcmp(cmdName, "SET_PARAMETER") == 0) {
-		handleCmd_SET_PARAMETER(subsession, fullRequestStr);
+	} else if (cmdName.equals("GET_PARAMETER")) {
+		handleCmd_GET_PARAMETER(subsession);
+	} else if (cmdName.equals("SET_PARAMETER")) {
+		handleCmd_SET_PARAMETER(subsession, body);
 	}
 }
 
 void RTSPServer::RTSPClientSession::handleCmd_bad()
 {
 	// Don't do anything with "fCurrentCSeq", because it might be nonsense
-	snprintf((char*)fResponseBuffer, sizeof fResponseBuffer,
-		"RTSP/1.0 400 Bad Request\r\n%sAllow: %s\r\n\r\n",
-		dateHeader(), fOurServer.allowedCommandNames());
+	fResponse.reset();
+	fResponse.appendFragment("RTSP/1.0 400 Bad Request\r\n");
+	fOurServer.appendDateHeader(fResponse);
+	fResponse.appendFragment("Allow: ");
+	fResponse.append(fOurServer.allowedCommandNames());
+	fResponse.appendFragment("\r\n\r\n");
 }
 
 void RTSPServer::RTSPClientSession::handleCmd_notSupported() 
 {
-	snprintf((char*)fResponseBuffer, sizeof fResponseBuffer,
-		"RTSP/1.0 405 Method Not Allowed\r\nCSeq: %s\r\n%sAllow: %s\r\n\r\n",
-		fCurrentCSeq, dateHeader(), fOurServer.allowedCommandNames());
+	startResponse("405 Method Not Allowed");
+	fResponse.appendFragment("Allow: ");
+	fResponse.append(fOurServer.allowedCommandNames());
+	fResponse.appendFragment("\r\n\r\n");
 }
 
 void RTSPServer::RTSPClientSession::handleCmd_notFound() 
@@ -1315,28 +1313,35 @@ void RTSPServer::RTSPClientSession::handleCmd_unsupportedTransport()
 	setRTSPResponse("461 Unsupported Transport");
 }
 
+void RTSPServer::RTSPClientSession::startResponse(char const* responseStr)
+{
+	fResponse.reset();
+	fResponse.appendFragment("RTSP/1.0 ");
+	fResponse.append(responseStr);
+	fResponse.appendFragment("\r\nCSeq: ");
+	fResponse.append(fCurrentCSeq.str, fCurrentCSeq.len);
+	fResponse.appendFragment("\r\n");
+	fOurServer.appendDateHeader(fResponse);
+}
+
+void RTSPServer::RTSPClientSession::appendSessionHeader(u_int64_t sessionId)
+{
+	fResponse.appendFragment("Session: ");
+	fResponse.appendHex16(sessionId);
+	fResponse.appendFragment("\r\n");
+}
+
 void RTSPServer::RTSPClientSession::setRTSPResponse(char const* responseStr) 
 {
-	snprintf((char*)fResponseBuffer, sizeof fResponseBuffer,
-		"RTSP/1.0 %s\r\n"
-		"CSeq: %s\r\n"
-		"%s\r\n",
-		responseStr,
-		fCurrentCSeq,
-		dateHeader());
+	startResponse(responseStr);
+	fResponse.appendFragment("\r\n");
 }
 
-void RTSPServer::RTSPClientSession::setRTSPResponse(char const* responseStr, u_int32_t sessionId) 
+void RTSPServer::RTSPClientSession::setRTSPResponse(char const* responseStr, u_int64_t sessionId) 
 {
-	snprintf((char*)fResponseBuffer, sizeof fResponseBuffer,
-		"RTSP/1.0 %s\r\n"
-		"CSeq: %s\r\n"
-		"%s"
-		"Session: %08X\r\n\r\n",
-		responseStr,
-		fCurrentCSeq,
-		dateHeader(),
-		sessionId);
+	startResponse(responseStr);
+	appendSessionHeader(sessionId);
+	fResponse.appendFragment("\r\n");
 }
 
 void RTSPServer::RTSPClientSession::setRTSPResponse(char const* responseStr, char const* contentStr) 
@@ -1344,37 +1349,98 @@ void RTSPServer::RTSPClientSession::setRTSPResponse(char const* responseStr, cha
 	if (contentStr == NULL) contentStr = "";
 	unsigned const contentLen = strlen(contentStr);
 
-	snprintf((char*)fResponseBuffer, sizeof fResponseBuffer,
-		"RTSP/1.0 %s\r\n"
-		"CSeq: %s\r\n"
-		"%s"
-		"Content-Length: %d\r\n\r\n"
-		"%s",
-		responseStr,
-		fCurrentCSeq,
-		dateHeader(),
-		contentLen,
-		contentStr);
+	startResponse(responseStr);
+	fResponse.appendFragment("Content-Length: ");
+	fResponse.appendUnsigned(contentLen);
+	fResponse.appendFragment("\r\n\r\n");
+	fResponse.append(contentStr, contentLen);
 }
 
-void RTSPServer::RTSPClientSession::setRTSPResponse(char const* responseStr, u_int32_t sessionId, char const* contentStr) 
+void RTSPServer::RTSPClientSession::setRTSPResponse(char const* responseStr, u_int64_t sessionId, char const* contentStr) 
 {
 	if (contentStr == NULL) contentStr = "";
 	unsigned const contentLen = strlen(contentStr);
 
-	snprintf((char*)fResponseBuffer, sizeof fResponseBuffer,
-		"RTSP/1.0 %s\r\n"
-		"CSeq: %s\r\n"
-		"%s"
-		"Session: %08X\r\n"
-		"Content-Length: %d\r\n\r\n"
-		"%s",
-		responseStr,
-		fCurrentCSeq,
-		dateHeader(),
-		sessionId,
-		contentLen,
-		contentStr);
+	startResponse(responseStr);
+	appendSessionHeader(sessionId);
+	fResponse.appendFragment("Content-Length: ");
+	fResponse.appendUnsigned(contentLen);
+	fResponse.appendFragment("\r\n\r\n");
+	fResponse.append(contentStr, contentLen);
+}
+
+ResponseWriter::ResponseWriter(char *buf, unsigned size)
+: fBuf(buf), fSize(size), fLength(0), fOverflowed(false)
+{
+	fBuf[0] = '\0';
+}
+
+void ResponseWriter::reset()
+{
+	fLength = 0;
+	fOverflowed = false;
+	fBuf[0] = '\0';
+}
+
+void ResponseWriter::append(char const* str, unsigned len)
+{
+	unsigned room = fSize - 1 - fLength; // keeping one byte for the '\0'
+	if (len > room) {
+		len = room;
+		fOverflowed = true;
+	}
+	memcpy(&fBuf[fLength], str, len);
+	fLength += len;
+	fBuf[fLength] = '\0';
+}
+
+void ResponseWriter::appendUnsigned(unsigned value)
+{
+	char digits[10];
+	int i = sizeof digits;
+	do {
+		digits[--i] = '0' + value%10;
+		value /= 10;
+	} while (value != 0);
+	append(&digits[i], sizeof digits - i);
+}
+
+void ResponseWriter::appendHex16(u_int64_t value)
+{
+	static char const hexDigits[] = "0123456789ABCDEF";
+	char digits[16];
+	for (int i = 15; i >= 0; i--) {
+		digits[i] = hexDigits[value&0xF];
+		value >>= 4;
+	}
+	append(digits, sizeof digits);
+}
+
+void ResponseWriter::appendAddress(unsigned int address)
+{
+	unsigned char const* bytes = (unsigned char const*)&address;
+	for (int i = 0; i < 4; i++) {
+		if (i > 0) append(".", 1);
+		appendUnsigned(bytes[i]);
+	}
+}
+
+void ResponseWriter::appendFormat(char const* fmt, ...)
+{
+	unsigned room = fSize - fLength;
+	va_list args;
+	va_start(args, fmt);
+	int len = vsnprintf(&fBuf[fLength], room, fmt, args);
+	va_end(args);
+
+	if (len < 0) {
+		fBuf[fLength] = '\0';
+	} else if ((unsigned)len >= room) {
+		fLength = fSize - 1;
+		fOverflowed = true;
+	} else {
+		fLength += len;
+	}
 }
 
 CallbackParam::CallbackParam(ServerCallbackType type)
@@ -3,10 +3,18 @@
 
 #include "MySock.h"
 #include "TaskScheduler.h"
-#include "MyList.h"
+#include "MySlotList.h"
+#include "MyHashMap.h"
 #include "RTSPCommon.h"
+#include "ClientSocket.h"
+
+#include <string.h>
+#include <time.h>
 
 #define RTSP_BUFFER_SIZE	(20000)
+#define RTSP_READ_BUFFER_INITIAL_SIZE	(4096)
+#define RTSP_READ_BUFFER_MAX_SIZE		(1024*1024)
+#define MAX_INTERLEAVED_FRAME_SIZE	(4+65535)	// '$', channel id, 16-bit size, packet
 
 typedef enum { OPEN_SERVER_SESSION, CLIENT_CONNECTED, CLIENT_DISCONNECTED } ServerCallbackType;
 
@@ -51,28 +59,85 @@ public:
 
 typedef int (*RTSPServerCallback)(void *arg, CallbackParam *param);
 
+// Builds a RTSP response by appending to a buffer of the connection, without allocating anything.
+// The result is always '\0'-terminated; what doesn't fit is cut off (see "overflowed()").
+class ResponseWriter
+{
+public:
+	ResponseWriter(char *buf, unsigned size);
+
+	void reset();
+	void append(char const* str, unsigned len);
+	void append(char const* str) { append(str, strlen(str)); }
+	template <unsigned N> void appendFragment(char const (&fragment)[N]) { append(fragment, N-1); }
+	// for string literals, whose length is known at compile time
+	void appendUnsigned(unsigned value);
+	void appendHex16(u_int64_t value);			// as "%016llX"
+	void appendAddress(unsigned int address);	// "address" is in network byte order
+	void appendFormat(char const* fmt, ...);	// for the odd value that needs "printf()" formatting
+
+	char const* data() const { return fBuf; }
+	unsigned length() const { return fLength; }
+	bool overflowed() const { return fOverflowed; }
+
+private:
+	char*		fBuf;
+	unsigned	fSize;
+	unsigned	fLength;
+	bool		fOverflowed;
+};
+
 class ServerMediaSession;
 class ServerMediaSubsession;
-class ClientSocket;
 
+// A RTSP server, listening on one port. A process may run several of them (e.g. one per network interface),
+// each with its own thread, sessions and limits; a "ServerMediaSession" is added to one server only.
 class RTSPServer
 {
 public:
+	RTSPServer();
+	virtual ~RTSPServer();
+	// (stops the server first, if it's running)
+
 	static RTSPServer* instance();
 	static void destroy();
+	// a default server of the process, created on the first call to "instance()"
 
 	int startServer(unsigned short port = 554, RTSPServerCallback func = NULL, void *arg = NULL);
+	// Our thread (of "fTask") is created with the first "startServer()", and kept until we are deleted.
 	void stopServer();
 	bool isServerRunning() { return fIsServerRunning; }
 	int serverSessionCount() { return fServerMediaSessions.count(); }
+	int clientSessionCount() { return fClientSessions.count(); }
 
-	void addServerMediaSession(ServerMediaSession* serverMediaSession);
+	bool addServerMediaSession(ServerMediaSession* serverMediaSession);
+	// Returns false (and adds nothing) if another session has the same stream name; it isn't ours to replace,
+	// so its owner has to remove it first.
 	ServerMediaSession* lookupServerMediaSession(char const* streamName);
 	void removeServerMediaSession(ServerMediaSession* serverMediaSession);
+	// Once removed, a session can't be looked up any more; it is deleted as soon as no client uses it.
 
 	void closeAllClientSessionsForServerMediaSession(ServerMediaSession* serverMediaSession);
 	void deleteServerMediaSession(ServerMediaSession* serverMediaSession);
 
+	void setClientSendQueue(unsigned maxBytes, SEND_QUEUE_POLICY policy, unsigned maxBacklogSeconds = 0);
+	// how RTP/TCP clients that can't keep up are handled (applies to the clients set up afterwards)
+
+	void setSharedUdpSockets(bool enable) { fSharedUdpSockets = enable; }
+	// If set, the UDP clients of each subsession are sent from one shared server port pair
+	// (see "ServerMediaSubsession::setupSharedSockets()") instead of a socket pair per client.
+
+	void setFanoutWorkers(int numWorkers) { fFanoutWorkers = numWorkers; }
+	// If non-zero, each subsession sends to its clients from "numWorkers" threads of its own
+	// (see "ServerMediaSubsession::startFanoutWorkers()"), rather than from the thread that gives it the packets.
+
+	void setListenAddress(unsigned int address) { fListenAddress = address; }
+	// If set (in network byte order), the next "startServer()" listens on this local address only, instead of on all of them.
+	// Our "rtsp://" URLs use it too, unless they are for a given client.
+
+	void setMaxClientSessions(int maxSessions) { fMaxClientSessions = maxSessions; }
+	// If non-zero, a connection that would make more client sessions than this is closed as soon as it's accepted.
+
 	char* rtspURL(ServerMediaSession const* serverMediaSession, int clientSocket = -1);
 	// returns a "rtsp://" URL that could be used to access the
 	// specified session (which must already have been added to
@@ -84,15 +149,18 @@ public:
 	// like "rtspURL()", except that it returns just the common prefix used by
 	// each session's "rtsp://" URL.
 	// This string is dynamically allocated; caller should delete[]
+	void appendRTSPURLPrefix(ResponseWriter& writer, unsigned int ourAddress);
+	// like "rtspURLPrefix()", for the local address "ourAddress", written to "writer" instead
 
 protected:
-	RTSPServer();
-	virtual ~RTSPServer();
-
 	static RTSPServer* fInstance;
 
 	virtual char const* allowedCommandNames(); // used to implement "RTSPClientConnection::handleCmd_OPTIONS()"
 
+	void appendDateHeader(ResponseWriter& writer);
+	// The "Date:" header is formatted at most once a second, and kept for the responses in between.
+	// (Only the server's thread uses it.)
+
 protected:
 	static void incomingConnectionHandlerRTSP(void*, int);
 	void incomingConnectionHandlerRTSP1();
@@ -102,27 +170,26 @@ protected:
 	class RTSPClientSession
 	{
 	public:
-		RTSPClientSession(RTSPServer& ourServer, MySock& clientSock, unsigned int sessionId);
+		RTSPClientSession(RTSPServer& ourServer, MySock& clientSock, u_int64_t sessionId);
 		virtual ~RTSPClientSession();
 
 		friend class RTSPServer;
 
 	protected:
 		static void incomingRequestHandler(void*, int);
-		void incomingRequestHandler1(unsigned char requestByte);
-		void handleRequestBytes(int newBytesRead);
-
-		void resetRequestBuffer();
+		static void outgoingDataHandler(void*, int);
+		void flushSendQueues();
 
 		void handleCmd_OPTIONS();
-		void handleCmd_DESCRIBE(char const* urlPreSuffix, char const* urlSuffix, char const* fullRequestStr);
-		void handleCmd_SETUP(char const* urlPreSuffix, char const* urlSuffix, char const* fullRequestStr);
-		void handleCmd_PLAY(ServerMediaSubsession* subsession, char const* fullRequestStr);
+		// (The headers of the request being handled are in "fRequestParser".)
+		void handleCmd_DESCRIBE(char const* urlPreSuffix, char const* urlSuffix);
+		void handleCmd_SETUP(char const* urlPreSuffix, char const* urlSuffix);
+		void handleCmd_PLAY(ServerMediaSubsession* subsession);
 		void handleCmd_TEARDOWN(ServerMediaSubsession* subsession);
 		void handleCmd_PAUSE(ServerMediaSubsession* subsession);
-		void handleCmd_GET_PARAMETER(ServerMediaSubsession* subsession, char const* fullRequestStr);
-		void handleCmd_SET_PARAMETER(ServerMediaSubsession* subsession, char const* fullRequestStr);
-		void handleCmd_withinSession(char const* cmdName, char const* urlPreSuffix, char const* urlSuffix, char const* fullRequestStr);
+		void handleCmd_GET_PARAMETER(ServerMediaSubsession* subsession);
+		void handleCmd_SET_PARAMETER(ServerMediaSubsession* subsession, char* body);
+		void handleCmd_withinSession(RTSPField const& cmdName, char const* urlPreSuffix, char const* urlSuffix, char* body);
 		void handleCmd_bad();
 		void handleCmd_notSupported();
 		void handleCmd_notFound();
@@ -133,38 +200,39 @@ protected:
 		void shutdown();
 
 		// Shortcuts for setting up a RTSP response (prior to sending it):
+		void startResponse(char const* responseStr);
+		// the status line, "CSeq:" and "Date:"; the headers that follow are appended to "fResponse"
+		void appendSessionHeader(u_int64_t sessionId);
 		void setRTSPResponse(char const* responseStr);
-		void setRTSPResponse(char const* responseStr, unsigned int sessionId);
+		void setRTSPResponse(char const* responseStr, u_int64_t sessionId);
 		void setRTSPResponse(char const* responseStr, char const* contentStr);
-		void setRTSPResponse(char const* responseStr, u_int32_t sessionId, char const* contentStr);
+		void setRTSPResponse(char const* responseStr, u_int64_t sessionId, char const* contentStr);
 		
 		// tcp stream read fuctions
 		void tcpReadHandler1();
-		bool lookupStreamChannelId(unsigned char channel);	
-		void readRTPOverTCP();
+		int handleRequest(char *buf, int len);
+		int handleInterleavedFrame(char *buf, int len);
+		// return the number of bytes consumed from "buf", or 0 if the request/frame is not complete yet
+		ClientSocket* lookupStreamChannelId(unsigned char channel);
 
 	protected:
-		enum { AWAITING_DOLLAR, AWAITING_STREAM_CHANNEL_ID, AWAITING_SIZE1, AWAITING_SIZE2, AWAITING_PACKET_DATA,
-			 } fTCPReadingState;
-		unsigned char	fStreamChannelId, fSizeByte1;
-		unsigned		fTCPReadSize;
-
+		// read buffer of "tcpReadHandler1()"; holds RTSP requests and interleaved RTP/RTCP frames
+		// (It is allocated with the first data that arrives, grows only for a message that doesn't fit,
+		//  and goes back to RTSP_READ_BUFFER_INITIAL_SIZE once emptied.)
 		char*			fRtpBuffer;
 		int				fRtpBufferSize;
-		int				fRtpBufferIdx;
+		int				fRtpBufferIdx;		// end of the received data
+		int				fRtpBufferReadIdx;	// start of the data not handled yet
+		RTSPRequestParser	fRequestParser;	// of the request at "fRtpBufferReadIdx", across reads
 
 	protected:
 		RTSPServer&	fOurServer;
-		u_int32_t	fOurSessionId;
+		u_int64_t	fOurSessionId;
 		ServerMediaSession*	fOurServerMediaSession;
 		bool			fIsActive;
 		MySock*			fClientSock;
-		unsigned char	fRequestBuffer[RTSP_BUFFER_SIZE];
-		unsigned		fRequestBytesAlreadySeen, fRequestBufferBytesLeft;
-		unsigned char*	fLastCRLF;
-		unsigned char	fResponseBuffer[RTSP_BUFFER_SIZE];
-		char const*		fCurrentCSeq;
-		unsigned		fBase64RemainderCount;	// used for optional RTSP-over-HTTP tunneling (possible values: 0,1,2,3)
+		ResponseWriter&	fResponse;	// the server's
+		RTSPField		fCurrentCSeq;
 
 		bool			fIsMulticast;
 		unsigned char	fTCPStreamIdCount;	// used for (optional) RTP/TCP
@@ -172,14 +240,18 @@ protected:
 		unsigned		fNumStreamStates;
 		struct streamState {
 			ServerMediaSubsession* subsession;
+			bool isMulticastMember;
 		} * fStreamStates;
 
-		MyList<ClientSocket>	fClientSockList;
+		MySlotList<ClientSocket>	fClientSockList;	// of our streams (owned by their subsessions)
 	};
 
 	RTSPClientSession* createNewClientSession(MySock& clientSock);
 	void addClientSession(RTSPClientSession *clientSession);
 	void removeClientSession(RTSPClientSession *clientSession);
+	u_int64_t newClientSessionId();
+	// a random session id that no other client session of ours has
+	static void shutdownClientSessionOf(RTSPClientSession *clientSession, void *serverMediaSession);
 
 protected:
 	friend class RTSPClientSession;
@@ -192,10 +264,28 @@ protected:
 	void*				fServerCallbackArg;
 
 	MySock			fServerSock;
+	unsigned int	fListenAddress;
 	TaskScheduler*	fTask;
+	int				fMaxClientSessions;
+
+	unsigned			fSendQueueMaxBytes;
+	SEND_QUEUE_POLICY	fSendQueuePolicy;
+	unsigned			fMaxBacklogSeconds;
+
+	bool				fSharedUdpSockets;
+	int					fFanoutWorkers;
+
+	time_t				fDateHeaderTime;
+	char				fDateHeader[64];
+	unsigned			fDateHeaderLength;
+
+	// The client sessions build their responses here, one at a time: every request is handled on the thread
+	// of "fTask", and its response is sent before the next one is handled.
+	char				fResponseBuffer[RTSP_BUFFER_SIZE];
+	ResponseWriter		fResponse;
 
-	MyList<ServerMediaSession>	fServerMediaSessions;
-	MyList<RTSPClientSession>	fClientSessions;
+	MyHashMap<char const*, ServerMediaSession>	fServerMediaSessions;	// by stream name
+	MyHashMap<u_int64_t, RTSPClientSession>		fClientSessions;		// by session id
 };
 
 #endif
@@ -3,6 +3,14 @@
 #include "SockCommon.h"
 #include "RTSPCommonEnv.h"
 #include <stdio.h>
+#include <stdlib.h>
+
+#define SEND_BATCH_SIZE		64		// the most UDP clients sent to with one "writeSocketBatch()"
+#define FANOUT_RING_SIZE	1024	// the most packets waiting for a fan-out worker
+#define GOP_PACKET_SIZE		2048	// the buffer size of the pooled GOP cache packets
+#define GOP_PRIME_MAX_ROUNDS	4	// see "activateClientSock()"
+#define FANOUT_PACKET_SIZE	2048	// the buffer size of the pooled fan-out packets
+#define FANOUT_POOL_SIZE	FANOUT_RING_SIZE	// the most fan-out packets kept for reuse
 
 
 static char const* const libNameStr = "DX Streaming Media v";
@@ -134,6 +142,9 @@ ServerMediaSession::ServerMediaSession(const char *streamName, const char *info,
 	gettimeofday(&fCreationTime, NULL);
 
 	MUTEX_INIT(&fMutex);
+
+	fSDPCache = NULL;
+	MUTEX_INIT(&fSDPMutex);
 }
 
 ServerMediaSession::~ServerMediaSession()
@@ -145,6 +156,7 @@ ServerMediaSession::~ServerMediaSession()
 	delete[] fMiscSDPLines;
 
 	MUTEX_DESTROY(&fMutex);
+	MUTEX_DESTROY(&fSDPMutex);
 }
 
 bool ServerMediaSession::addSubsession(ServerMediaSubsession *subsession)
@@ -161,6 +173,8 @@ bool ServerMediaSession::addSubsession(ServerMediaSubsession *subsession)
 	subsession->fParentSession = this;
 	subsession->fTrackNumber = ++fSubsessionCounter;
 
+	flushSDPCache();
+
 	return true;
 }
 
@@ -171,12 +185,73 @@ void ServerMediaSession::deleteAllSubsessions()
 
 	fSubsessionsHead = fSubsessionsTail = NULL;
 	fSubsessionCounter = 0;
+
+	flushSDPCache();
 }
 
-char* ServerMediaSession::generateSDPDescription()
+ServerMediaSession::SDPDescription* ServerMediaSession::acquireSDPDescription(unsigned int ourAddress)
+{
+	MUTEX_LOCK(&fSDPMutex);
+
+	SDPDescription *description;
+	for (description = fSDPCache; description != NULL; description = description->next) {
+		if (description->ourAddress == ourAddress)
+			break;
+	}
+
+	if (description == NULL) {
+		char *sdp = generateSDPDescription(ourAddress);
+		if (sdp != NULL) {
+			description = new SDPDescription;
+			description->refCount = 1;
+			description->ourAddress = ourAddress;
+			description->sdp = sdp;
+			description->length = strlen(sdp);
+			description->next = fSDPCache;
+			fSDPCache = description;
+		}
+	}
+
+	if (description != NULL)
+		description->refCount++;
+
+	MUTEX_UNLOCK(&fSDPMutex);
+	return description;
+}
+
+void ServerMediaSession::releaseSDPDescription(SDPDescription *description)
+{
+	if (description == NULL) return;
+
+	MUTEX_LOCK(&fSDPMutex);
+	bool last = --description->refCount == 0;
+	MUTEX_UNLOCK(&fSDPMutex);
+
+	if (last) {
+		delete[] description->sdp;
+		delete description;
+	}
+}
+
+void ServerMediaSession::flushSDPCache()
+{
+	// Descriptions still being sent are freed by their last user instead:
+	MUTEX_LOCK(&fSDPMutex);
+	SDPDescription *description = fSDPCache;
+	fSDPCache = NULL;
+	MUTEX_UNLOCK(&fSDPMutex);
+
+	while (description != NULL) {
+		SDPDescription *next = description->next;
+		releaseSDPDescription(description);
+		description = next;
+	}
+}
+
+char* ServerMediaSession::generateSDPDescription(unsigned int ourAddr)
 {
 	struct sockaddr_in ourAddress;
-	ourAddress.sin_addr.s_addr = ourIPAddress();
+	ourAddress.sin_addr.s_addr = ourAddr != 0 ? ourAddr : ourIPAddress();
 	char *ipAddressStr = inet_ntoa(ourAddress.sin_addr);
 	unsigned ipAddressStrSize = strlen(ipAddressStr);
 
@@ -297,32 +372,39 @@ void ServerMediaSession::removeClientSocket(ClientSocket *sock)
 	}
 }
 
-int ServerMediaSession::sendClientRtp(const char *trackId, char *buf, int len)
+void ServerMediaSession::activateClientSocket(ClientSocket *sock)
 {
-	int err = 0;
 	ServerMediaSubsessionIterator iter(*this);
 	ServerMediaSubsession* subsession;
 	while ((subsession = iter.next()) != NULL) {
-		if (strstr(trackId, subsession->trackId()) || strstr(subsession->trackId(), trackId)) {
-			err = subsession->sendClientRtp(buf, len);
-			break;
-		}
+		if (subsession->activateClientSock(sock))
+			return;
 	}
-	return err;
+
+	sock->activate();
 }
 
-int ServerMediaSession::sendClientRtcp(const char *trackId, char *buf, int len)
+ServerMediaSubsession* ServerMediaSession::lookupSubsession(const char *trackId)
 {
-	int err = 0;
 	ServerMediaSubsessionIterator iter(*this);
 	ServerMediaSubsession* subsession;
 	while ((subsession = iter.next()) != NULL) {
-		if (strstr(trackId, subsession->trackId()) || strstr(subsession->trackId(), trackId)) {
-			err = subsession->sendClientRtcp(buf, len);
+		if (strstr(trackId, subsession->trackId()) || strstr(subsession->trackId(), trackId))
 			break;
-		}
 	}
-	return err;
+	return subsession;
+}
+
+int ServerMediaSession::sendClientRtp(const char *trackId, char *buf, int len)
+{
+	ServerMediaSubsession* subsession = lookupSubsession(trackId);
+	return subsession ? subsession->sendClientRtp(buf, len) : 0;
+}
+
+int ServerMediaSession::sendClientRtcp(const char *trackId, char *buf, int len)
+{
+	ServerMediaSubsession* subsession = lookupSubsession(trackId);
+	return subsession ? subsession->sendClientRtcp(buf, len) : 0;
 }
 
 void ServerMediaSession::closeStreamControl()
@@ -488,11 +570,63 @@ ServerMediaSubsession::ServerMediaSubsession(char const* trackId, char const* co
 {
 	fTrackId = strDup(trackId);
 	fCodecName = strDup(codec);
+	fClientSockList.setOrder(compareClients);
+	fWorkers = NULL;
+	fNumWorkers = 0;
+	fWorkersRunning = false;
+	MUTEX_INIT(&fFanoutMutex);
+	fNextFanoutKey = 0;
+	fFanoutPool = NULL;
+	fFanoutPoolCount = 0;
+	MUTEX_INIT(&fFanoutPoolMutex);
+	fMulticastAddress = 0;
+	fMulticastRtpPort = 0;
+	fMulticastTTL = 255;
+	fMulticastSock = NULL;
+	fNumMulticastMembers = 0;
+	fGopMaxBytes = 0;
+	fGopHead = fGopTail = NULL;
+	fGopBytes = 0;
+	fGopValid = false;
+	fGopTimestamp = 0;
+	fGopPool = NULL;
+	fGopGeneration = 0;
+	MUTEX_INIT(&fGopMutex);
+	fKeyframeRequestFunc = NULL;
+	fKeyframeRequestArg = NULL;
+	MUTEX_INIT(&fKeyframeRequestMutex);
+	fSharedRtpSock = fSharedRtcpSock = NULL;
+	fSharedSockTask = NULL;
 }
 
 ServerMediaSubsession::~ServerMediaSubsession()
 {
+	stopFanoutWorkers();
+	MUTEX_DESTROY(&fFanoutMutex);
+	while (fFanoutPool) {
+		FanoutPacket *packet = fFanoutPool;
+		fFanoutPool = packet->next;
+		delete[] packet->buf;
+		delete packet;
+	}
+	MUTEX_DESTROY(&fFanoutPoolMutex);
+
+	clearGopCache();
+	while (fGopPool) {
+		GopPacket *packet = fGopPool;
+		fGopPool = packet->next;
+		delete[] packet->buf;
+		delete packet;
+	}
+	MUTEX_DESTROY(&fGopMutex);
+	MUTEX_DESTROY(&fKeyframeRequestMutex);
+
 	fClientSockList.clear();
+
+	if (fSharedSockTask)
+		fSharedSockTask->turnOffBackgroundReadHandling(fSharedRtcpSock->sock());
+	ServerPortAllocator::releasePortPair(fSharedRtpSock, fSharedRtcpSock);
+
 	delete[] (char*)fTrackId;
 	delete[] fCodecName;
 	delete fNext;
@@ -515,10 +649,8 @@ char const* ServerMediaSubsession::sdpLines()
 	return fSDPLines;
 }
 
-static MUTEX hMutex = PTHREAD_MUTEX_INITIALIZER;
-
 void ServerMediaSubsession::getStreamParameters(
-	unsigned clientSessionId, // in
+	u_int64_t clientSessionId, // in
 	unsigned int clientAddress, // in
 	unsigned short const& clientRTPPort, // in
 	unsigned short const& clientRTCPPort, // in
@@ -529,39 +661,147 @@ void ServerMediaSubsession::getStreamParameters(
 	unsigned char& destinationTTL, // in out
 	bool& isMulticast, // out
 	unsigned short& serverRTPPort, // out
-	unsigned short& serverRTCPPort // out
+	unsigned short& serverRTCPPort, // out
+	MySock*& rtpSock, // out
+	MySock*& rtcpSock // out
 	)
 {
 	if (destinationAddress == 0) destinationAddress = clientAddress;
 
 	isMulticast = false;
+	serverRTPPort = serverRTCPPort = 0;
+	rtpSock = rtcpSock = NULL;
+
+	if (tcpSocketNum >= 0) return;
+
+	// UDP clients of a multicast subsession all join its stream:
+	if (fMulticastAddress != 0) {
+		isMulticast = true;
+		destinationAddress = fMulticastAddress;
+		destinationTTL = fMulticastTTL;
+		serverRTPPort = fMulticastRtpPort;
+		serverRTCPPort = fMulticastRtpPort+1;
+		return;
+	}
 
-	static int serverSockPort = RTSPCommonEnv::nServerPortRangeMin;
-	
-	if (serverSockPort < RTSPCommonEnv::nServerPortRangeMin || serverSockPort > RTSPCommonEnv::nServerPortRangeMax)
-		serverSockPort = RTSPCommonEnv::nServerPortRangeMin;
+	// UDP clients of a subsession with a shared socket pair are all sent from its ports:
+	if (fSharedRtpSock != NULL) {
+		serverRTPPort = fSharedRtpSock->port();
+		serverRTCPPort = fSharedRtcpSock->port();
+		return;
+	}
+
+	if (ServerPortAllocator::allocPortPair(rtpSock, rtcpSock)) {
+		serverRTPPort = rtpSock->port();
+		serverRTCPPort = rtcpSock->port();
+	}
+}
+
+bool ServerMediaSubsession::setupSharedSockets(TaskScheduler *task)
+{
+	if (fSharedRtpSock != NULL) return true;
+
+	MySock *rtpSock, *rtcpSock;
+	if (!ServerPortAllocator::allocPortPair(rtpSock, rtcpSock)) {
+		DPRINTF("failed to setup shared rtp/rtcp sockets\n");
+		return false;
+	}
+	rtpSock->setSendBufferTo(1024*1024*5);
 
-	MUTEX_LOCK(&hMutex);
+	fSharedRtpSock = rtpSock;
+	fSharedRtcpSock = rtcpSock;
+	fSharedSockTask = task;
+	fSharedSockTask->turnOnBackgroundReadHandling(fSharedRtcpSock->sock(), incomingRtcpHandler, this);
 
-	while(1)
-	{
-		serverSockPort = (serverSockPort+1)&~1;
+	return true;
+}
+
+void ServerMediaSubsession::setMulticast(unsigned int groupAddress, unsigned short rtpPort, unsigned char ttl)
+{
+	fMulticastAddress = groupAddress;
+	fMulticastRtpPort = rtpPort&~1;
+	fMulticastTTL = ttl;
+}
+
+bool ServerMediaSubsession::addMulticastMember()
+{
+	if (fNumMulticastMembers++ > 0) return true;
+
+	// The first member starts the multicast stream:
+	MySock *rtpSock, *rtcpSock;
+	if (!ServerPortAllocator::allocPortPair(rtpSock, rtcpSock)) {
+		DPRINTF("failed to setup multicast rtp/rtcp sockets\n");
+		fNumMulticastMembers--;
+		return false;
+	}
+	rtpSock->setMulticastTTL(fMulticastTTL);
+	rtcpSock->setMulticastTTL(fMulticastTTL);
+	rtpSock->setSendBufferTo(1024*1024*5);
 
-		if (serverSockPort > RTSPCommonEnv::nServerPortRangeMax) serverSockPort = RTSPCommonEnv::nServerPortRangeMin;
+	struct sockaddr_in rtpDestAddr, rtcpDestAddr;
+	memset(&rtpDestAddr, 0, sizeof(struct sockaddr_in));
+	rtpDestAddr.sin_family = AF_INET;
+	rtpDestAddr.sin_addr.s_addr = fMulticastAddress;
+	rtpDestAddr.sin_port = htons(fMulticastRtpPort);
+	rtcpDestAddr = rtpDestAddr;
+	rtcpDestAddr.sin_port = htons(fMulticastRtpPort+1);
 
-		if(CheckUdpPort(serverSockPort) == 0)
-		{
-			serverRTPPort = serverSockPort;
-			serverRTCPPort = serverSockPort+1;
-			serverSockPort += 2;
+	fMulticastSock = new ClientSocket(*rtpSock, rtpDestAddr, *rtcpSock, rtcpDestAddr);
+	fMulticastSock->activate();
+	addClientSock(fMulticastSock);
+
+	DPRINTF("server session %s/%s multicast started, %s:%d ttl %d\n",
+		fParentSession ? fParentSession->streamName() : "", trackId(), inet_ntoa(rtpDestAddr.sin_addr), fMulticastRtpPort, fMulticastTTL);
+
+	return true;
+}
+
+void ServerMediaSubsession::removeMulticastMember()
+{
+	if (fNumMulticastMembers == 0 || --fNumMulticastMembers > 0) return;
+
+	// The last member is gone:
+	removeClientSock(fMulticastSock);
+	fMulticastSock = NULL;
+
+	DPRINTF("server session %s/%s multicast stopped\n", fParentSession ? fParentSession->streamName() : "", trackId());
+}
+
+void ServerMediaSubsession::incomingRtcpHandler(void *instance, int)
+{
+	ServerMediaSubsession *subsession = (ServerMediaSubsession *)instance;
+	subsession->incomingRtcpHandler1();
+}
+
+void ServerMediaSubsession::incomingRtcpHandler1()
+{
+	char buf[2048];
+	struct sockaddr_in fromAddress;
+
+	int len = fSharedRtcpSock->readSocket1(buf, sizeof buf, fromAddress);
+	if (len <= 0) return;
+
+	// Find the client by the address and port it sends from; a client behind a NAT may use another port:
+	ClientSocket *client = NULL, *sameAddress = NULL;
+
+	ClientSnapshot *snapshot = fClientSockList.acquire();
+
+	for (int i = 0; i < snapshot->count; i++) {
+		ClientSocket *cursor = snapshot->items[i];
+		if (cursor->isTCP() || cursor->rtcpSock() != fSharedRtcpSock) continue;
+		struct sockaddr_in& destAddr = cursor->rtcpDestAddr();
+		if (destAddr.sin_addr.s_addr != fromAddress.sin_addr.s_addr) continue;
+		if (destAddr.sin_port == fromAddress.sin_port) {
+			client = cursor;
 			break;
 		}
-
-		DPRINTF("Rtp port(%d) already used the other rtp port\r\n", serverSockPort);
-		serverSockPort += 2;
+		if (sameAddress == NULL) sameAddress = cursor;
 	}
 
-	MUTEX_UNLOCK(&hMutex);
+	if (client == NULL) client = sameAddress;
+	if (client != NULL) client->handleRtcpPacket(buf, len);
+
+	fClientSockList.release(snapshot);
 }
 
 float ServerMediaSubsession::getCurrentNPT()
@@ -577,7 +817,8 @@ float ServerMediaSubsession::duration() const
 void ServerMediaSubsession::addClientSock(ClientSocket *sock)
 {
 	fClientSockList.lock();
-	fClientSockList.insert(sock);
+	sock->setFanoutKey(fNextFanoutKey++);
+	sock->setSubsessionHandle(fClientSockList.insert(sock));
 #if 0
 	DPRINTF("server session %s/%s client socket added, count : %d\n", 
 		fParentSession->streamName(), trackId(), fClientSockList.count());
@@ -587,74 +828,576 @@ void ServerMediaSubsession::addClientSock(ClientSocket *sock)
 
 bool ServerMediaSubsession::removeClientSock(ClientSocket *sock)
 {
-	bool ret = false;
-
-	fClientSockList.lock();
-
-	fClientSockList.gotoBeginCursor();
-	ClientSocket *cursor = fClientSockList.getCursor();
-	while (cursor) {
-		if (cursor == sock) {
-			fClientSockList.remove();
-			ret = true;
+	// (The socket may be another subsession's: then its handle doesn't lead to it in our set.)
+	ClientSocket *removed = fClientSockList.remove(sock->subsessionHandle(), sock);
+	if (removed == NULL) return false;
 #if 0
-			DPRINTF("server session %s/%s client socket removed, count : %d\n", 
-				fParentSession->streamName(), trackId(), fClientSockList.count());
+	DPRINTF("server session %s/%s client socket removed, count : %d\n", 
+		fParentSession->streamName(), trackId(), fClientSockList.count());
 #endif
-			break;
+
+	// A sender may still be using it from an older snapshot:
+	fClientSockList.synchronize();
+	delete removed;
+
+	return true;
+}
+
+bool ServerMediaSubsession::activateClientSock(ClientSocket *sock)
+{
+	bool found = fClientSockList.contains(sock->subsessionHandle(), sock);
+
+	if (!found) return false;
+	if (sock->isActivated()) return true;
+
+	// Give it the packets since the last keyframe first, without holding up "cacheGopPacket()" meanwhile:
+	// each round takes (references) the packets cached since the last one with "fGopMutex" locked, and sends
+	// them with it unlocked. Once there are no more (or after GOP_PRIME_MAX_ROUNDS rounds, sending the rest
+	// with it locked), the client is activated before anything more is cached. A packet being sent to the
+	// other clients meanwhile may be in them too, so the client skips whatever it got here.
+	GopPacket **taken = NULL;	// the packets of the last round (still referenced)
+	int numTaken = 0;
+	unsigned generation = 0;
+	int count = 0;
+
+	for (int round = 1; ; round++) {
+		MUTEX_LOCK(&fGopMutex);
+
+		GopPacket *last = numTaken > 0 ? taken[numTaken-1] : NULL;
+		GopPacket *next;
+		if (last != NULL && generation == fGopGeneration)
+			next = last->next;
+		else
+			next = fGopValid ? fGopHead : NULL;	// (a new GOP since the last round, if any)
+
+		bool done = next == NULL || round == GOP_PRIME_MAX_ROUNDS;
+		if (done) {
+			for (; next != NULL; next = next->next, count++) {
+				sock->sendRTP(next->buf, next->len, next->isKeyframe);
+				last = next;
+			}
+			if (last != NULL)
+				sock->activate(((unsigned char)last->buf[2]<<8)|(unsigned char)last->buf[3]);
+			else
+				sock->activate();
 		}
-		fClientSockList.getNext();
-		cursor = fClientSockList.getCursor();
+
+		GopPacket **newTaken = NULL;
+		int numNewTaken = 0;
+		if (!done) {
+			for (GopPacket *packet = next; packet != NULL; packet = packet->next)
+				numNewTaken++;
+			newTaken = new GopPacket*[numNewTaken];
+			numNewTaken = 0;
+			for (GopPacket *packet = next; packet != NULL; packet = packet->next) {
+				packet->refCount++;
+				newTaken[numNewTaken++] = packet;
+			}
+			generation = fGopGeneration;
+		}
+
+		for (int i = 0; i < numTaken; i++)
+			releaseGopPacket(taken[i]);
+		delete[] taken;
+		taken = newTaken;
+		numTaken = numNewTaken;
+
+		MUTEX_UNLOCK(&fGopMutex);
+
+		if (done) break;
+
+		for (int i = 0; i < numTaken; i++)
+			sock->sendRTP(taken[i]->buf, taken[i]->len, taken[i]->isKeyframe);
+		count += numTaken;
 	}
 
-	fClientSockList.unlock();
+	if (count > 0) {
+		DPRINTF("server session %s/%s client primed with %d cached packets\n",
+			fParentSession ? fParentSession->streamName() : "", trackId(), count);
+	} else {
+		requestKeyframe();
+	}
+
+	return true;
+}
+
+void ServerMediaSubsession::setKeyframeRequestHandler(ControlStreamCallback0 func, void *arg)
+{
+	MUTEX_LOCK(&fKeyframeRequestMutex);
+	fKeyframeRequestFunc = func;
+	fKeyframeRequestArg = arg;
+	MUTEX_UNLOCK(&fKeyframeRequestMutex);
+}
+
+void ServerMediaSubsession::requestKeyframe()
+{
+	MUTEX_LOCK(&fKeyframeRequestMutex);
+	if (fKeyframeRequestFunc)
+		fKeyframeRequestFunc(fKeyframeRequestArg);
+	MUTEX_UNLOCK(&fKeyframeRequestMutex);
+}
 
-	return ret;
+void ServerMediaSubsession::setGopCache(unsigned maxBytes)
+{
+	MUTEX_LOCK(&fGopMutex);
+	fGopMaxBytes = maxBytes;
+	clearGopCache();
+	MUTEX_UNLOCK(&fGopMutex);
+}
+
+void ServerMediaSubsession::cacheGopPacket(char *buf, int len, bool keyframe)
+{
+	if (len < 12) return;
+
+	unsigned timestamp = ((unsigned char)buf[4]<<24)|((unsigned char)buf[5]<<16)|((unsigned char)buf[6]<<8)|(unsigned char)buf[7];
+
+	MUTEX_LOCK(&fGopMutex);
+
+	// A keyframe (beginning with its parameter sets) starts the cache anew:
+	if (keyframe && (!fGopValid || timestamp != fGopTimestamp)) {
+		clearGopCache();
+		fGopValid = true;
+		fGopTimestamp = timestamp;
+	}
+
+	if (fGopValid && fGopBytes + len > fGopMaxBytes) {
+		// Too big a GOP: leave it until the next keyframe
+		clearGopCache();
+	}
+
+	if (fGopValid) {
+		GopPacket *packet = fGopPool;
+		if (packet != NULL && len <= packet->size) {
+			fGopPool = packet->next;
+		} else {
+			packet = new GopPacket;
+			packet->size = len > GOP_PACKET_SIZE ? len : GOP_PACKET_SIZE;
+			packet->buf = new char[packet->size];
+		}
+
+		memcpy(packet->buf, buf, len);
+		packet->len = len;
+		packet->isKeyframe = keyframe;
+		packet->refCount = 1;
+		packet->next = NULL;
+
+		if (fGopTail) fGopTail->next = packet;
+		else fGopHead = packet;
+		fGopTail = packet;
+		fGopBytes += len;
+	}
+
+	MUTEX_UNLOCK(&fGopMutex);
+}
+
+void ServerMediaSubsession::clearGopCache()
+{
+	// (called with "fGopMutex" locked)
+	while (fGopHead) {
+		GopPacket *packet = fGopHead;
+		fGopHead = packet->next;
+		releaseGopPacket(packet);
+	}
+
+	fGopTail = NULL;
+	fGopBytes = 0;
+	fGopValid = false;
+	fGopGeneration++;
+}
+
+void ServerMediaSubsession::releaseGopPacket(GopPacket *packet)
+{
+	// (called with "fGopMutex" locked)
+	if (--packet->refCount > 0)
+		return;
+
+	if (packet->size == GOP_PACKET_SIZE) {
+		packet->next = fGopPool;
+		fGopPool = packet;
+	} else {
+		delete[] packet->buf;
+		delete packet;
+	}
+}
+
+int ServerMediaSubsession::compareClients(const void *client1, const void *client2)
+{
+	ClientSocket *clientA = *(ClientSocket* const*)client1;
+	ClientSocket *clientB = *(ClientSocket* const*)client2;
+
+	// RTP/TCP clients first; then the UDP clients by socket, so that "sendClientRtp()" can batch those sharing one:
+	if (clientA->isTCP() || clientB->isTCP())
+		return (int)clientB->isTCP() - (int)clientA->isTCP();
+
+	MySock *sockA = clientA->rtpSock();
+	MySock *sockB = clientB->rtpSock();
+	return sockA < sockB ? -1 : sockA > sockB ? 1 : 0;
+}
+
+int ServerMediaSubsession::fanoutWorkerOf(ClientSocket *client, void *subsession)
+{
+	return client->fanoutKey()%((ServerMediaSubsession *)subsession)->fNumWorkers;
+}
+
+bool ServerMediaSubsession::isKeyframe(char *buf, int len)
+{
+	bool isH264 = strcmp(fCodecName, "H264") == 0;
+	bool isH265 = strcmp(fCodecName, "H265") == 0;
+	if (!isH264 && !isH265) return true;
+
+	unsigned char *ptr = (unsigned char *)buf;
+	if (len < 12) return false;
+
+	// Skip the RTP header (with its CSRCs and header extension):
+	int offset = 12 + (ptr[0]&0x0F)*4;
+	if ((ptr[0]&0x10) && offset+4 <= len)
+		offset += 4 + 4*((ptr[offset+2]<<8)|ptr[offset+3]);
+	if (offset+3 > len) return false;
+
+	unsigned char *payload = &ptr[offset];
+	int nalType;
+
+	if (isH264) {
+		nalType = payload[0]&0x1F;
+		if (nalType == 24) {									// STAP-A: the first NAL unit
+			if (offset+4 > len) return false;
+			nalType = payload[3]&0x1F;
+		} else if (nalType == 28) {								// FU-A: the start fragment only
+			if (!(payload[1]&0x80)) return false;
+			nalType = payload[1]&0x1F;
+		}
+		return nalType == 5 || nalType == 7;					// IDR, SPS
+	} else {
+		nalType = (payload[0]>>1)&0x3F;
+		if (nalType == 48) {									// AP: the first NAL unit
+			if (offset+5 > len) return false;
+			nalType = (payload[4]>>1)&0x3F;
+		} else if (nalType == 49) {								// FU: the start fragment only
+			if (!(payload[2]&0x80)) return false;
+			nalType = payload[2]&0x3F;
+		}
+		return (nalType >= 16 && nalType <= 23) || nalType == 32 || nalType == 33;	// IRAP, VPS, SPS
+	}
 }
 
 int ServerMediaSubsession::sendClientRtp(char *buf, int len)
+{
+	bool keyframe = isKeyframe(buf, len);
+
+	if (fGopMaxBytes > 0 && (strcmp(fCodecName, "H264") == 0 || strcmp(fCodecName, "H265") == 0))
+		cacheGopPacket(buf, len, keyframe);
+
+	if (fWorkers != NULL)
+		return dispatchToWorkers(buf, len, false, keyframe);
+
+	ClientSnapshot *snapshot = fClientSockList.acquire();
+
+	int err = sendRtpToClients(snapshot, 0, snapshot->count, buf, len, keyframe);
+
+	fClientSockList.release(snapshot);
+
+	return err;
+}
+
+int ServerMediaSubsession::sendRtpToClients(ClientSnapshot *snapshot, int begin, int end, char *buf, int len, bool keyframe)
 {
 	int err = 0;
 
-	fClientSockList.lock();
+	// RTP/TCP clients are sent to one by one; UDP clients sharing a socket are sent to in batches:
+	ClientSocket *batchClients[SEND_BATCH_SIZE];
+	struct sockaddr_in batchAddrs[SEND_BATCH_SIZE];
+	int numBatch = 0;
 
-	fClientSockList.gotoBeginCursor();
-	ClientSocket *cursor = fClientSockList.getNextCursor();
-	while (cursor) {
-		if (cursor->isActivated()) {
-			if (cursor->sendRTP(buf, len) < 0) {
+	for (int i = begin; i < end; i++) {
+		ClientSocket *client = snapshot->items[i];
+		if (!client->isActivated()) continue;
+
+		if (client->isTCP()) {
+			if (client->sendRTP(buf, len, keyframe) < 0) {
 				err = WSAGetLastError();
 				DPRINTF("rtp send error %d\n", err);
 			}
+		} else {
+			if (numBatch > 0 && (numBatch == SEND_BATCH_SIZE || batchClients[0]->rtpSock() != client->rtpSock())) {
+				sendUdpBatch(buf, len, batchClients, batchAddrs, numBatch);
+				numBatch = 0;
+			}
+			batchClients[numBatch] = client;
+			batchAddrs[numBatch] = client->rtpDestAddr();
+			numBatch++;
 		}
-		cursor = fClientSockList.getNextCursor();
 	}
 
-	fClientSockList.unlock();
+	if (numBatch > 0)
+		sendUdpBatch(buf, len, batchClients, batchAddrs, numBatch);
 
 	return err;
 }
 
+void ServerMediaSubsession::sendUdpBatch(char *buf, int len, ClientSocket **clients, struct sockaddr_in *addrs, int count)
+{
+	int numSent = 0;
+	if (count > 1)
+		numSent = clients[0]->rtpSock()->writeSocketBatch(buf, len, addrs, count);
+	if (numSent < 0) numSent = 0;
+
+	// Whatever the batch didn't take is sent (and accounted for) one by one:
+	for (int i = numSent; i < count; i++) {
+		if (clients[i]->sendRTP(buf, len) < 0)
+			DPRINTF("rtp send error %d\n", WSAGetLastError());
+	}
+}
+
 int ServerMediaSubsession::sendClientRtcp(char *buf, int len)
 {
-	int err = 0;
+	if (fWorkers != NULL)
+		return dispatchToWorkers(buf, len, true, false);
 
-	fClientSockList.lock();
+	ClientSnapshot *snapshot = fClientSockList.acquire();
+
+	int err = sendRtcpToClients(snapshot, 0, snapshot->count, buf, len);
 
-	fClientSockList.gotoBeginCursor();
-	ClientSocket *cursor = fClientSockList.getNextCursor();
-	while (cursor) {
-		if (cursor->isActivated()) {
-			if (cursor->sendRTCP(buf, len) < 0) {
+	fClientSockList.release(snapshot);
+
+	return err;
+}
+
+int ServerMediaSubsession::sendRtcpToClients(ClientSnapshot *snapshot, int begin, int end, char *buf, int len)
+{
+	int err = 0;
+
+	for (int i = begin; i < end; i++) {
+		ClientSocket *client = snapshot->items[i];
+		if (client->isActivated()) {
+			if (client->sendRTCP(buf, len) < 0) {
 				err = WSAGetLastError();
 				DPRINTF("rtcp send error %d\n", err);
 			}
 		}
-		cursor = fClientSockList.getNextCursor();
 	}
 
+	return err;
+}
+
+bool ServerMediaSubsession::startFanoutWorkers(int numWorkers)
+{
+	if (numWorkers <= 0) return false;
+
+	MUTEX_LOCK(&fFanoutMutex);
+
+	if (fWorkers != NULL) {
+		MUTEX_UNLOCK(&fFanoutMutex);
+		return true;
+	}
+
+	FanoutWorker *workers = new FanoutWorker[numWorkers];
+	fWorkersRunning = true;
+
+	int numStarted;
+	for (numStarted = 0; numStarted < numWorkers; numStarted++) {
+		FanoutWorker *worker = &workers[numStarted];
+		worker->subsession = this;
+		worker->index = numStarted;
+		worker->ring = new FanoutPacket*[FANOUT_RING_SIZE];
+		worker->head = worker->tail = 0;
+		worker->droppedPackets = 0;
+		SEM_INIT(&worker->sem, 0, FANOUT_RING_SIZE+1);
+
+		if (THREAD_CREATE(&worker->thread, fanoutWorkerThread, worker) != 0) {
+			DPRINTF("failed to create fan-out worker thread %d\n", numStarted);
+			SEM_DESTROY(&worker->sem);
+			delete[] worker->ring;
+			break;
+		}
+	}
+
+	if (numStarted == 0) {
+		delete[] workers;
+		MUTEX_UNLOCK(&fFanoutMutex);
+		return false;
+	}
+
+	// From now on, the snapshots split the clients among the workers:
+	fClientSockList.lock();
+	fNumWorkers = numStarted;
+	fClientSockList.setOrder(compareClients, fanoutWorkerOf, this, fNumWorkers);
 	fClientSockList.unlock();
 
-	return err;
+	MEMORY_BARRIER();
+	fWorkers = workers;
+
+	MUTEX_UNLOCK(&fFanoutMutex);
+
+	DPRINTF("server session %s/%s fan-out workers started, count : %d\n",
+		fParentSession ? fParentSession->streamName() : "", trackId(), numStarted);
+
+	return true;
+}
+
+void ServerMediaSubsession::stopFanoutWorkers()
+{
+	MUTEX_LOCK(&fFanoutMutex);
+	FanoutWorker *workers = fWorkers;
+	fWorkers = NULL;
+	MUTEX_UNLOCK(&fFanoutMutex);
+
+	if (workers == NULL) return;
+
+	fWorkersRunning = false;
+	for (int i = 0; i < fNumWorkers; i++)
+		SEM_POST(&workers[i].sem);
+
+	for (int i = 0; i < fNumWorkers; i++) {
+		FanoutWorker *worker = &workers[i];
+		THREAD_JOIN(&worker->thread);
+		THREAD_DESTROY(&worker->thread);
+
+		// the packets it didn't get to:
+		while (worker->head != worker->tail)
+			releaseFanoutPacket(worker->ring[worker->head++%FANOUT_RING_SIZE]);
+
+		SEM_DESTROY(&worker->sem);
+		delete[] worker->ring;
+	}
+
+	delete[] workers;
+}
+
+unsigned ServerMediaSubsession::fanoutDroppedPackets()
+{
+	unsigned dropped = 0;
+
+	MUTEX_LOCK(&fFanoutMutex);
+	if (fWorkers != NULL) {
+		for (int i = 0; i < fNumWorkers; i++)
+			dropped += fWorkers[i].droppedPackets;
+	}
+	MUTEX_UNLOCK(&fFanoutMutex);
+
+	return dropped;
+}
+
+int ServerMediaSubsession::dispatchToWorkers(char *buf, int len, bool isRtcp, bool isKeyframe)
+{
+	// The packet is copied once (before taking "fFanoutMutex"), into a pooled buffer shared by all the workers:
+	FanoutPacket *packet = allocFanoutPacket(len);
+	packet->len = len;
+	packet->isRtcp = isRtcp;
+	packet->isKeyframe = isKeyframe;
+	memcpy(packet->buf, buf, len);
+
+	MUTEX_LOCK(&fFanoutMutex);
+
+	FanoutWorker *workers = fWorkers;
+	if (workers == NULL) {
+		MUTEX_UNLOCK(&fFanoutMutex);
+		packet->refCount = 1;
+		releaseFanoutPacket(packet);
+		return 0;
+	}
+
+	packet->refCount = fNumWorkers;
+
+	for (int i = 0; i < fNumWorkers; i++) {
+		FanoutWorker *worker = &workers[i];
+		if (worker->tail - worker->head >= FANOUT_RING_SIZE) {
+			if (worker->droppedPackets++ == 0)
+				DPRINTF("server session %s/%s fan-out worker %d can't keep up, dropping packets\n",
+					fParentSession ? fParentSession->streamName() : "", trackId(), i);
+			releaseFanoutPacket(packet);
+			continue;
+		}
+
+		worker->ring[worker->tail%FANOUT_RING_SIZE] = packet;
+		MEMORY_BARRIER();
+		worker->tail++;
+		SEM_POST(&worker->sem);
+	}
+
+	MUTEX_UNLOCK(&fFanoutMutex);
+
+	return 0;
+}
+
+ServerMediaSubsession::FanoutPacket* ServerMediaSubsession::allocFanoutPacket(int len)
+{
+	FanoutPacket *packet = NULL;
+
+	if (len <= FANOUT_PACKET_SIZE) {
+		MUTEX_LOCK(&fFanoutPoolMutex);
+		packet = fFanoutPool;
+		if (packet != NULL) {
+			fFanoutPool = packet->next;
+			fFanoutPoolCount--;
+		}
+		MUTEX_UNLOCK(&fFanoutPoolMutex);
+	}
+
+	if (packet == NULL) {
+		packet = new FanoutPacket;
+		packet->size = len > FANOUT_PACKET_SIZE ? len : FANOUT_PACKET_SIZE;
+		packet->buf = new char[packet->size];
+	}
+
+	return packet;
+}
+
+void ServerMediaSubsession::releaseFanoutPacket(FanoutPacket *packet)
+{
+	if (ATOMIC_DEC(&packet->refCount) != 0)
+		return;
+
+	if (packet->size == FANOUT_PACKET_SIZE) {
+		MUTEX_LOCK(&fFanoutPoolMutex);
+		bool pooled = fFanoutPoolCount < FANOUT_POOL_SIZE;
+		if (pooled) {
+			packet->next = fFanoutPool;
+			fFanoutPool = packet;
+			fFanoutPoolCount++;
+		}
+		MUTEX_UNLOCK(&fFanoutPoolMutex);
+		if (pooled) return;
+	}
+
+	delete[] packet->buf;
+	delete packet;
+}
+
+THREAD_FUNC ServerMediaSubsession::fanoutWorkerThread(void *param)
+{
+	FanoutWorker *worker = (FanoutWorker *)param;
+	worker->subsession->fanoutWorkerLoop(worker);
+	return 0;
+}
+
+void ServerMediaSubsession::fanoutWorkerLoop(FanoutWorker *worker)
+{
+	while (1) {
+		if (SEM_WAIT(&worker->sem) != 0) continue;
+
+		if (worker->head == worker->tail) {
+			if (!fWorkersRunning) break;
+			continue;
+		}
+
+		FanoutPacket *packet = worker->ring[worker->head%FANOUT_RING_SIZE];
+		MEMORY_BARRIER();
+		worker->head++;
+
+		ClientSnapshot *snapshot = fWorkersRunning ? fClientSockList.acquire() : NULL;
+		if (snapshot != NULL) {
+			if (snapshot->groupStart != NULL) {
+				int begin = snapshot->groupStart[worker->index];
+				int end = snapshot->groupStart[worker->index+1];
+				if (packet->isRtcp)
+					sendRtcpToClients(snapshot, begin, end, packet->buf, packet->len);
+				else
+					sendRtpToClients(snapshot, begin, end, packet->buf, packet->len, packet->isKeyframe);
+			}
+			fClientSockList.release(snapshot);
+		}
+
+		releaseFanoutPacket(packet);
+	}
 }
 
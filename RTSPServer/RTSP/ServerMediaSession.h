@@ -2,7 +2,9 @@
 #define __SERVER_MEDIA_SESSION_H__
 
 #include "ClientSocket.h"
-#include "MyList.h"
+#include "MySnapshotSet.h"
+#include "Thread.h"
+#include "MySemaphore.h"
 
 #define STREAM_INFO			"DXMediaPlayer"
 #define STREAM_DESCRIPTION	"Session streamed by \"DXMediaPlayer\""
@@ -78,7 +80,22 @@ public:
 
 	virtual ~ServerMediaSession();
 
-	char* generateSDPDescription();
+	char* generateSDPDescription(unsigned int ourAddress = 0);
+	// "ourAddress" is the local interface address the description is for (0 means "ourIPAddress()")
+
+	// A generated SDP description, kept until the subsessions change:
+	struct SDPDescription {
+		int				refCount;	// the users of it, plus one while it is cached
+		unsigned int	ourAddress;
+		char*			sdp;
+		unsigned		length;
+		SDPDescription*	next;
+	};
+
+	SDPDescription* acquireSDPDescription(unsigned int ourAddress);
+	// Returns the SDP description for the local interface "ourAddress", generating it only the first time
+	// (NULL if there is none). Give it back with "releaseSDPDescription()".
+	void releaseSDPDescription(SDPDescription *description);
 
 	char const* streamName() const { return fStreamName; }
 
@@ -113,9 +130,15 @@ public:
 	void closeStreamControl();
 	
 	void removeClientSocket(ClientSocket *sock);
+	void activateClientSocket(ClientSocket *sock);
+	// starts sending to the client socket (see "ServerMediaSubsession::activateClientSock()")
 	int sendClientRtp(const char *trackId, char *buf, int len);
 	int sendClientRtcp(const char *trackId, char *buf, int len);
 
+	ServerMediaSubsession* lookupSubsession(const char *trackId);
+	// Resolve a track once, then send to "ServerMediaSubsession::sendClientRtp()/sendClientRtcp()" directly;
+	// the subsession lives as long as this session.
+
 	SESSION_TYPE sessionType() { return fSessionType; }
 
 protected:
@@ -139,6 +162,11 @@ private:
 
 	StreamControl*	fStreamControl;	
 	MUTEX			fMutex;
+
+	void flushSDPCache();
+
+	SDPDescription*	fSDPCache;	// one per local interface address seen
+	MUTEX			fSDPMutex;
 };
 
 class ServerMediaSubsessionIterator 
@@ -161,7 +189,7 @@ public:
 	unsigned trackNumber() const { return fTrackNumber; }
 	char const* trackId();
 
-	virtual void getStreamParameters(unsigned clientSessionId, // in
+	virtual void getStreamParameters(u_int64_t clientSessionId, // in
 		unsigned int clientAddress, // in
 		unsigned short const& clientRTPPort, // in
 		unsigned short const& clientRTCPPort, // in
@@ -172,7 +200,9 @@ public:
 		unsigned char& destinationTTL, // in out
 		bool& isMulticast, // out
 		unsigned short& serverRTPPort, // out
-		unsigned short& serverRTCPPort // out
+		unsigned short& serverRTCPPort, // out
+		MySock*& rtpSock, // out (a bound socket pair for a UDP client without shared sockets; see "ServerPortAllocator")
+		MySock*& rtcpSock // out
 		);
 
 	virtual float getCurrentNPT();
@@ -180,23 +210,157 @@ public:
 
 	void addClientSock(ClientSocket *sock);
 	bool removeClientSock(ClientSocket *sock);
+	bool activateClientSock(ClientSocket *sock);
+	// Starts sending to one of our clients; with a GOP cache, it first gets the cached packets.
+	// returns false if the client socket isn't ours
+
+	void setGopCache(unsigned maxBytes);
+	// Keeps the RTP packets from the most recent keyframe on (up to "maxBytes"; 0 for none), so that a client
+	// starting to play gets them at once, rather than waiting for the next keyframe. H.264/H.265 only.
+
+	void setKeyframeRequestHandler(ControlStreamCallback0 func, void *arg);
+	// "func" is called when a client starts to play and there is no cached keyframe to give it,
+	// so that the source can be asked for a new one (e.g. a relay sending RTCP PLI/FIR upstream).
+	// It is called from the server thread, and should return at once. Once this returns, the former "func"
+	// isn't being called any more, so that its "arg" may go (e.g. set a NULL "func" before deleting the source).
+	void requestKeyframe();
 
 	char const* codecName() { return fCodecName; }
 	unsigned char rtpPayloadType() { return fRTPPayloadType; }
 	unsigned timestampFrequency() { return fTimestampFrequency; }
 
+	int sendClientRtp(char *buf, int len);
+	int sendClientRtcp(char *buf, int len);
+
+	bool setupSharedSockets(TaskScheduler *task);
+	// Has all the UDP clients of this subsession sent from one server RTP/RTCP socket pair, instead of
+	// a pair per client. RTCP from the clients is read by "task", and told apart by source address.
+	MySock* sharedRtpSock() { return fSharedRtpSock; }
+	MySock* sharedRtcpSock() { return fSharedRtcpSock; }
+
+	bool startFanoutWorkers(int numWorkers);
+	// Has "numWorkers" threads send the packets given to "sendClientRtp()"/"sendClientRtcp()", each to its own
+	// share of the clients, instead of the calling thread sending to all of them. A packet is copied once and
+	// shared by the workers; each client still gets its packets in order.
+	// (Call it before clients are added; it does nothing if the workers are already running.)
+	int numFanoutWorkers() { return fNumWorkers; }
+	unsigned fanoutDroppedPackets();
+	// packets a worker had no room for
+
+	void setMulticast(unsigned int groupAddress, unsigned short rtpPort, unsigned char ttl);
+	// Has the UDP clients of this subsession join one multicast stream to "groupAddress":"rtpPort" (RTCP to "rtpPort"+1),
+	// instead of each getting its own copy. RTP/TCP clients are still sent to one by one.
+	bool isMulticast() { return fMulticastAddress != 0; }
+	bool addMulticastMember();
+	void removeMulticastMember();
+	// The multicast stream is sent while it has members: from the first SETUP, until the last of them is gone.
+
 protected:
 	ServerMediaSubsession(char const* trackId, char const* codec, unsigned char rtpPayload, unsigned timestampFreq);
 	virtual ~ServerMediaSubsession();
 
 	char const* sdpLines();
 
-	int sendClientRtp(char *buf, int len);
-	int sendClientRtcp(char *buf, int len);
+	bool isKeyframe(char *buf, int len);
+	// whether the RTP packet begins a keyframe; always true for codecs other than H.264/H.265
+
+	void sendUdpBatch(char *buf, int len, ClientSocket **clients, struct sockaddr_in *addrs, int count);
+
+	static void incomingRtcpHandler(void*, int);
+	void incomingRtcpHandler1();
 
 	ServerMediaSession*	fParentSession;
 
-	MyList<ClientSocket>	fClientSockList;
+	// The clients, as "sendClientRtp()"/"sendClientRtcp()" see them: each send walks a snapshot of the set,
+	// so that nothing is sent with it locked. A snapshot has the RTP/TCP clients first, then the UDP clients
+	// grouped by socket; with fan-out workers, it is split into a group of clients per worker (in that order within each).
+	MySnapshotSet<ClientSocket>	fClientSockList;
+	typedef MySnapshotSet<ClientSocket>::Snapshot ClientSnapshot;
+
+	static int compareClients(const void *client1, const void *client2);
+	static int fanoutWorkerOf(ClientSocket *client, void *subsession);
+
+	int sendRtpToClients(ClientSnapshot *snapshot, int begin, int end, char *buf, int len, bool keyframe);
+	int sendRtcpToClients(ClientSnapshot *snapshot, int begin, int end, char *buf, int len);
+
+	// A packet on its way to the fan-out workers, released (to "fFanoutPool") by the last one to send it:
+	struct FanoutPacket {
+		int				refCount;
+		int				len;
+		bool			isRtcp;
+		bool			isKeyframe;
+		char*			buf;
+		int				size;	// of "buf"
+		FanoutPacket*	next;	// in "fFanoutPool"
+	};
+
+	// A fan-out worker, fed by a single-producer/single-consumer ring of packets:
+	struct FanoutWorker {
+		ServerMediaSubsession*	subsession;
+		int						index;
+		FanoutPacket**			ring;
+		volatile unsigned		head;	// advanced by the worker
+		volatile unsigned		tail;	// advanced by the sending thread
+		SEMAPHORE				sem;	// posted once per packet put in the ring
+		THREAD					thread;
+		unsigned				droppedPackets;
+	};
+
+	int dispatchToWorkers(char *buf, int len, bool isRtcp, bool isKeyframe);
+	FanoutPacket* allocFanoutPacket(int len);
+	void releaseFanoutPacket(FanoutPacket *packet);
+	void stopFanoutWorkers();
+	static THREAD_FUNC fanoutWorkerThread(void *param);
+	void fanoutWorkerLoop(FanoutWorker *worker);
+
+	FanoutWorker* volatile	fWorkers;
+	int					fNumWorkers;
+	volatile bool		fWorkersRunning;
+	MUTEX				fFanoutMutex;	// taken by the sending threads, so that each ring has a single producer
+	unsigned			fNextFanoutKey;
+	FanoutPacket*		fFanoutPool;	// packets to reuse
+	int					fFanoutPoolCount;
+	MUTEX				fFanoutPoolMutex;
+
+	// The GOP cache (see "setGopCache()"): the packets since the last keyframe, in pooled buffers.
+	struct GopPacket {
+		char*		buf;
+		int			size;	// of "buf"
+		int			len;
+		bool		isKeyframe;
+		int			refCount;	// the cache, and the clients being sent it by "activateClientSock()"
+		GopPacket*	next;
+	};
+
+	void cacheGopPacket(char *buf, int len, bool keyframe);
+	void clearGopCache();
+	void releaseGopPacket(GopPacket *packet);
+
+	unsigned		fGopMaxBytes;
+	GopPacket*		fGopHead;
+	GopPacket*		fGopTail;
+	unsigned		fGopBytes;
+	bool			fGopValid;		// whether the cache starts with a keyframe
+	unsigned		fGopTimestamp;	// of that keyframe
+	GopPacket*		fGopPool;		// buffers to reuse
+	unsigned		fGopGeneration;	// counts the times the cache was emptied
+	MUTEX			fGopMutex;
+
+	ControlStreamCallback0	fKeyframeRequestFunc;
+	void*					fKeyframeRequestArg;
+	MUTEX					fKeyframeRequestMutex;	// held while "fKeyframeRequestFunc" is called
+
+	// the multicast stream (see "setMulticast()"), sent as if to one more client
+	unsigned int	fMulticastAddress;
+	unsigned short	fMulticastRtpPort;
+	unsigned char	fMulticastTTL;
+	ClientSocket*	fMulticastSock;
+	int				fNumMulticastMembers;
+
+	// the shared socket pair (see "setupSharedSockets()")
+	MySock*			fSharedRtpSock;
+	MySock*			fSharedRtcpSock;
+	TaskScheduler*	fSharedSockTask;
 
 private:
 	friend class ServerMediaSession;
@@ -1,4 +1,5 @@
 #include "MySock.h"
+#include "RTSPCommonEnv.h"
 #ifdef LINUX
 #include <string.h>
 #endif
@@ -11,11 +12,14 @@ MySock::MySock()
 	fIsSSM = false;
 	fGroupAddress = fSourceFilterAddr = 0;
 	MUTEX_INIT(&fMutex);
+	fPendingBuf = NULL;
+	fPendingBufSize = fPendingSize = fPendingOffset = 0;
 }
 
 MySock::~MySock()
 {
 	closeSock();
+	delete[] fPendingBuf;
 	MUTEX_DESTROY(&fMutex);
 }
 
@@ -62,9 +66,9 @@ int MySock::setupDatagramSock(short port, int makeNonBlocking)
 	return sock;
 }
 
-int MySock::setupServerSock(short port, int makeNonBlocking)
+int MySock::setupServerSock(short port, int makeNonBlocking, unsigned int bindAddress)
 {
-	int sock = ::setupServerSock(port, makeNonBlocking);
+	int sock = ::setupServerSock(port, makeNonBlocking, bindAddress);
 	if (sock > 0) {
 		fSock = sock;
 		fPort = port;
@@ -86,8 +90,14 @@ int MySock::setupClientSock(int serverSock, int makeNonBlocking)
 
 int MySock::writeSocket(char *buffer, unsigned bufferSize) 
 {
+	int err = -1;
 	MUTEX_LOCK(&fMutex);
-	int err = ::writeSocket(fSock, buffer, bufferSize); 
+	// Nothing may be written in the middle of a partly sent frame:
+	int remain = fPendingSize > 0 ? flushPendingFrame() : 0;
+	if (remain == 0)
+		err = ::writeSocket(fSock, buffer, bufferSize); 
+	else if (remain > 0 && keepPending(buffer, bufferSize))
+		err = bufferSize;
 	MUTEX_UNLOCK(&fMutex);
 	return err;
 }
@@ -100,14 +110,137 @@ int MySock::writeSocket(char *buffer, unsigned bufferSize, struct sockaddr_in &t
 	return err;
 }
 
+int MySock::writeSocketBatch(char *buffer, unsigned bufferSize, struct sockaddr_in *toAddresses, int numAddresses)
+{
+	MUTEX_LOCK(&fMutex);
+	int err = ::writeSocketBatch(fSock, buffer, bufferSize, toAddresses, numAddresses);
+	MUTEX_UNLOCK(&fMutex);
+	return err;
+}
+
 int MySock::sendRTPOverTCP(char *buffer, int len, unsigned char streamChannelId)
 {
+	int err = -1;
+	MUTEX_LOCK(&fMutex);
+	if (fPendingSize == 0 || flushPendingFrame() == 0)
+		err = ::sendRTPOverTCP(fSock, buffer, len, streamChannelId);
+	MUTEX_UNLOCK(&fMutex);
+	return err;
+}
+
+int MySock::sendRTPOverTCP1(char *buffer, int len, unsigned char streamChannelId)
+{
+	int err = -1;
+	MUTEX_LOCK(&fMutex);
+
+	if (fPendingSize > 0 && flushPendingFrame() != 0) goto exit;
+
+	{
+		int bytesSent = ::sendInterleavedFrame(fSock, buffer, len, streamChannelId);
+		if (bytesSent <= 0) goto exit;
+
+		err = 0;
+		if (bytesSent == 4+len) goto exit;
+
+		// Keep the rest of the frame:
+		if (bytesSent < 4) {
+			char header[4];
+			header[0] = '$';
+			header[1] = (char)streamChannelId;
+			header[2] = (char)((len&0xFF00)>>8);
+			header[3] = (char)(len&0x00FF);
+			keepPending(&header[bytesSent], 4-bytesSent);
+			keepPending(buffer, len);
+		} else {
+			keepPending(&buffer[bytesSent-4], 4+len-bytesSent);
+		}
+	}
+
+exit:
+	MUTEX_UNLOCK(&fMutex);
+	return err;
+}
+
+int MySock::writeSocket1(char *buffer, unsigned bufferSize)
+{
+	int err = -1;
 	MUTEX_LOCK(&fMutex);
-	int err = ::sendRTPOverTCP(fSock, buffer, len, streamChannelId);
+
+	{
+		int remain = fPendingSize > 0 ? flushPendingFrame() : 0;
+		if (remain < 0) goto exit;
+
+		int bytesSent = 0;
+		if (remain == 0) {
+			bytesSent = ::writeSocket(fSock, buffer, bufferSize);
+			if (bytesSent < 0) {
+				int sockErr = WSAGetLastError();
+				if (sockErr != EWOULDBLOCK && sockErr != EINTR) goto exit;
+				bytesSent = 0;
+			}
+		}
+
+		if ((unsigned)bytesSent == bufferSize || keepPending(&buffer[bytesSent], bufferSize - bytesSent))
+			err = 0;
+	}
+
+exit:
 	MUTEX_UNLOCK(&fMutex);
 	return err;
 }
 
+int MySock::flushPendingFrame()
+{
+	MUTEX_LOCK(&fMutex);
+
+	while (fPendingOffset < fPendingSize) {
+		int bytesSent = ::writeSocket(fSock, &fPendingBuf[fPendingOffset], fPendingSize - fPendingOffset);
+		if (bytesSent < 0) {
+			int err = WSAGetLastError();
+			if (err == EWOULDBLOCK || err == EINTR) break;
+			MUTEX_UNLOCK(&fMutex);
+			return -1;
+		}
+		fPendingOffset += bytesSent;
+	}
+
+	int remain = fPendingSize - fPendingOffset;
+	if (remain == 0)
+		fPendingSize = fPendingOffset = 0;
+
+	MUTEX_UNLOCK(&fMutex);
+	return remain;
+}
+
+bool MySock::keepPending(char const *buffer, int len)
+{
+	// Move what's left to the front:
+	if (fPendingOffset > 0) {
+		memmove(fPendingBuf, &fPendingBuf[fPendingOffset], fPendingSize - fPendingOffset);
+		fPendingSize -= fPendingOffset;
+		fPendingOffset = 0;
+	}
+
+	if (fPendingSize + len > fPendingBufSize) {
+		int newSize = fPendingBufSize > 0 ? fPendingBufSize : PENDING_BUFFER_INITIAL_SIZE;
+		while (newSize < fPendingSize + len) newSize *= 2;
+		if (newSize > PENDING_BUFFER_MAX_SIZE) {
+			DPRINTF("[%s] %d bytes pending on socket %d already; %d more don't fit\n", __FUNCTION__, fPendingSize, fSock, len);
+			return false;
+		}
+
+		char *newBuf = new char[newSize];
+		if (fPendingSize > 0) memcpy(newBuf, fPendingBuf, fPendingSize);
+		delete[] fPendingBuf;
+		fPendingBuf = newBuf;
+		fPendingBufSize = newSize;
+	}
+
+	memcpy(&fPendingBuf[fPendingSize], buffer, len);
+	fPendingSize += len;
+	return true;
+}
+
 bool MySock::changePort(short port)
 {
 	closeSocket(fSock);
@@ -4,6 +4,9 @@
 #include "SockCommon.h"
 #include "Mutex.h"
 
+#define PENDING_BUFFER_INITIAL_SIZE	(4+65535)		// a whole interleaved frame
+#define PENDING_BUFFER_MAX_SIZE		(1024*1024)
+
 class MySock
 {
 public:
@@ -17,7 +20,7 @@ public:
 
 	int setupStreamSock(short port, int makeNonBlocking);
 	int setupDatagramSock(short port, int makeNonBlocking);
-	int setupServerSock(short port, int makeNonBlocking);
+	int setupServerSock(short port, int makeNonBlocking, unsigned int bindAddress = INADDR_ANY);
 	int setupClientSock(int serverSock, int makeNonBlocking);
 	void closeSock();
 	void shutdown();
@@ -27,6 +30,7 @@ public:
 	unsigned setReceiveBufferTo(unsigned requestedSize) { return ::setReceiveBufferTo(fSock, requestedSize); }
 	unsigned getSendBufferSize() { return ::getSendBufferSize(fSock); }
 	unsigned getReceiveBufferSize() { return ::getReceiveBufferSize(fSock); }
+	bool setMulticastTTL(unsigned char ttl) { return ::setMulticastTTL(fSock, ttl); }
 
 	int readSocket1(char *buffer, unsigned bufferSize, struct sockaddr_in &fromAddress) {
 		return ::readSocket1(fSock, buffer, bufferSize, fromAddress);
@@ -41,8 +45,21 @@ public:
 	}
 
 	int writeSocket(char *buffer, unsigned bufferSize);
+	// (if something is pending - see below - the buffer is kept behind it, and isn't written yet)
 	int writeSocket(char *buffer, unsigned bufferSize, struct sockaddr_in &toAddress);
+	int writeSocketBatch(char *buffer, unsigned bufferSize, struct sockaddr_in *toAddresses, int numAddresses);
 	int sendRTPOverTCP(char *buffer, int len, unsigned char streamChannelId);
+	// (if something is pending, the frame is dropped)
+
+	int sendRTPOverTCP1(char *buffer, int len, unsigned char streamChannelId);
+	// never blocks: returns 0 if the frame was taken, or -1 if nothing was sent.
+	// The rest of a partly sent frame is kept, and goes out before anything else written to this socket.
+	int writeSocket1(char *buffer, unsigned bufferSize);
+	// never blocks: returns 0 if the buffer was taken (what can't be sent now is kept, as above), or -1 on error
+	// or if the pending bytes would exceed PENDING_BUFFER_MAX_SIZE
+	int flushPendingFrame();
+	// returns the number of pending bytes still not sent, or -1 on error
+	bool hasPendingFrame() { return fPendingSize > 0; }
 
 	bool joinGroupSSM(unsigned int groupAddress, unsigned int sourceFilterAddr);
 	bool leaveGroupSSM(unsigned int groupAddress, unsigned int sourceFilterAddr);
@@ -51,6 +68,9 @@ public:
 	bool changePort(short port);
 	void changeDestination(struct in_addr const& newDestAddr, short newDestPort);
 
+protected:
+	bool keepPending(char const *buffer, int len);
+
 protected:
 	int				fSock;
 	unsigned short	fPort;
@@ -62,6 +82,12 @@ protected:
 	unsigned int	fSourceFilterAddr;
 
 	MUTEX			fMutex;
+
+	// the rest of a partly sent interleaved frame (see "sendRTPOverTCP1()"), and what was written after it
+	char*			fPendingBuf;
+	int				fPendingBufSize;
+	int				fPendingSize;
+	int				fPendingOffset;
 };
 
 #endif
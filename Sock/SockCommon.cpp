@@ -6,6 +6,7 @@
 #pragma comment(lib, "ws2_32.lib")
 #elif defined(LINUX)
 #include <string.h>
+#include <sys/uio.h>
 #endif
 
 #define MAKE_SOCKADDR_IN(var,adr,prt) /*adr,prt must be in network order*/\
@@ -81,7 +82,7 @@ void socketErr(char *lpszFormat,...)
 
 static int reuseFlag = 1;
 
-int setupStreamSock(short port, int makeNonBlocking)
+int setupStreamSock(short port, int makeNonBlocking, unsigned int bindAddress)
 {
 	if (!initializeWinsockIfNecessary()) {
 		socketErr("[%s] Failed to initialize 'winsock': ", __FUNCTION__);
@@ -104,7 +105,7 @@ int setupStreamSock(short port, int makeNonBlocking)
 #endif
 	struct sockaddr_in c_addr;
 	memset(&c_addr, 0, sizeof(c_addr));
-	c_addr.sin_addr.s_addr = INADDR_ANY;
+	c_addr.sin_addr.s_addr = bindAddress;
 	c_addr.sin_family = AF_INET;
 	c_addr.sin_port = htons(port);
 
@@ -170,9 +171,9 @@ int setupDatagramSock(short port, int makeNonBlocking)
 
 #define LISTEN_BACKLOG_SIZE 20
 
-int setupServerSock(short port, int makeNonBlocking)
+int setupServerSock(short port, int makeNonBlocking, unsigned int bindAddress)
 {
-	int sock = setupStreamSock(port, makeNonBlocking);
+	int sock = setupStreamSock(port, makeNonBlocking, bindAddress);
 	if (sock < 0) return sock;
 
 	if (listen(sock, LISTEN_BACKLOG_SIZE) != 0) {
@@ -296,6 +297,35 @@ int blockUntilReadable(int sock, timeval *timeout)
 	return result;
 }
 
+int blockUntilWritable(int sock, timeval *timeout)
+{
+	int result = -1;
+
+	do {
+		fd_set wr_set;
+		FD_ZERO(&wr_set);
+		if (sock < 0) break;
+
+		FD_SET((unsigned) sock, &wr_set);
+		const unsigned numFds = sock+1;
+
+		result = select(numFds, NULL, &wr_set, NULL, timeout);
+		if (timeout != NULL && result == 0) {
+			break; // this is OK - timeout occurred
+		} else if (result <= 0) {
+			socketErr("[%s] select() error: ", __FUNCTION__);
+			break;
+		}
+
+		if (!FD_ISSET(sock, &wr_set)) {
+			socketErr("[%s] select() error - !FD_ISSET", __FUNCTION__);
+			break;
+		}
+	} while (0);
+
+	return result;
+}
+
 int readSocket1(int sock, char *buffer, unsigned bufferSize, struct sockaddr_in &fromAddress)
 {
 	int bytesRead;
@@ -372,6 +402,44 @@ int writeSocket(int sock, char *buffer, unsigned int bufferSize, sockaddr_in &to
 	return sendto(sock, buffer, bufferSize, 0, (struct sockaddr *)&toAddress, sizeof(struct sockaddr_in));
 }
 
+int writeSocketBatch(int sock, char *buffer, unsigned bufferSize, struct sockaddr_in *toAddresses, int numAddresses)
+{
+#ifdef LINUX
+#define MAX_BATCH_MESSAGES	(64)
+	struct iovec iov;
+	iov.iov_base = buffer; iov.iov_len = bufferSize;
+
+	struct mmsghdr msgs[MAX_BATCH_MESSAGES];
+	int numSent = 0;
+
+	while (numSent < numAddresses) {
+		int num = numAddresses - numSent;
+		if (num > MAX_BATCH_MESSAGES) num = MAX_BATCH_MESSAGES;
+
+		memset(msgs, 0, num*sizeof(struct mmsghdr));
+		for (int i = 0; i < num; i++) {
+			msgs[i].msg_hdr.msg_name = &toAddresses[numSent+i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+			msgs[i].msg_hdr.msg_iov = &iov;
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		int result = sendmmsg(sock, msgs, num, 0);
+		if (result <= 0) break;
+		numSent += result;
+		if (result < num) break;	// the next message failed; let the caller see why
+	}
+#else
+	int numSent = 0;
+	while (numSent < numAddresses) {
+		if (sendto(sock, buffer, bufferSize, 0, (struct sockaddr *)&toAddresses[numSent], sizeof(struct sockaddr_in)) < 0) break;
+		numSent++;
+	}
+#endif
+
+	return numSent > 0 ? numSent : -1;
+}
+
 bool writeSocket(int socket, struct in_addr address, unsigned short port,
 				 unsigned char* buffer, unsigned bufferSize) 
 {
@@ -396,6 +464,14 @@ bool writeSocket(int socket, struct in_addr address, unsigned short port,
 				 unsigned char* buffer, unsigned bufferSize) 
 {
 	// Before sending, set the socket's TTL:
+	if (!setMulticastTTL(socket, ttlArg))
+		return false;
+
+	return writeSocket(socket, address, port, buffer, bufferSize);
+}
+
+bool setMulticastTTL(int socket, unsigned char ttlArg)
+{
 #if defined(__WIN32__) || defined(_WIN32)
 #define TTL_TYPE int
 #else
@@ -407,22 +483,78 @@ bool writeSocket(int socket, struct in_addr address, unsigned short port,
 		return false;
 	}
 
-	return writeSocket(socket, address, port, buffer, bufferSize);
+	return true;
 }
 
-int sendRTPOverTCP(int sock, char *buffer, int len, unsigned char streamChannelId)
+static int sendRemaining(int sock, char *buffer, int len)
 {
-	char const dollar = '$';
+	while (len > 0) {
+		struct timeval timeout;
+		timeout.tv_sec = SEND_RTP_OVER_TCP_TIMEOUT; timeout.tv_usec = 0;
+		if (blockUntilWritable(sock, &timeout) <= 0) return -1;
 
-	if (send(sock, &dollar, 1, 0) != 1) return -1;
-	if (send(sock, (char*)&streamChannelId, 1, 0) != 1) return -1;
+		int bytesSent = send(sock, buffer, len, 0);
+		if (bytesSent < 0) {
+			int err = WSAGetLastError();
+			if (err == EWOULDBLOCK || err == EINTR) continue;
+			return -1;
+		}
+		buffer += bytesSent; len -= bytesSent;
+	}
 
-	char sz[2];
-	sz[0] = (char)((len&0xFF00)>>8);
-	sz[1] = (char)(len&0x00FF);
-	if (send(sock, sz, 2, 0) != 2) return -1;
+	return 0;
+}
+
+int sendInterleavedFrame(int sock, char *buffer, int len, unsigned char streamChannelId)
+{
+	char header[4];
+	header[0] = '$';
+	header[1] = (char)streamChannelId;
+	header[2] = (char)((len&0xFF00)>>8);
+	header[3] = (char)(len&0x00FF);
+
+	// Send the interleaved header together with the packet, in a single call:
+#ifdef WIN32
+	WSABUF bufs[2];
+	bufs[0].buf = header; bufs[0].len = 4;
+	bufs[1].buf = buffer; bufs[1].len = len;
+	DWORD numBytesSent = 0;
+	int bytesSent = WSASend(sock, bufs, 2, &numBytesSent, 0, NULL, NULL) == 0 ? (int)numBytesSent : -1;
+#else
+	struct iovec iov[2];
+	iov[0].iov_base = header; iov[0].iov_len = 4;
+	iov[1].iov_base = buffer; iov[1].iov_len = len;
+	struct msghdr msg;
+	memset(&msg, 0, sizeof msg);
+	msg.msg_iov = iov; msg.msg_iovlen = 2;
+	int bytesSent = sendmsg(sock, &msg, 0);
+#endif
 
-	if (send(sock, buffer, len, 0) != len) return -1;
+	return bytesSent;
+}
+
+int sendRTPOverTCP(int sock, char *buffer, int len, unsigned char streamChannelId)
+{
+	int bytesSent = sendInterleavedFrame(sock, buffer, len, streamChannelId);
+	if (bytesSent == 4+len) return 0;
+
+	// Nothing was sent (e.g. the socket buffer is full); the packet is dropped, but the stream is still in sync:
+	if (bytesSent <= 0) return -1;
+
+	// Partial write. The rest of the frame must follow, or the client loses the '$' framing:
+	if (bytesSent < 4) {
+		char header[4];
+		header[0] = '$';
+		header[1] = (char)streamChannelId;
+		header[2] = (char)((len&0xFF00)>>8);
+		header[3] = (char)(len&0x00FF);
+		if (sendRemaining(sock, &header[bytesSent], 4-bytesSent) < 0) return -1;
+		bytesSent = 4;
+	}
+	if (sendRemaining(sock, &buffer[bytesSent-4], 4+len-bytesSent) < 0) {
+		DPRINTF("[%s] failed to send the rest of an interleaved frame (%d of %d bytes sent)\n", __FUNCTION__, bytesSent, 4+len);
+		return -1;
+	}
 
 	return 0;
 }
@@ -3,9 +3,10 @@
 
 #include "NetCommon.h"
 
-int setupStreamSock(short port, int makeNonBlocking);
+int setupStreamSock(short port, int makeNonBlocking, unsigned int bindAddress = INADDR_ANY);
 int setupDatagramSock(short port, int makeNonBlocking);
-int setupServerSock(short port, int makeNonBlocking);
+int setupServerSock(short port, int makeNonBlocking, unsigned int bindAddress = INADDR_ANY);
+// ("bindAddress" is the local address to bind to, in network byte order)
 int setupClientSock(int serverSock, int makeNonBlocking, struct sockaddr_in& clientAddr);
 int makeSocketNonBlocking(int sock);
 
@@ -20,6 +21,7 @@ unsigned getBufferSize(int bufOptName, int sock);
 unsigned setBufferSizeTo(int bufOptName, int sock, int requestedSize);
 
 int blockUntilReadable(int sock, struct timeval* timeout);
+int blockUntilWritable(int sock, struct timeval* timeout);
 
 int readSocket1(int sock, char *buffer, unsigned bufferSize, struct sockaddr_in &fromAddress);
 int readSocket(int sock, char *buffer, unsigned bufferSize, struct sockaddr_in &fromAddress, struct timeval *timeout = NULL);
@@ -27,12 +29,20 @@ int readSocketExact(int sock, char *buffer, unsigned bufferSize, struct sockaddr
 
 int writeSocket(int sock, char *buffer, unsigned bufferSize);
 int writeSocket(int sock, char *buffer, unsigned bufferSize, struct sockaddr_in& toAddress);
+int writeSocketBatch(int sock, char *buffer, unsigned bufferSize, struct sockaddr_in *toAddresses, int numAddresses);
+// sends the same datagram to each address, with as few system calls as possible (sendmmsg() on Linux);
+// returns the number of addresses it was sent to, in order, or -1 if none
 
+#define SEND_RTP_OVER_TCP_TIMEOUT	(1)	// seconds to wait for the rest of a partially sent frame
+
+int sendInterleavedFrame(int sock, char *buffer, int len, unsigned char streamChannelId);
+// sends the '$' header and the packet with one call; returns the number of bytes sent, which may be less than 4+len
 int sendRTPOverTCP(int sock, char *buffer, int len, unsigned char streamChannelId);
 
 void shutdown(int sock);
 
 bool isMulticastAddress(unsigned int address);
+bool setMulticastTTL(int socket, unsigned char ttl);
 bool socketJoinGroupSSM(int sock, unsigned int groupAddress, unsigned int sourceFilterAddr);
 bool socketLeaveGroupSSM(int sock, unsigned int groupAddress, unsigned int sourceFilterAddr);
 bool socketJoinGroup(int sock, unsigned int groupAddress);
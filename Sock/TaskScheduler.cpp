@@ -17,6 +17,10 @@ TaskScheduler::TaskScheduler()
 	fMaxNumSockets = 0;
 	fThread = NULL;
 	fReadHandlers = new HandlerSet();
+	MUTEX_INIT(&fWriteMutex);
+	FD_ZERO(&fWriteSet);
+	fMaxNumWriteSockets = 0;
+	fWriteHandlers = new HandlerSet();
 }
 
 TaskScheduler::~TaskScheduler()
@@ -24,9 +28,11 @@ TaskScheduler::~TaskScheduler()
 	stopEventLoop();
 
 	delete fReadHandlers;
+	delete fWriteHandlers;
 
 	THREAD_DESTROY(&fThread);
 
+	MUTEX_DESTROY(&fWriteMutex);
 	MUTEX_DESTROY(&fMutex);
 }
 
@@ -74,6 +80,38 @@ exit:
 	taskUnlock();
 }
 
+void TaskScheduler::turnOnBackgroundWriteHandling(int socketNum, BackgroundHandlerProc* handlerProc, void *clientData) 
+{
+	if (socketNum < 0) return;
+
+	MUTEX_LOCK(&fWriteMutex);
+
+	FD_SET((unsigned)socketNum, &fWriteSet);
+	fWriteHandlers->assignHandler(socketNum, handlerProc, clientData);
+
+	if (socketNum+1 > fMaxNumWriteSockets) {
+		fMaxNumWriteSockets = socketNum+1;
+	}
+
+	MUTEX_UNLOCK(&fWriteMutex);
+}
+
+void TaskScheduler::turnOffBackgroundWriteHandling(int socketNum) 
+{
+	if (socketNum < 0) return;
+
+	MUTEX_LOCK(&fWriteMutex);
+
+	FD_CLR((unsigned)socketNum, &fWriteSet);
+	fWriteHandlers->removeHandler(socketNum);
+
+	if (socketNum+1 == fMaxNumWriteSockets) {
+		--fMaxNumWriteSockets;
+	}
+
+	MUTEX_UNLOCK(&fWriteMutex);
+}
+
 int TaskScheduler::startEventLoop()
 {
 	if (fTaskLoop != 0)
@@ -112,11 +150,16 @@ void TaskScheduler::SingleStep()
 
 	fd_set readSet = fReadSet;
 
+	MUTEX_LOCK(&fWriteMutex);
+	fd_set writeSet = fWriteSet;
+	int maxNumSockets = fMaxNumSockets > fMaxNumWriteSockets ? fMaxNumSockets : fMaxNumWriteSockets;
+	MUTEX_UNLOCK(&fWriteMutex);
+
 	struct timeval timeout;
 	timeout.tv_sec = 1;
 	timeout.tv_usec = 0;
 
-	int selectResult = select(fMaxNumSockets, &readSet, NULL, NULL, &timeout);
+	int selectResult = select(maxNumSockets, &readSet, &writeSet, NULL, &timeout);
 	if (selectResult < 0) {
 		int err = WSAGetLastError();
 #ifdef WIN32
@@ -181,12 +224,43 @@ void TaskScheduler::SingleStep()
 		if (handler == NULL) fLastHandledSocketNum = -1;//because we didn't call a handler
 	}
 
+	if (selectResult > 0) handleWritableSockets(writeSet);
+
 	taskUnlock();
 #ifndef WIN32
 	if (fLastHandledSocketNum == -1) usleep(1);
 #endif
 }
 
+void TaskScheduler::handleWritableSockets(fd_set& writeSet)
+{
+	// Call the handler function for each writable socket.  A handler may turn itself off
+	// (which deletes its descriptor), so look the next one up again after each call:
+	while (1) {
+		MUTEX_LOCK(&fWriteMutex);
+
+		HandlerIterator iter(*fWriteHandlers);
+		HandlerDescriptor* handler;
+		while ((handler = iter.next()) != NULL) {
+			if (FD_ISSET(handler->socketNum, &writeSet) &&
+				FD_ISSET(handler->socketNum, &fWriteSet) /* sanity check */ &&
+				handler->handlerProc != NULL) break;
+		}
+
+		BackgroundHandlerProc* handlerProc = NULL;
+		void* clientData = NULL;
+		if (handler != NULL) {
+			FD_CLR((unsigned)handler->socketNum, &writeSet);
+			handlerProc = handler->handlerProc;
+			clientData = handler->clientData;
+		}
+
+		MUTEX_UNLOCK(&fWriteMutex);
+
+		if (handlerProc == NULL) break;
+		(*handlerProc)(clientData, SOCKET_WRITABLE);
+	}
+}
 
 HandlerDescriptor::HandlerDescriptor(HandlerDescriptor* nextHandler)
 : handlerProc(NULL) {
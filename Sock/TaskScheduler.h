@@ -22,6 +22,11 @@ public:
 	void turnOnBackgroundReadHandling(int socketNum, BackgroundHandlerProc* handlerProc, void *clientData);
 	void turnOffBackgroundReadHandling(int socketNum);	
 
+	void turnOnBackgroundWriteHandling(int socketNum, BackgroundHandlerProc* handlerProc, void *clientData);
+	void turnOffBackgroundWriteHandling(int socketNum);
+	// Write handlers have their own lock, so that these can be called from any thread
+	// without waiting for "select()"; a new write handler is noticed from the next "SingleStep()".
+
 	int startEventLoop();
 	void stopEventLoop();
 	void doEventLoop();
@@ -30,6 +35,7 @@ public:
 
 protected:		
 	virtual void SingleStep();
+	void handleWritableSockets(fd_set& writeSet);
 	void taskLock();
 	void taskUnlock();
 
@@ -43,6 +49,11 @@ protected:
 
 	int		fMaxNumSockets;
 	fd_set	fReadSet;
+
+	MUTEX		fWriteMutex;
+	HandlerSet	*fWriteHandlers;
+	int			fMaxNumWriteSockets;
+	fd_set		fWriteSet;
 };
 
 class HandlerDescriptor {
@@ -1,6 +1,14 @@
 #include "util.h"
 #include "NetCommon.h"
 #include "RTSPCommonEnv.h"
+#include <stdlib.h>
+
+#ifdef WIN32
+#include <wincrypt.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 char* strDup(char const* str) 
 {
@@ -93,3 +101,32 @@ int gettimeofday(struct timeval* tp, int* /*tz*/) {
   return 0;
 }
 #endif
+
+uint64_t secureRandom64()
+{
+	uint64_t value = 0;
+
+#ifdef WIN32
+	HCRYPTPROV provider;
+	if (CryptAcquireContext(&provider, NULL, NULL, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT)) {
+		if (!CryptGenRandom(provider, sizeof value, (BYTE *)&value)) value = 0;
+		CryptReleaseContext(provider, 0);
+	}
+#else
+	int fd = open("/dev/urandom", O_RDONLY);
+	if (fd >= 0) {
+		if (read(fd, &value, sizeof value) != sizeof value) value = 0;
+		close(fd);
+	}
+#endif
+
+	if (value == 0) {
+		// Not expected to happen; fall back to something that is at least hard to guess from outside:
+		DPRINTF("secureRandom64(): no random source!\n");
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		value = ((uint64_t)rand() << 32) ^ ((uint64_t)tv.tv_sec << 20) ^ (uint64_t)tv.tv_usec ^ (uint64_t)rand();
+	}
+
+	return value;
+}
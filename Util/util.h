@@ -3,6 +3,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include "RTSPCommon.h"
 
 #ifdef WIN32
 #include <Winsock2.h>
@@ -14,5 +15,6 @@ int gettimeofday(struct timeval* tp, int* /*tz*/);
 extern char* strDup(char const* str);
 extern char* strDupSize(char const* str);
 extern int CheckUdpPort(unsigned short port);
+extern uint64_t secureRandom64();	// from the OS's cryptographically secure random number generator
 
 #endif
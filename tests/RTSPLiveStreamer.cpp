@@ -2,16 +2,17 @@
 #include "RTSPCommonEnv.h"
 #include "LiveServerMediaSession.h"
 
-RTSPLiveStreamer::RTSPLiveStreamer() : m_pServerSession(NULL), m_pSessionName(NULL)
+RTSPLiveStreamer::RTSPLiveStreamer(RTSPServer *rtspServer) : m_pServerSession(NULL), m_pSessionName(NULL), m_pTracks(NULL), m_nTracks(0)
 {
 	m_pRtspClient = new RTSPClient();
-	m_pRtspServer = RTSPServer::instance();
+	m_pRtspServer = rtspServer ? rtspServer : RTSPServer::instance();
 	m_nState = STREAMER_STATE_STOPPED;
 }
 
 RTSPLiveStreamer::~RTSPLiveStreamer()
 {
 	delete[] m_pSessionName;
+	delete[] m_pTracks;
 	delete m_pRtspClient;
 }
 
@@ -51,6 +52,15 @@ int RTSPLiveStreamer::run()
 
 	MediaSubsessionIterator *iter = new MediaSubsessionIterator(m_pRtspClient->mediaSession());
 	MediaSubsession *subsession = NULL;
+
+	int numTracks = 0;
+	while (iter->next() != NULL) numTracks++;
+	iter->reset();
+
+	delete[] m_pTracks;
+	m_pTracks = new TrackHandle[numTracks];
+	numTracks = 0;
+
 	while ((subsession=iter->next()) != NULL) {
 		char *sdpLines;
 		char *controlPath = checkControlPath(subsession->controlPath());
@@ -60,14 +70,24 @@ int RTSPLiveStreamer::run()
 		else
 			sdpLines = updateSdpLines(subsession->savedSDPLines(), subsession->controlPath(), controlPath);
 
-		m_pServerSession->addSubsession(
-			new LiveServerMediaSubsession(
+		LiveServerMediaSubsession *serverSubsession = new LiveServerMediaSubsession(
 				controlPath,
 				sdpLines, 
 				subsession->codecName(),
 				subsession->rtpPayloadFormat(), 
-				subsession->rtpTimestampFrequency())
-				);
+				subsession->rtpTimestampFrequency());
+		m_pServerSession->addSubsession(serverSubsession);
+
+		if (subsession->fRTPSource) {
+			m_pTracks[numTracks].trackId = subsession->fRTPSource->trackId();
+			m_pTracks[numTracks].subsession = serverSubsession;
+			m_pTracks[numTracks].source = subsession->fRTPSource;
+			numTracks++;
+
+			// a new viewer with nothing cached to start from has the upstream asked for a keyframe
+			if (strcmp(subsession->mediumName(), "video") == 0)
+				serverSubsession->setKeyframeRequestHandler(onKeyframeNeeded, subsession->fRTPSource);
+		}
 
 		if (controlPath) delete[] controlPath;
 		if (sdpLines) delete[] sdpLines;
@@ -75,7 +95,12 @@ int RTSPLiveStreamer::run()
 
 	delete iter;
 
-	m_pRtspServer->addServerMediaSession(m_pServerSession);
+	m_nTracks = numTracks;
+	if (!m_pRtspServer->addServerMediaSession(m_pServerSession)) {
+		// another session streams under our name; it stays, and we stop
+		close();
+		return -1;
+	}
 
 	m_nState = STREAMER_STATE_RUNNING;
 
@@ -84,6 +109,13 @@ int RTSPLiveStreamer::run()
 
 void RTSPLiveStreamer::close()
 {
+	for (int i = 0; i < m_nTracks; i++) {
+		DPRINTF("%s keyframe requests sent: %u, suppressed: %u\n", m_pTracks[i].trackId,
+			m_pTracks[i].source->keyframeRequestsSent(), m_pTracks[i].source->keyframeRequestsSuppressed());
+		// the RTPSource goes with "closeURL()", while the server subsession may still have viewers asking for keyframes
+		m_pTracks[i].subsession->setKeyframeRequestHandler(NULL, NULL);
+	}
+	m_nTracks = 0;
 	m_pRtspClient->closeURL();
 	m_pRtspServer->deleteServerMediaSession(m_pServerSession);
 	m_pServerSession = NULL;
@@ -99,8 +131,9 @@ void RTSPLiveStreamer::onRtpReceived(void *arg, const char *trackId, char *buf,
 
 void RTSPLiveStreamer::onRtpReceived1(const char *trackId, char *buf, int len)
 {
-	if (m_pServerSession)
-		m_pServerSession->sendClientRtp(trackId, buf, len);
+	ServerMediaSubsession *subsession = lookupTrack(trackId);
+	if (subsession)
+		subsession->sendClientRtp(buf, len);
 }
 
 void RTSPLiveStreamer::onRtcpReceived(void *arg, const char *trackId, char *buf, int len)
@@ -111,8 +144,25 @@ void RTSPLiveStreamer::onRtcpReceived(void *arg, const char *trackId, char *buf,
 
 void RTSPLiveStreamer::onRtcpReceived1(const char *trackId, char *buf, int len)
 {
-	if (m_pServerSession)
-		m_pServerSession->sendClientRtcp(trackId, buf, len);
+	ServerMediaSubsession *subsession = lookupTrack(trackId);
+	if (subsession)
+		subsession->sendClientRtcp(buf, len);
+}
+
+void RTSPLiveStreamer::onKeyframeNeeded(void *arg)
+{
+	RTPSource *source = (RTPSource *)arg;
+	source->requestKeyframe();
+}
+
+ServerMediaSubsession* RTSPLiveStreamer::lookupTrack(const char *trackId)
+{
+	// the track ids come from the RTPSources, so comparing the pointers is enough
+	for (int i = 0; i < m_nTracks; i++) {
+		if (m_pTracks[i].trackId == trackId)
+			return m_pTracks[i].subsession;
+	}
+	return NULL;
 }
 
 char* RTSPLiveStreamer::checkControlPath(const char *controlPath)
@@ -15,7 +15,8 @@ typedef enum {
 class RTSPLiveStreamer
 {
 public:
-	RTSPLiveStreamer();
+	RTSPLiveStreamer(RTSPServer *rtspServer = NULL);
+	// relays to "rtspServer" (the default server, if NULL)
 	virtual ~RTSPLiveStreamer();
 
 	STREAMER_STATE state() { return m_nState; }
@@ -31,6 +32,10 @@ protected:
 	static void onRtcpReceived(void *arg, const char *trackId, char *buf, int len);
 	void onRtcpReceived1(const char *trackId, char *buf, int len);
 
+	ServerMediaSubsession* lookupTrack(const char *trackId);
+
+	static void onKeyframeNeeded(void *arg);
+
 protected:
 	char* checkControlPath(const char *controlPath);
 	char* updateSdpLines(const char *sdpLines, const char *orgControlPath, const char *newControlPath);
@@ -42,6 +47,14 @@ protected:
 	ServerMediaSession*	m_pServerSession;
 	RTSPServer*			m_pRtspServer;
 	char*				m_pSessionName;
+
+	// server subsession of each relayed track, resolved in "run()"; keyed by the RTPSource's track id pointer
+	struct TrackHandle {
+		const char*				trackId;
+		ServerMediaSubsession*	subsession;
+		RTPSource*				source;
+	} * m_pTracks;
+	int					m_nTracks;
 };
 
 #endif
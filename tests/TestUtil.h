@@ -0,0 +1,37 @@
+#ifndef __TEST_UTIL_H__
+#define __TEST_UTIL_H__
+
+// Shared by the "test_*" and "bench_*" programs ("make check", "make bench").
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+static int gTestFailures = 0;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+		gTestFailures++; \
+	} \
+} while (0)
+
+// returns the exit status of a test program
+static inline int testResult(const char *name)
+{
+	if (gTestFailures > 0) {
+		fprintf(stderr, "%s: %d check(s) failed\n", name, gTestFailures);
+		return 1;
+	}
+	printf("%s: OK\n", name);
+	return 0;
+}
+
+static inline double nowMicros()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec*1e6 + tv.tv_usec;
+}
+
+#endif
@@ -0,0 +1,98 @@
+// Times "BitVector" reads against the previous way of reading them ("shiftBits()" into a
+// 4-byte buffer for every call), on the fields an AU-header or SPS parser reads.
+
+#include "BitVector.hh"
+#include "TestUtil.h"
+
+#include <string.h>
+
+#define BUF_SIZE	(64*1024)
+#define ROUNDS		(50)
+
+// "BitVector::getBits()" as it was before the cache:
+static unsigned getBitsByShift(unsigned char *base, unsigned &index, unsigned totNumBits, unsigned numBits)
+{
+	unsigned char tmpBuf[4] = {0, 0, 0, 0};
+	unsigned overflowingBits = 0;
+	if (numBits > totNumBits - index) overflowingBits = numBits - (totNumBits - index);
+
+	shiftBits(tmpBuf, 0, base, index, numBits - overflowingBits);
+	index += numBits - overflowingBits;
+
+	unsigned result = (tmpBuf[0]<<24) | (tmpBuf[1]<<16) | (tmpBuf[2]<<8) | tmpBuf[3];
+	result >>= (32 - numBits);
+	result &= (0xFFFFFFFF << overflowingBits);
+	return result;
+}
+
+static unsigned expGolombByShift(unsigned char *base, unsigned &index, unsigned totNumBits)
+{
+	unsigned numLeadingZeroBits = 0;
+	unsigned codeStart = 1;
+	while (getBitsByShift(base, index, totNumBits, 1) == 0 && index < totNumBits) {
+		++numLeadingZeroBits;
+		codeStart *= 2;
+	}
+	return codeStart - 1 + getBitsByShift(base, index, totNumBits, numLeadingZeroBits);
+}
+
+static void report(const char *what, double before, double after, unsigned long long numReads)
+{
+	printf("%-24s shiftBits %7.2f ns/read   cached %6.2f ns/read   (x%.1f)\n",
+		what, before*1000/numReads, after*1000/numReads, before/after);
+}
+
+int main()
+{
+	static unsigned char buf[BUF_SIZE];
+	srand(1);
+	for (unsigned i = 0; i < BUF_SIZE; i++) buf[i] = (unsigned char)rand();
+	unsigned totNumBits = BUF_SIZE*8;
+	unsigned long long sum1 = 0, sum2 = 0;
+
+	static unsigned const widths[] = { 1, 3, 13, 32 };
+	for (unsigned w = 0; w < sizeof widths/sizeof widths[0]; w++) {
+		unsigned numBits = widths[w];
+		unsigned long long numReads = 0;
+
+		double t0 = nowMicros();
+		for (int r = 0; r < ROUNDS; r++) {
+			unsigned index = 0;
+			while (index + numBits <= totNumBits) { sum1 += getBitsByShift(buf, index, totNumBits, numBits); numReads++; }
+		}
+		double t1 = nowMicros();
+		for (int r = 0; r < ROUNDS; r++) {
+			BitVector bv(buf, 0, totNumBits);
+			while (bv.numBitsRemaining() >= numBits) sum2 += bv.getBits(numBits);
+		}
+		double t2 = nowMicros();
+
+		char what[32];
+		snprintf(what, sizeof what, "getBits(%u)", numBits);
+		report(what, t1 - t0, t2 - t1, numReads);
+	}
+
+	// exp-Golomb codes of small values, as in a SPS (mostly 1-7 bits each):
+	for (unsigned i = 0; i < BUF_SIZE; i++) buf[i] = (unsigned char)(rand() | 0x11);
+	{
+		unsigned long long numReads = 0;
+		double t0 = nowMicros();
+		for (int r = 0; r < ROUNDS; r++) {
+			unsigned index = 0;
+			while (index + 64 <= totNumBits) { sum1 += expGolombByShift(buf, index, totNumBits); numReads++; }
+		}
+		double t1 = nowMicros();
+		for (int r = 0; r < ROUNDS; r++) {
+			BitVector bv(buf, 0, totNumBits);
+			while (bv.numBitsRemaining() >= 64) sum2 += bv.get_expGolomb();
+		}
+		double t2 = nowMicros();
+		report("get_expGolomb()", t1 - t0, t2 - t1, numReads);
+	}
+
+	if (sum1 != sum2) {
+		fprintf(stderr, "bench_bitvector: results differ (%llu != %llu)\n", sum1, sum2);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,196 @@
+// Times the server's containers with 10,000 items: inserting them all, walking them, and removing them
+// all in a random order. A linked list with a node per item, walked to find what it removes (as the
+// former "MyList" was), is the baseline.
+
+#include "MySlotList.h"
+#include "MySnapshotSet.h"
+#include "MyHashMap.h"
+#include "TestUtil.h"
+
+#include <string.h>
+
+#define NUM_ITEMS	(10000)
+#define NUM_ROUNDS	(20)
+#define NUM_WALKS	(10)	// per round
+
+struct Item {
+	int value;
+};
+
+// The baseline: appended at its tail, unlinked once found from its head
+class NodeList
+{
+public:
+	NodeList() : fHead(NULL), fTail(NULL) {}
+	~NodeList() { while (fHead) remove(fHead->item); }
+
+	void insert(Item *item) {
+		Node *node = new Node;
+		node->item = item;
+		node->prev = fTail;
+		node->next = NULL;
+		if (fTail) fTail->next = node;
+		else fHead = node;
+		fTail = node;
+	}
+	Item* remove(Item *item) {
+		for (Node *node = fHead; node != NULL; node = node->next) {
+			if (node->item == item) {
+				if (node->prev) node->prev->next = node->next;
+				else fHead = node->next;
+				if (node->next) node->next->prev = node->prev;
+				else fTail = node->prev;
+				delete node;
+				return item;
+			}
+		}
+		return NULL;
+	}
+	long walk() {
+		long sum = 0;
+		for (Node *node = fHead; node != NULL; node = node->next) sum += node->item->value;
+		return sum;
+	}
+
+private:
+	struct Node {
+		Item*	item;
+		Node*	prev;
+		Node*	next;
+	};
+	Node*	fHead;
+	Node*	fTail;
+};
+
+static Item gItems[NUM_ITEMS];
+static int gOrder[NUM_ITEMS];	// the order of removal
+static long const gExpectedSum = (long)NUM_ITEMS*(NUM_ITEMS-1)/2;
+static int gErrors = 0;
+
+struct Times {
+	double insert, walk, remove;
+	Times() : insert(0), walk(0), remove(0) {}
+	void print(char const *name, char const *removeHow) {
+		printf("%-14s insert %8.1f us   walk %7.1f us   remove (%s) %9.1f us\n",
+			name, insert/NUM_ROUNDS, walk/(NUM_ROUNDS*NUM_WALKS), removeHow, remove/NUM_ROUNDS);
+	}
+};
+
+static void benchNodeList()
+{
+	Times times;
+	for (int r = 0; r < NUM_ROUNDS; r++) {
+		NodeList list;
+		double t0 = nowMicros();
+		for (int i = 0; i < NUM_ITEMS; i++) list.insert(&gItems[i]);
+		double t1 = nowMicros();
+		for (int k = 0; k < NUM_WALKS; k++) gErrors += list.walk() != gExpectedSum;
+		double t2 = nowMicros();
+		for (int i = 0; i < NUM_ITEMS; i++) gErrors += list.remove(&gItems[gOrder[i]]) != &gItems[gOrder[i]];
+		double t3 = nowMicros();
+		times.insert += t1 - t0; times.walk += t2 - t1; times.remove += t3 - t2;
+	}
+	times.print("linked list", "by item");
+}
+
+static void benchSlotList()
+{
+	static MySlotList<Item>::Handle handles[NUM_ITEMS];
+	Times times, byFind;
+	for (int r = 0; r < NUM_ROUNDS; r++) {
+		MySlotList<Item> list;
+		double t0 = nowMicros();
+		for (int i = 0; i < NUM_ITEMS; i++) handles[i] = list.insert(&gItems[i]);
+		double t1 = nowMicros();
+		for (int k = 0; k < NUM_WALKS; k++) {
+			long sum = 0;
+			for (int i = 0; i < list.count(); i++) sum += list.at(i)->value;
+			gErrors += sum != gExpectedSum;
+		}
+		double t2 = nowMicros();
+		for (int i = 0; i < NUM_ITEMS; i++) gErrors += list.remove(handles[gOrder[i]]) != &gItems[gOrder[i]];
+		double t3 = nowMicros();
+		times.insert += t1 - t0; times.walk += t2 - t1; times.remove += t3 - t2;
+
+		// (without the handles:)
+		for (int i = 0; i < NUM_ITEMS; i++) list.insert(&gItems[i]);
+		double t4 = nowMicros();
+		for (int i = 0; i < NUM_ITEMS; i++) gErrors += list.remove(list.find(&gItems[gOrder[i]])) != &gItems[gOrder[i]];
+		byFind.remove += nowMicros() - t4;
+		gErrors += list.count() != 0;
+	}
+	times.print("MySlotList", "by handle");
+	printf("%-14s %65s %9.1f us\n", "", "(by find)", byFind.remove/NUM_ROUNDS);
+}
+
+static void benchSnapshotSet()
+{
+	static MySnapshotSet<Item>::Handle handles[NUM_ITEMS];
+	Times times;
+	for (int r = 0; r < NUM_ROUNDS; r++) {
+		MySnapshotSet<Item> set;
+		double t0 = nowMicros();
+		for (int i = 0; i < NUM_ITEMS; i++) handles[i] = set.insert(&gItems[i]);
+		double t1 = nowMicros();
+		for (int k = 0; k < NUM_WALKS; k++) {
+			// (the first walk makes the snapshot; the others share it)
+			MySnapshotSet<Item>::Snapshot *snapshot = set.acquire();
+			long sum = 0;
+			for (int i = 0; i < snapshot->count; i++) sum += snapshot->items[i]->value;
+			set.release(snapshot);
+			gErrors += sum != gExpectedSum;
+		}
+		double t2 = nowMicros();
+		for (int i = 0; i < NUM_ITEMS; i++) gErrors += set.remove(handles[gOrder[i]], &gItems[gOrder[i]]) != &gItems[gOrder[i]];
+		double t3 = nowMicros();
+		times.insert += t1 - t0; times.walk += t2 - t1; times.remove += t3 - t2;
+	}
+	times.print("MySnapshotSet", "by handle");
+}
+
+static void benchHashMap()
+{
+	Times times;
+	for (int r = 0; r < NUM_ROUNDS; r++) {
+		MyHashMap<uint64_t, Item> map;
+		double t0 = nowMicros();
+		for (int i = 0; i < NUM_ITEMS; i++) gErrors += !map.insert((uint64_t)i*0x9E3779B97F4A7C15ULL, &gItems[i]);
+		double t1 = nowMicros();
+		// (a walk here is a lookup of every key)
+		for (int k = 0; k < NUM_WALKS; k++) {
+			long sum = 0;
+			for (int i = 0; i < NUM_ITEMS; i++) sum += map.lookup((uint64_t)i*0x9E3779B97F4A7C15ULL)->value;
+			gErrors += sum != gExpectedSum;
+		}
+		double t2 = nowMicros();
+		for (int i = 0; i < NUM_ITEMS; i++)
+			gErrors += map.remove((uint64_t)gOrder[i]*0x9E3779B97F4A7C15ULL) != &gItems[gOrder[i]];
+		double t3 = nowMicros();
+		times.insert += t1 - t0; times.walk += t2 - t1; times.remove += t3 - t2;
+	}
+	times.print("MyHashMap", "by key");
+}
+
+int main()
+{
+	for (int i = 0; i < NUM_ITEMS; i++) {
+		gItems[i].value = i;
+		gOrder[i] = i;
+	}
+	srand(1);
+	for (int i = NUM_ITEMS-1; i > 0; i--) {
+		int j = rand()%(i+1);
+		int t = gOrder[i]; gOrder[i] = gOrder[j]; gOrder[j] = t;
+	}
+
+	benchNodeList();
+	benchSlotList();
+	benchSnapshotSet();
+	benchHashMap();
+
+	if (gErrors > 0) {
+		fprintf(stderr, "bench_containers: %d wrong results\n", gErrors);
+		return 1;
+	}
+	return 0;
+}
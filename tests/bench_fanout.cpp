@@ -0,0 +1,134 @@
+// Times "ServerMediaSubsession::sendClientRtp()" to 64 UDP clients: sent by the calling thread, then
+// through 1, 2 and 4 fan-out workers. For the workers, it gives what each one sends per second, and what
+// a "sendClientRtp()" call costs the calling thread (which only hands the packet over).
+
+#include "LiveServerMediaSession.h"
+#include "ClientSocket.h"
+#include "SockCommon.h"
+#include "TestUtil.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#define NUM_CLIENTS		(64)
+#define NUM_RECEIVERS	(8)
+#define NUM_PACKETS		(20000)
+#define PACKET_SIZE		(1316)
+
+class BenchSubsession : public LiveServerMediaSubsession
+{
+public:
+	BenchSubsession() : LiveServerMediaSubsession("track1", "", "H264", 96, 90000) {}
+
+	unsigned backlog(int i) { return fWorkers[i].tail - fWorkers[i].head; }
+	unsigned maxBacklog() {
+		unsigned most = 0;
+		for (int i = 0; i < fNumWorkers; i++)
+			if (backlog(i) > most) most = backlog(i);
+		return most;
+	}
+	unsigned dropped(int i) { return fWorkers[i].droppedPackets; }
+	int clientsOf(int i) {
+		ClientSnapshot *snapshot = fClientSockList.acquire();
+		int count = snapshot->groupStart ? snapshot->groupStart[i+1] - snapshot->groupStart[i] : snapshot->count;
+		fClientSockList.release(snapshot);
+		return count;
+	}
+};
+
+static struct sockaddr_in gReceiverAddrs[NUM_RECEIVERS];
+static MySock gRtpSocks[NUM_CLIENTS], gRtcpSocks[NUM_CLIENTS];
+
+static void makePacket(char *buf, unsigned short seqNum)
+{
+	memset(buf, 0x47, PACKET_SIZE);
+	buf[0] = (char)0x80; buf[1] = 96;
+	buf[2] = seqNum >> 8; buf[3] = (char)seqNum;
+	buf[12] = 0x41;	// a non-IDR slice
+}
+
+static void run(int numWorkers)
+{
+	BenchSubsession *subsession = new BenchSubsession();
+	if (numWorkers > 0) subsession->startFanoutWorkers(numWorkers);
+
+	for (int i = 0; i < NUM_CLIENTS; i++) {
+		struct sockaddr_in rtcpAddr = gReceiverAddrs[i%NUM_RECEIVERS];
+		ClientSocket *client = new ClientSocket(gRtpSocks[i], gReceiverAddrs[i%NUM_RECEIVERS], gRtcpSocks[i], rtcpAddr, false);
+		subsession->addClientSock(client);
+		subsession->activateClientSock(client);
+	}
+
+	char buf[PACKET_SIZE];
+	double dispatchTime = 0;
+
+	double t0 = nowMicros();
+	for (int n = 0; n < NUM_PACKETS; n++) {
+		// (Keep the workers' rings from overflowing, so that every packet is sent:)
+		while (numWorkers > 0 && subsession->maxBacklog() > 512)
+			usleep(100);
+
+		makePacket(buf, (unsigned short)n);
+		double t = nowMicros();
+		subsession->sendClientRtp(buf, PACKET_SIZE);
+		dispatchTime += nowMicros() - t;
+	}
+
+	if (numWorkers == 0) {
+		double elapsed = nowMicros() - t0;
+		printf("no workers : %8.0f sends/s\n", (double)NUM_PACKETS*NUM_CLIENTS*1e6/elapsed);
+	} else {
+		double *finished = new double[numWorkers];
+		int numFinished = 0;
+		for (int i = 0; i < numWorkers; i++) finished[i] = 0;
+		while (numFinished < numWorkers) {
+			for (int i = 0; i < numWorkers; i++) {
+				if (finished[i] == 0 && subsession->backlog(i) == 0) {
+					finished[i] = nowMicros();
+					numFinished++;
+				}
+			}
+		}
+
+		double total = 0;
+		printf("%d worker(s): dispatch %5.0f ns/packet;", numWorkers, dispatchTime*1000/NUM_PACKETS);
+		for (int i = 0; i < numWorkers; i++) {
+			double sendsPerSecond = (double)(NUM_PACKETS - subsession->dropped(i))*subsession->clientsOf(i)*1e6/(finished[i] - t0);
+			total += sendsPerSecond;
+			printf("  #%d %8.0f sends/s", i, sendsPerSecond);
+		}
+		printf("  (total %8.0f)\n", total);
+		delete[] finished;
+	}
+
+	delete subsession;	// (and the client sockets, but not their sockets)
+}
+
+int main()
+{
+	int receivers[NUM_RECEIVERS];
+	for (int i = 0; i < NUM_RECEIVERS; i++) {
+		receivers[i] = setupDatagramSock(0, 1);
+		socklen_t len = sizeof gReceiverAddrs[i];
+		getsockname(receivers[i], (struct sockaddr *)&gReceiverAddrs[i], &len);
+		gReceiverAddrs[i].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	}
+	for (int i = 0; i < NUM_CLIENTS; i++) {
+		gRtpSocks[i].setupDatagramSock(0, 1);
+		gRtcpSocks[i].setupDatagramSock(0, 1);
+	}
+
+	run(0);
+	run(1);
+	run(2);
+	run(4);
+
+	for (int i = 0; i < NUM_CLIENTS; i++) {
+		gRtpSocks[i].closeSock();
+		gRtcpSocks[i].closeSock();
+	}
+	for (int i = 0; i < NUM_RECEIVERS; i++)
+		closeSocket(receivers[i]);
+
+	return 0;
+}
@@ -0,0 +1,118 @@
+// Times the RTP receive path of a "H264RTPSource" (reordering buffer, then depacketizing into the
+// frame buffer), per packet, for small single-NAL-unit packets and for FU-A fragments.
+
+#include "MediaSession.h"
+#include "H264RTPSource.h"
+#include "TestUtil.h"
+
+#include <string.h>
+
+#define NUM_PACKETS		(1000000)
+#define PAYLOAD_TYPE	(96)
+
+static char const* sdp =
+	"v=0\r\n"
+	"o=- 0 0 IN IP4 127.0.0.1\r\n"
+	"s=bench\r\n"
+	"t=0 0\r\n"
+	"m=video 0 RTP/AVP 96\r\n"
+	"a=rtpmap:96 H264/90000\r\n"
+	"a=control:track1\r\n";
+
+static unsigned long long gNumFrames = 0, gNumRtpPackets = 0;
+
+static void frameHandler(void *, RTP_FRAME_TYPE, int64_t, uint8_t *, int len)
+{
+	gNumFrames += len > 0;
+}
+
+static void rtpHandler(void *, char *, char *, int)
+{
+	gNumRtpPackets++;
+}
+
+// a single NAL unit ("nalUnitType" 1 or 5), or a FU-A fragment of one, "payloadLen" bytes in all
+static int makePacket(unsigned char *buf, unsigned short seqNum, unsigned timestamp, bool marker,
+					  int payloadLen, bool fuA, bool start, bool end)
+{
+	buf[0] = 0x80;
+	buf[1] = (marker ? 0x80 : 0) | PAYLOAD_TYPE;
+	buf[2] = seqNum >> 8; buf[3] = (unsigned char)seqNum;
+	buf[4] = timestamp >> 24; buf[5] = timestamp >> 16; buf[6] = timestamp >> 8; buf[7] = (unsigned char)timestamp;
+	buf[8] = 0x12; buf[9] = 0x34; buf[10] = 0x56; buf[11] = 0x78;
+
+	unsigned char *payload = &buf[12];
+	memset(payload, 0xAB, payloadLen);
+	if (fuA) {
+		payload[0] = 0x60 | 28;
+		payload[1] = (start ? 0x80 : 0) | (end ? 0x40 : 0) | 1;
+	} else {
+		payload[0] = 0x60 | 1;
+	}
+	return 12 + payloadLen;
+}
+
+static double run(RTPSource &source, int payloadLen, int fragmentsPerFrame)
+{
+	static unsigned char buf[1500];
+	struct sockaddr_in from;
+	memset(&from, 0, sizeof from);
+	from.sin_addr.s_addr = htonl(0x7F000001);
+
+	static unsigned short seqNum = 0;
+	unsigned timestamp = 0;
+
+	double t0 = nowMicros();
+	for (int i = 0; i < NUM_PACKETS; i++) {
+		int fragment = i%fragmentsPerFrame;
+		bool last = fragment == fragmentsPerFrame - 1;
+		int len = makePacket(buf, seqNum++, timestamp, last, payloadLen, fragmentsPerFrame > 1, fragment == 0, last);
+		source.rtpReadHandler((char *)buf, len, from);
+		if (last) timestamp += 3000;
+	}
+	double t1 = nowMicros();
+
+	return (t1 - t0)*1000/NUM_PACKETS;
+}
+
+int main()
+{
+	MediaSession *session = MediaSession::createNew(sdp);
+	MediaSubsessionIterator iter(*session);
+	MediaSubsession *subsession = iter.next();
+	if (subsession == NULL) {
+		fprintf(stderr, "bench_rtp_depacketize: bad SDP\n");
+		return 1;
+	}
+
+	TaskScheduler task;
+	H264RTPSource source(STREAM_TYPE_TCP, *subsession, task);
+
+	static struct { const char *name; int payloadLen; int fragmentsPerFrame; } const cases[] = {
+		{ "single NAL, 100 bytes", 100, 1 },
+		{ "FU-A, 1400 bytes x 20", 1400, 20 },
+	};
+
+	for (unsigned c = 0; c < sizeof cases/sizeof cases[0]; c++) {
+		source.startNetworkReading(frameHandler, NULL, NULL, NULL, NULL, NULL);
+		double frameOnly = run(source, cases[c].payloadLen, cases[c].fragmentsPerFrame);
+		source.startNetworkReading(NULL, NULL, rtpHandler, NULL, NULL, NULL);
+		double rtpOnly = run(source, cases[c].payloadLen, cases[c].fragmentsPerFrame);
+		source.startNetworkReading(frameHandler, NULL, rtpHandler, NULL, NULL, NULL);
+		double both = run(source, cases[c].payloadLen, cases[c].fragmentsPerFrame);
+		source.stopNetworkReading();
+
+		printf("%-24s frame handler %6.1f ns/packet   RTP handler %6.1f ns/packet   both %6.1f ns/packet\n",
+			cases[c].name, frameOnly, rtpOnly, both);
+	}
+
+	unsigned long long expectedFrames = NUM_PACKETS*2 + NUM_PACKETS/20*2;
+	if (gNumFrames != expectedFrames || gNumRtpPackets != 4ULL*NUM_PACKETS) {
+		fprintf(stderr, "bench_rtp_depacketize: %llu frames (expected %llu), %llu RTP packets (expected %llu)\n",
+			gNumFrames, expectedFrames, gNumRtpPackets, 4ULL*NUM_PACKETS);
+		return 1;
+	}
+
+	delete session;
+	return 0;
+}
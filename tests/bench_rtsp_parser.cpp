@@ -0,0 +1,90 @@
+// Times "RTSPRequestParser" on the requests of a player's session (OPTIONS, DESCRIBE, SETUP, PLAY, as
+// VLC sends them): given whole, and arriving in 32-byte reads - carrying on from the last read, against
+// starting over on each one (as a parser that isn't incremental has to).
+
+#include "NetCommon.h"
+#include "RTSPCommon.h"
+#include "TestUtil.h"
+
+#include <string.h>
+
+#define NUM_ROUNDS	(500000)
+#define READ_SIZE	(32)
+
+static char const* requests[] = {
+	"OPTIONS rtsp://10.0.0.5:554/live RTSP/1.0\r\n"
+	"CSeq: 2\r\n"
+	"User-Agent: LibVLC/3.0.18 (LIVE555 Streaming Media v2016.11.28)\r\n\r\n",
+
+	"DESCRIBE rtsp://10.0.0.5:554/live RTSP/1.0\r\n"
+	"CSeq: 3\r\n"
+	"User-Agent: LibVLC/3.0.18 (LIVE555 Streaming Media v2016.11.28)\r\n"
+	"Accept: application/sdp\r\n\r\n",
+
+	"SETUP rtsp://10.0.0.5:554/live/track1 RTSP/1.0\r\n"
+	"CSeq: 4\r\n"
+	"User-Agent: LibVLC/3.0.18 (LIVE555 Streaming Media v2016.11.28)\r\n"
+	"Transport: RTP/AVP;unicast;client_port=50000-50001\r\n\r\n",
+
+	"PLAY rtsp://10.0.0.5:554/live/ RTSP/1.0\r\n"
+	"CSeq: 5\r\n"
+	"User-Agent: LibVLC/3.0.18 (LIVE555 Streaming Media v2016.11.28)\r\n"
+	"Session: 1A2B3C4D\r\n"
+	"Range: npt=0.000-\r\n\r\n",
+};
+#define NUM_REQUESTS	(sizeof requests/sizeof requests[0])
+
+static unsigned gSum = 0;	// (so that the work isn't optimized away)
+
+static void use(RTSPRequestParser &parser, int headerSize)
+{
+	RTSPField const *transport = parser.header("Transport");
+	gSum += headerSize + parser.cseq().len + (transport ? transport->len : 0);
+}
+
+static double runWhole()
+{
+	RTSPRequestParser parser;
+	double t0 = nowMicros();
+	for (int r = 0; r < NUM_ROUNDS; r++) {
+		for (unsigned i = 0; i < NUM_REQUESTS; i++) {
+			parser.reset();
+			use(parser, parser.parse(requests[i], strlen(requests[i])));
+		}
+	}
+	return (nowMicros() - t0)*1000/(NUM_ROUNDS*NUM_REQUESTS);
+}
+
+static double runInReads(bool startOver)
+{
+	RTSPRequestParser parser;
+	double t0 = nowMicros();
+	for (int r = 0; r < NUM_ROUNDS; r++) {
+		for (unsigned i = 0; i < NUM_REQUESTS; i++) {
+			unsigned len = strlen(requests[i]), received = 0;
+			int headerSize = 0;
+			parser.reset();
+			while (headerSize == 0 && received < len) {
+				received += READ_SIZE;
+				if (received > len) received = len;
+				if (startOver) parser.reset();
+				headerSize = parser.parse(requests[i], received);
+			}
+			use(parser, headerSize);
+		}
+	}
+	return (nowMicros() - t0)*1000/(NUM_ROUNDS*NUM_REQUESTS);
+}
+
+int main()
+{
+	double whole = runWhole();
+	double incremental = runInReads(false);
+	double startOver = runInReads(true);
+
+	printf("whole request       %6.1f ns/request\n", whole);
+	printf("%d-byte reads:      %6.1f ns/request carrying on, %6.1f ns/request starting over (x%.2f)\n",
+		READ_SIZE, incremental, startOver, startOver/incremental);
+
+	return gSum == 0;
+}
@@ -0,0 +1,66 @@
+// Times sending one RTP packet to N UDP clients from one socket: a "sendto()" per client, against
+// "writeSocketBatch()" (sendmmsg(), 64 clients per system call).
+
+#include "SockCommon.h"
+#include "TestUtil.h"
+
+#include <string.h>
+
+#define NUM_RECEIVERS	(16)
+#define PACKET_SIZE		(1316)
+#define TOTAL_SENDS		(400000)	// per case
+
+int main()
+{
+	int receivers[NUM_RECEIVERS];
+	struct sockaddr_in receiverAddrs[NUM_RECEIVERS];
+	for (int i = 0; i < NUM_RECEIVERS; i++) {
+		receivers[i] = setupDatagramSock(0, 1);
+		socklen_t len = sizeof receiverAddrs[i];
+		getsockname(receivers[i], (struct sockaddr *)&receiverAddrs[i], &len);
+		receiverAddrs[i].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	}
+
+	int sender = setupDatagramSock(0, 1);
+	setSendBufferTo(sender, 4*1024*1024);
+
+	char packet[PACKET_SIZE];
+	memset(packet, 0x47, sizeof packet);
+
+	static int const numClients[] = { 1, 4, 16, 64, 256 };
+	for (unsigned c = 0; c < sizeof numClients/sizeof numClients[0]; c++) {
+		int n = numClients[c];
+		struct sockaddr_in *addrs = new struct sockaddr_in[n];
+		for (int i = 0; i < n; i++)
+			addrs[i] = receiverAddrs[i%NUM_RECEIVERS];
+
+		int rounds = TOTAL_SENDS/n;
+		int numFailed = 0;
+
+		double t0 = nowMicros();
+		for (int r = 0; r < rounds; r++) {
+			for (int i = 0; i < n; i++) {
+				if (writeSocket(sender, packet, sizeof packet, addrs[i]) < 0) numFailed++;
+			}
+		}
+		double t1 = nowMicros();
+		for (int r = 0; r < rounds; r++) {
+			int numSent = writeSocketBatch(sender, packet, sizeof packet, addrs, n);
+			if (numSent < n) numFailed += n - (numSent < 0 ? 0 : numSent);
+		}
+		double t2 = nowMicros();
+
+		// (The receivers aren't read, so the loopback drops most of the packets at their end; the sends still succeed.)
+		double perSendto = (t1 - t0)*1000/(rounds*n), perBatch = (t2 - t1)*1000/(rounds*n);
+		printf("%3d clients: sendto %6.0f ns/client   writeSocketBatch %6.0f ns/client   (x%.2f)%s\n",
+			n, perSendto, perBatch, perSendto/perBatch, numFailed ? "  (some sends failed)" : "");
+
+		delete[] addrs;
+	}
+
+	closeSocket(sender);
+	for (int i = 0; i < NUM_RECEIVERS; i++)
+		closeSocket(receivers[i]);
+
+	return 0;
+}
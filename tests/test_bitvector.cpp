@@ -0,0 +1,171 @@
+// Checks "BitVector" reads (through its 64-bit cache) against a plain bit-by-bit reader.
+
+#include "BitVector.hh"
+#include "TestUtil.h"
+
+#include <string.h>
+
+// The reference: one bit at a time, straight from the buffer.
+class RefBitReader
+{
+public:
+	RefBitReader(unsigned char const *buf, unsigned bitOffset, unsigned numBits)
+	: fBuf(buf), fBitOffset(bitOffset), fNumBits(numBits), fIndex(0) {}
+
+	unsigned get1Bit() {
+		if (fIndex >= fNumBits) return 0;
+		unsigned pos = fBitOffset + fIndex++;
+		return (fBuf[pos/8] >> (7 - pos%8)) & 1;
+	}
+	unsigned getBits(unsigned n) {
+		if (n > 32) n = 32;	// as "BitVector" does
+		unsigned result = 0;
+		for (unsigned i = 0; i < n; i++) result = (result << 1) | get1Bit();
+		return result;
+	}
+	void skipBits(unsigned n) { fIndex = n > fNumBits - fIndex ? fNumBits : fIndex + n; }
+	void skipBytesAligned() { unsigned pos = fBitOffset + fIndex; if (pos%8 != 0) skipBits(8 - pos%8); }
+	unsigned get_expGolomb() {
+		unsigned numLeadingZeroBits = 0;
+		unsigned codeStart = 1;
+		while (get1Bit() == 0 && fIndex < fNumBits) {
+			++numLeadingZeroBits;
+			codeStart *= 2;
+		}
+		return codeStart - 1 + getBits(numLeadingZeroBits);
+	}
+	int get_expGolombSigned() {
+		unsigned codeNum = get_expGolomb();
+		return (codeNum & 1) ? (int)((codeNum + 1)/2) : -(int)(codeNum/2);
+	}
+	unsigned index() { return fIndex; }
+
+private:
+	unsigned char const*	fBuf;
+	unsigned				fBitOffset;
+	unsigned				fNumBits;
+	unsigned				fIndex;
+};
+
+// Appends the exp-Golomb code of "value" (as "ue(v)") to "buf" at bit "pos".
+static void putExpGolomb(unsigned char *buf, unsigned &pos, unsigned value)
+{
+	unsigned codeNum = value + 1;
+	unsigned numBits = 0;
+	while ((codeNum >> numBits) > 1) numBits++;
+	for (unsigned i = 0; i < numBits; i++, pos++)
+		buf[pos/8] &= ~(0x80 >> pos%8);
+	for (int i = numBits; i >= 0; i--, pos++) {
+		if ((codeNum >> i) & 1) buf[pos/8] |= 0x80 >> pos%8;
+		else buf[pos/8] &= ~(0x80 >> pos%8);
+	}
+}
+
+static void testRefillAcrossBytes()
+{
+	// Reads that straddle the 64-bit cache and the byte boundaries, from every starting bit offset:
+	unsigned char buf[40];
+	for (unsigned i = 0; i < sizeof buf; i++) buf[i] = (unsigned char)(i*37 + 11);
+
+	for (unsigned offset = 0; offset < 8; offset++) {
+		for (unsigned first = 0; first <= 32; first++) {
+			unsigned numBits = sizeof buf*8 - offset;
+			BitVector bv(buf, offset, numBits);
+			RefBitReader ref(buf, offset, numBits);
+			CHECK(bv.getBits(first) == ref.getBits(first));
+			while (ref.index() < numBits) {
+				CHECK(bv.getBits(32) == ref.getBits(32));
+				CHECK(bv.curBitIndex() == ref.index());
+			}
+			CHECK(bv.getBits(32) == 0);	// past the end
+			CHECK(bv.curBitIndex() == numBits);
+		}
+	}
+}
+
+static void testExpGolomb()
+{
+	unsigned char buf[512];
+	memset(buf, 0, sizeof buf);
+
+	static unsigned const values[] = { 0, 1, 2, 3, 7, 8, 255, 256, 65534, 65535, 1000000, 0x7FFFFFFE };
+	unsigned const numValues = sizeof values/sizeof values[0];
+
+	unsigned pos = 3;	// not byte-aligned
+	for (unsigned i = 0; i < numValues; i++) putExpGolomb(buf, pos, values[i]);
+	// then the same values as "se(v)": 0, 1, -1, 2, -2, ...
+	static int const signedValues[] = { 0, 1, -1, 2, -2, 127, -128, 32767, -32768, 1000000, -1000000 };
+	unsigned const numSignedValues = sizeof signedValues/sizeof signedValues[0];
+	for (unsigned i = 0; i < numSignedValues; i++) {
+		int v = signedValues[i];
+		putExpGolomb(buf, pos, v > 0 ? 2*v - 1 : -2*v);
+	}
+
+	BitVector bv(buf, 3, pos - 3);
+	for (unsigned i = 0; i < numValues; i++)
+		CHECK(bv.get_expGolomb() == values[i]);
+	for (unsigned i = 0; i < numSignedValues; i++)
+		CHECK(bv.get_expGolombSigned() == signedValues[i]);
+	CHECK(bv.numBitsRemaining() == 0);
+}
+
+static void testSkipBytesAligned()
+{
+	unsigned char buf[16];
+	for (unsigned i = 0; i < sizeof buf; i++) buf[i] = (unsigned char)i;
+
+	for (unsigned offset = 0; offset < 8; offset++) {
+		for (unsigned skip = 0; skip < 24; skip++) {
+			BitVector bv(buf, offset, sizeof buf*8 - offset);
+			bv.skipBits(skip);
+			bv.skipBytesAligned();
+			CHECK((offset + bv.curBitIndex())%8 == 0);
+			CHECK(bv.curBitIndex() >= skip && bv.curBitIndex() < skip + 8);
+			unsigned byteIndex = (offset + bv.curBitIndex())/8;
+			CHECK(bv.getBits(8) == buf[byteIndex]);
+			bv.skipBytesAligned();	// already aligned: no-op
+			CHECK(bv.getBits(8) == buf[byteIndex+1]);
+		}
+	}
+}
+
+static void testRandomSequences()
+{
+	srand(1234);
+	unsigned char buf[64];
+
+	for (int round = 0; round < 20000; round++) {
+		for (unsigned i = 0; i < sizeof buf; i++) buf[i] = (unsigned char)rand();
+		// sparse buffers, so that the exp-Golomb codes are long:
+		if (round%2) for (unsigned i = 0; i < sizeof buf; i++) buf[i] &= (unsigned char)rand() & (unsigned char)rand();
+
+		unsigned offset = rand()%8;
+		unsigned numBits = rand()%(sizeof buf*8 - offset + 1);
+		BitVector bv(buf, offset, numBits);
+		RefBitReader ref(buf, offset, numBits);
+
+		for (int op = 0; op < 40; op++) {
+			unsigned n = rand()%33;
+			switch (rand()%6) {
+				case 0: CHECK(bv.getBits(n) == ref.getBits(n)); break;
+				case 1: CHECK(bv.get1Bit() == ref.get1Bit()); break;
+				case 2: n = rand()%100; bv.skipBits(n); ref.skipBits(n); break;
+				case 3: bv.skipBytesAligned(); ref.skipBytesAligned(); break;
+				case 4: CHECK(bv.get_expGolomb() == ref.get_expGolomb()); break;
+				case 5: CHECK(bv.get_expGolombSigned() == ref.get_expGolombSigned()); break;
+			}
+			CHECK(bv.curBitIndex() == ref.index());
+			if (gTestFailures > 0) return;
+		}
+	}
+}
+
+int main()
+{
+	testRefillAcrossBytes();
+	testExpGolomb();
+	testSkipBytesAligned();
+	testRandomSequences();
+
+	return testResult("test_bitvector");
+}
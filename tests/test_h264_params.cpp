@@ -0,0 +1,400 @@
+// Checks that "setInjectParameterSets()" puts the parameter sets in front of the first slice of a
+// keyframe that doesn't carry its own, and nowhere else (e.g. not in front of a later slice); and that
+// "setKeyframeOnly()" delivers keyframe NAL units only, whole, whether fragmented, aggregated, or with
+// packets lost.
+
+#include "MediaSession.h"
+#include "H264RTPSource.h"
+#include "H265RTPSource.h"
+#include "TestUtil.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_FRAMES		(32)
+#define MAX_FRAME_SIZE	(4096)
+#define REORDERING_WAIT	(150000)	// us; longer than the reordering buffer waits for a lost packet
+
+static char const* sdpFormat =
+	"v=0\r\n"
+	"o=- 0 0 IN IP4 127.0.0.1\r\n"
+	"s=test\r\n"
+	"t=0 0\r\n"
+	"m=video 0 RTP/AVP 96\r\n"
+	"a=rtpmap:96 %s/90000\r\n"
+	"a=control:track1\r\n";
+
+static struct { int len; uint8_t buf[MAX_FRAME_SIZE]; } gFrames[MAX_FRAMES];
+static int gNumFrames = 0;
+
+static void frameHandler(void *, RTP_FRAME_TYPE, int64_t, uint8_t *buf, int len)
+{
+	if (gNumFrames < MAX_FRAMES && len <= MAX_FRAME_SIZE) {
+		gFrames[gNumFrames].len = len;
+		memcpy(gFrames[gNumFrames].buf, buf, len);
+	}
+	gNumFrames++;
+}
+
+class PacketFeeder
+{
+public:
+	PacketFeeder(RTPSource &source) : fSource(source), fSeqNum(1000), fLost(false) {}
+
+	// the next packet is lost
+	void lose() {
+		fSeqNum++;
+		fLost = true;
+	}
+
+	void send(uint32_t timestamp, bool marker, uint8_t const *payload, int len) {
+		uint8_t buf[1500];
+		buf[0] = 0x80;
+		buf[1] = (marker ? 0x80 : 0) | 96;
+		buf[2] = fSeqNum >> 8; buf[3] = (uint8_t)fSeqNum;
+		buf[4] = timestamp >> 24; buf[5] = timestamp >> 16; buf[6] = timestamp >> 8; buf[7] = (uint8_t)timestamp;
+		buf[8] = 0x12; buf[9] = 0x34; buf[10] = 0x56; buf[11] = 0x78;
+		memcpy(&buf[12], payload, len);
+		fSeqNum++;
+
+		struct sockaddr_in from;
+		memset(&from, 0, sizeof from);
+		fSource.rtpReadHandler((char *)buf, 12 + len, from);
+
+		// After a loss, the source waits for the lost packet a while; then another (here a duplicate) gets it going:
+		if (fLost) {
+			usleep(REORDERING_WAIT);
+			fSource.rtpReadHandler((char *)buf, 12 + len, from);
+			fLost = false;
+		}
+	}
+
+private:
+	RTPSource&	fSource;
+	uint16_t	fSeqNum;
+	bool		fLost;
+};
+
+// Sends a NAL unit in three fragments (FU-A, or FU with "h265"), the first "numLost" of them lost
+static void sendFragments(PacketFeeder &feeder, uint32_t timestamp, bool h265, uint8_t const *nal, int len, int numLost = 0)
+{
+	int headerLen = h265 ? 2 : 1;
+	uint8_t nalUnitType = h265 ? (nal[0]&0x7E)>>1 : nal[0]&0x1F;
+	int pos = headerLen;
+	for (int i = 0; i < 3; i++) {
+		uint8_t fu[64];
+		int fuLen = 0;
+		if (h265) {
+			fu[fuLen++] = (nal[0]&0x81) | (49<<1);
+			fu[fuLen++] = nal[1];
+		} else {
+			fu[fuLen++] = (nal[0]&0xE0) | 28;
+		}
+		fu[fuLen++] = (i == 0 ? 0x80 : 0) | (i == 2 ? 0x40 : 0) | nalUnitType;
+
+		int pieceLen = i < 2 ? (len - headerLen)/3 : len - pos;
+		memcpy(&fu[fuLen], &nal[pos], pieceLen);
+		fuLen += pieceLen;
+		pos += pieceLen;
+
+		if (i < numLost) feeder.lose();
+		else feeder.send(timestamp, i == 2, fu, fuLen);
+	}
+}
+
+// Sends NAL units in one aggregation packet (STAP-A, or AP with "h265")
+static void sendAggregated(PacketFeeder &feeder, uint32_t timestamp, bool h265, uint8_t const **nals, int const *lens, int numNals)
+{
+	uint8_t packet[256];
+	int len = 0;
+	if (h265) {
+		packet[len++] = 48<<1;
+		packet[len++] = 0x01;
+	} else {
+		packet[len++] = 0x78;
+	}
+	for (int i = 0; i < numNals; i++) {
+		packet[len++] = lens[i]>>8;
+		packet[len++] = (uint8_t)lens[i];
+		memcpy(&packet[len], nals[i], lens[i]);
+		len += lens[i];
+	}
+	feeder.send(timestamp, true, packet, len);
+}
+
+// Builds the expected frame: each NAL unit with a start code in front
+class FrameBuilder
+{
+public:
+	FrameBuilder() : fLen(0) {}
+	FrameBuilder& nal(uint8_t const *nal, int len) {
+		static uint8_t const startCode[4] = { 0, 0, 0, 1 };
+		memcpy(&fBuf[fLen], startCode, 4);
+		memcpy(&fBuf[fLen+4], nal, len);
+		fLen += 4 + len;
+		return *this;
+	}
+	bool matches(int frame) {
+		return frame < gNumFrames && gFrames[frame].len == fLen && memcmp(gFrames[frame].buf, fBuf, fLen) == 0;
+	}
+
+private:
+	uint8_t	fBuf[MAX_FRAME_SIZE];
+	int		fLen;
+};
+
+static MediaSubsession* firstSubsession(MediaSession *session)
+{
+	MediaSubsessionIterator iter(*session);
+	return iter.next();
+}
+
+static void testH264()
+{
+	char sdp[512];
+	snprintf(sdp, sizeof sdp, sdpFormat, "H264");
+	MediaSession *session = MediaSession::createNew(sdp);
+	MediaSubsession *subsession = firstSubsession(session);
+	CHECK(subsession != NULL);
+	if (subsession == NULL) return;
+
+	TaskScheduler task;
+	H264RTPSource source(STREAM_TYPE_TCP, *subsession, task);
+	source.setInjectParameterSets(true);
+	source.startNetworkReading(frameHandler, NULL, NULL, NULL, NULL, NULL);
+	PacketFeeder feeder(source);
+	gNumFrames = 0;
+
+	static uint8_t const sps[] = { 0x67, 0x42, 0xC0, 0x1E, 0xDA, 0x02, 0x80 };
+	static uint8_t const pps[] = { 0x68, 0xCE, 0x3C, 0x80 };
+	static uint8_t const idr1[] = { 0x65, 0x88, 0x84, 0x00, 0x11 };
+	static uint8_t const idr2[] = { 0x65, 0x00, 0x42, 0x22, 0x33 };
+	static uint8_t const slice[] = { 0x41, 0x9A, 0x02, 0x44 };
+
+	// 1. A two-slice IDR with in-band SPS/PPS: nothing is injected
+	feeder.send(3000, false, sps, sizeof sps);
+	feeder.send(3000, false, pps, sizeof pps);
+	feeder.send(3000, false, idr1, sizeof idr1);
+	feeder.send(3000, true, idr2, sizeof idr2);
+	CHECK(gNumFrames == 2);
+	CHECK(FrameBuilder().nal(sps, sizeof sps).nal(pps, sizeof pps).nal(idr1, sizeof idr1).matches(0));
+	CHECK(FrameBuilder().nal(idr2, sizeof idr2).matches(1));
+
+	feeder.send(6000, true, slice, sizeof slice);
+	CHECK(gNumFrames == 3);
+	CHECK(FrameBuilder().nal(slice, sizeof slice).matches(2));
+
+	// 2. A two-slice IDR without them: they go in front of the first slice only
+	feeder.send(9000, false, idr1, sizeof idr1);
+	feeder.send(9000, true, idr2, sizeof idr2);
+	CHECK(gNumFrames == 5);
+	CHECK(FrameBuilder().nal(sps, sizeof sps).nal(pps, sizeof pps).nal(idr1, sizeof idr1).matches(3));
+	CHECK(FrameBuilder().nal(idr2, sizeof idr2).matches(4));
+
+	// 3. The same, with each slice in FU-A fragments
+	uint8_t fu[8];
+	fu[0] = 0x7C; fu[1] = 0x85; memcpy(&fu[2], &idr1[1], 2);	// start
+	feeder.send(12000, false, fu, 4);
+	fu[1] = 0x45; memcpy(&fu[2], &idr1[3], 2);					// end
+	feeder.send(12000, false, fu, 4);
+	fu[1] = 0x85; memcpy(&fu[2], &idr2[1], 2);
+	feeder.send(12000, false, fu, 4);
+	fu[1] = 0x45; memcpy(&fu[2], &idr2[3], 2);
+	feeder.send(12000, true, fu, 4);
+	CHECK(gNumFrames == 7);
+	CHECK(FrameBuilder().nal(sps, sizeof sps).nal(pps, sizeof pps).nal(idr1, sizeof idr1).matches(5));
+	CHECK(FrameBuilder().nal(idr2, sizeof idr2).matches(6));
+
+	// 4. SPS, PPS and an IDR slice in one STAP-A (each delivered on its own), then a second slice
+	uint8_t stap[64];
+	int stapLen = 0;
+	stap[stapLen++] = 0x78;
+	stap[stapLen++] = 0; stap[stapLen++] = sizeof sps; memcpy(&stap[stapLen], sps, sizeof sps); stapLen += sizeof sps;
+	stap[stapLen++] = 0; stap[stapLen++] = sizeof pps; memcpy(&stap[stapLen], pps, sizeof pps); stapLen += sizeof pps;
+	stap[stapLen++] = 0; stap[stapLen++] = sizeof idr1; memcpy(&stap[stapLen], idr1, sizeof idr1); stapLen += sizeof idr1;
+	feeder.send(15000, false, stap, stapLen);
+	feeder.send(15000, true, idr2, sizeof idr2);
+	CHECK(gNumFrames == 11);
+	CHECK(FrameBuilder().nal(sps, sizeof sps).matches(7));
+	CHECK(FrameBuilder().nal(pps, sizeof pps).matches(8));
+	CHECK(FrameBuilder().nal(idr1, sizeof idr1).matches(9));
+	CHECK(FrameBuilder().nal(idr2, sizeof idr2).matches(10));
+
+	source.stopNetworkReading();
+	delete session;
+}
+
+static void testH265()
+{
+	char sdp[512];
+	snprintf(sdp, sizeof sdp, sdpFormat, "H265");
+	MediaSession *session = MediaSession::createNew(sdp);
+	MediaSubsession *subsession = firstSubsession(session);
+	CHECK(subsession != NULL);
+	if (subsession == NULL) return;
+
+	TaskScheduler task;
+	H265RTPSource source(STREAM_TYPE_TCP, *subsession, task);
+	source.setInjectParameterSets(true);
+	source.startNetworkReading(frameHandler, NULL, NULL, NULL, NULL, NULL);
+	PacketFeeder feeder(source);
+	gNumFrames = 0;
+
+	static uint8_t const vps[] = { 0x40, 0x01, 0x0C, 0x01, 0xFF };
+	static uint8_t const sps[] = { 0x42, 0x01, 0x01, 0x01, 0x60 };
+	static uint8_t const pps[] = { 0x44, 0x01, 0xC1, 0x72 };
+	static uint8_t const idr1[] = { 0x26, 0x01, 0xAF, 0x06, 0xB8 };		// IDR_W_RADL
+	static uint8_t const idr2[] = { 0x26, 0x01, 0x40, 0x22, 0x33 };
+
+	// 1. A two-slice IDR with in-band VPS/SPS/PPS (each of them is delivered as a frame): nothing is injected
+	feeder.send(3000, false, vps, sizeof vps);
+	feeder.send(3000, false, sps, sizeof sps);
+	feeder.send(3000, false, pps, sizeof pps);
+	feeder.send(3000, false, idr1, sizeof idr1);
+	feeder.send(3000, true, idr2, sizeof idr2);
+	CHECK(gNumFrames == 5);
+	CHECK(FrameBuilder().nal(vps, sizeof vps).matches(0));
+	CHECK(FrameBuilder().nal(sps, sizeof sps).matches(1));
+	CHECK(FrameBuilder().nal(pps, sizeof pps).matches(2));
+	CHECK(FrameBuilder().nal(idr1, sizeof idr1).matches(3));
+	CHECK(FrameBuilder().nal(idr2, sizeof idr2).matches(4));
+
+	// 2. A two-slice IDR without them: they go in front of the first slice only
+	feeder.send(6000, false, idr1, sizeof idr1);
+	feeder.send(6000, true, idr2, sizeof idr2);
+	CHECK(gNumFrames == 7);
+	CHECK(FrameBuilder().nal(vps, sizeof vps).nal(sps, sizeof sps).nal(pps, sizeof pps).nal(idr1, sizeof idr1).matches(5));
+	CHECK(FrameBuilder().nal(idr2, sizeof idr2).matches(6));
+
+	source.stopNetworkReading();
+	delete session;
+}
+
+// The same cases for H.264 and H.265: "parameterSets" are SPS and PPS (or VPS, SPS and PPS), "keyframes" two IDR slices
+static void testKeyframeOnly(RTPSource &source, bool h265, uint8_t const **parameterSets, int const *parameterSetLens,
+	int numParameterSets, uint8_t const **keyframes, int const *keyframeLens, uint8_t const *slice, int sliceLen)
+{
+	source.setKeyframeOnly(true);
+	source.startNetworkReading(frameHandler, NULL, NULL, NULL, NULL, NULL);
+	PacketFeeder feeder(source);
+	gNumFrames = 0;
+
+	// 1. A non-IDR slice in fragments: all of them are dropped
+	sendFragments(feeder, 3000, h265, slice, sliceLen);
+	CHECK(gNumFrames == 0);
+
+	// 2. An IDR slice in fragments is kept, whole
+	sendFragments(feeder, 6000, h265, keyframes[0], keyframeLens[0]);
+	CHECK(gNumFrames == 1);
+	CHECK(FrameBuilder().nal(keyframes[0], keyframeLens[0]).matches(0));
+
+	// 3. The parameter sets and a non-IDR slice aggregated: only the parameter sets come through
+	uint8_t const *nals[4];
+	int lens[4];
+	for (int i = 0; i < numParameterSets; i++) {
+		nals[i] = parameterSets[i];
+		lens[i] = parameterSetLens[i];
+	}
+	nals[numParameterSets] = slice;
+	lens[numParameterSets] = sliceLen;
+	sendAggregated(feeder, 9000, h265, nals, lens, numParameterSets+1);
+	CHECK(gNumFrames == 1 + numParameterSets);
+	for (int i = 0; i < numParameterSets; i++)
+		CHECK(FrameBuilder().nal(parameterSets[i], parameterSetLens[i]).matches(1 + i));
+
+	// 4. An IDR slice; then a non-IDR slice whose start fragment is lost: the rest of it is dropped,
+	// not taken for more of the IDR slice
+	int numFrames = gNumFrames;
+	sendFragments(feeder, 12000, h265, keyframes[0], keyframeLens[0]);
+	sendFragments(feeder, 15000, h265, slice, sliceLen, 1);
+	CHECK(gNumFrames == numFrames + 1);
+	CHECK(FrameBuilder().nal(keyframes[0], keyframeLens[0]).matches(numFrames));
+
+	// 5. An IDR slice without its end, then one without its start (both lost), then a whole one:
+	// only the last one is delivered, and nothing of the others with it
+	numFrames = gNumFrames;
+	uint8_t fu[64];
+	int headerLen = h265 ? 2 : 1;
+	if (h265) {
+		fu[0] = (keyframes[0][0]&0x81) | (49<<1);
+		fu[1] = keyframes[0][1];
+		fu[2] = 0x80 | ((keyframes[0][0]&0x7E)>>1);
+	} else {
+		fu[0] = (keyframes[0][0]&0xE0) | 28;
+		fu[1] = 0x80 | (keyframes[0][0]&0x1F);
+	}
+	memcpy(&fu[headerLen+1], &keyframes[0][headerLen], 1);
+	feeder.send(18000, false, fu, headerLen + 2);		// the start of the first one (the rest is lost)
+	feeder.lose();
+	sendFragments(feeder, 21000, h265, keyframes[1], keyframeLens[1], 1);
+	sendFragments(feeder, 24000, h265, keyframes[1], keyframeLens[1]);
+	CHECK(gNumFrames == numFrames + 1);
+	CHECK(FrameBuilder().nal(keyframes[1], keyframeLens[1]).matches(numFrames));
+
+	source.stopNetworkReading();
+}
+
+static void testH264KeyframeOnly()
+{
+	char sdp[512];
+	snprintf(sdp, sizeof sdp, sdpFormat, "H264");
+	MediaSession *session = MediaSession::createNew(sdp);
+	MediaSubsession *subsession = firstSubsession(session);
+	CHECK(subsession != NULL);
+	if (subsession == NULL) return;
+
+	TaskScheduler task;
+	H264RTPSource source(STREAM_TYPE_TCP, *subsession, task);
+
+	static uint8_t const sps[] = { 0x67, 0x42, 0xC0, 0x1E, 0xDA, 0x02, 0x80 };
+	static uint8_t const pps[] = { 0x68, 0xCE, 0x3C, 0x80 };
+	static uint8_t const idr1[] = { 0x65, 0x88, 0x84, 0x00, 0x11, 0x22, 0x33 };
+	static uint8_t const idr2[] = { 0x65, 0x00, 0x42, 0x22, 0x33, 0x44, 0x55 };
+	static uint8_t const slice[] = { 0x41, 0x9A, 0x02, 0x44, 0x66, 0x77, 0x88 };
+
+	uint8_t const *parameterSets[] = { sps, pps };
+	int parameterSetLens[] = { sizeof sps, sizeof pps };
+	uint8_t const *keyframes[] = { idr1, idr2 };
+	int keyframeLens[] = { sizeof idr1, sizeof idr2 };
+	testKeyframeOnly(source, false, parameterSets, parameterSetLens, 2, keyframes, keyframeLens, slice, sizeof slice);
+
+	delete session;
+}
+
+static void testH265KeyframeOnly()
+{
+	char sdp[512];
+	snprintf(sdp, sizeof sdp, sdpFormat, "H265");
+	MediaSession *session = MediaSession::createNew(sdp);
+	MediaSubsession *subsession = firstSubsession(session);
+	CHECK(subsession != NULL);
+	if (subsession == NULL) return;
+
+	TaskScheduler task;
+	H265RTPSource source(STREAM_TYPE_TCP, *subsession, task);
+
+	static uint8_t const vps[] = { 0x40, 0x01, 0x0C, 0x01, 0xFF };
+	static uint8_t const sps[] = { 0x42, 0x01, 0x01, 0x01, 0x60 };
+	static uint8_t const pps[] = { 0x44, 0x01, 0xC1, 0x72 };
+	static uint8_t const idr1[] = { 0x26, 0x01, 0xAF, 0x06, 0xB8, 0x11, 0x22 };	// IDR_W_RADL
+	static uint8_t const idr2[] = { 0x26, 0x01, 0x40, 0x22, 0x33, 0x44, 0x55 };
+	static uint8_t const slice[] = { 0x02, 0x01, 0xD0, 0x11, 0x22, 0x66, 0x77 };	// TRAIL_R
+
+	uint8_t const *parameterSets[] = { vps, sps, pps };
+	int parameterSetLens[] = { sizeof vps, sizeof sps, sizeof pps };
+	uint8_t const *keyframes[] = { idr1, idr2 };
+	int keyframeLens[] = { sizeof idr1, sizeof idr2 };
+	testKeyframeOnly(source, true, parameterSets, parameterSetLens, 3, keyframes, keyframeLens, slice, sizeof slice);
+
+	delete session;
+}
+
+int main()
+{
+	testH264();
+	testH265();
+	testH264KeyframeOnly();
+	testH265KeyframeOnly();
+
+	return testResult("test_h264_params");
+}
@@ -0,0 +1,128 @@
+// Checks what idle RTSP connections cost the server: NUM_CONNECTIONS clients connect, send an OPTIONS
+// each (which is answered), and then stay; the growth of the process' RSS and address space per
+// connection must stay within a budget. (It has to be fewer than FD_SETSIZE connections, both ends of
+// them in this process, as the server's "TaskScheduler" uses select(); 10,000 can't be tried here.)
+
+#include "RTSPServer.h"
+#include "RTSPCommonEnv.h"
+#include "TestUtil.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define NUM_CONNECTIONS			(400)
+#define RSS_BUDGET_KB			(16)	// per connection
+#define ADDRESS_SPACE_BUDGET_KB	(64)	// per connection (a read buffer of RTSP_READ_BUFFER_MAX_SIZE each would be 1024)
+
+// a "kB" value from /proc/self/status
+static long statusKB(char const *name)
+{
+	FILE *fp = fopen("/proc/self/status", "r");
+	if (fp == NULL) return 0;
+	char line[256];
+	long value = 0;
+	int nameLen = strlen(name);
+	while (fgets(line, sizeof line, fp) != NULL) {
+		if (strncmp(line, name, nameLen) == 0 && line[nameLen] == ':')
+			value = atol(&line[nameLen+1]);
+	}
+	fclose(fp);
+	return value;
+}
+
+// connects, and sends an OPTIONS; returns the socket, or -1
+static int connectTo(unsigned short port)
+{
+	int sock = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof addr);
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (sock >= 0 && connect(sock, (struct sockaddr *)&addr, sizeof addr) < 0) {
+		close(sock);
+		return -1;
+	}
+
+	char request[128];
+	int len = snprintf(request, sizeof request, "OPTIONS rtsp://127.0.0.1:%d/live RTSP/1.0\r\nCSeq: 1\r\n\r\n", port);
+	CHECK(write(sock, request, len) == len);
+	return sock;
+}
+
+static bool readAnswer(int sock)
+{
+	char buf[512];
+	struct timeval timeout = { 5, 0 };
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+	int len = read(sock, buf, sizeof buf - 1);
+	if (len <= 0) return false;
+	buf[len] = '\0';
+	return strncmp(buf, "RTSP/1.0 200 OK", 15) == 0;
+}
+
+int main()
+{
+	RTSPCommonEnv::nDebugFlag = 0;
+	RTSPServer *server = RTSPServer::instance();
+
+	unsigned short port = 0;
+	for (unsigned short p = 18554; p < 18654 && port == 0; p++) {
+		if (server->startServer(p) == 0) port = p;
+	}
+	CHECK(port != 0);
+	if (port == 0) return testResult("test_idle_connections");
+
+	// A first connection, not counted: the server thread's first allocations (e.g. its malloc arena) come with it
+	int firstSock = connectTo(port);
+	CHECK(firstSock >= 0 && readAnswer(firstSock));
+
+	long rssBefore = statusKB("VmRSS"), sizeBefore = statusKB("VmSize");
+
+	int socks[NUM_CONNECTIONS];
+	int numConnected = 0;
+	for (int i = 0; i < NUM_CONNECTIONS; i++) {
+		socks[i] = connectTo(port);
+		if (socks[i] < 0) break;
+		numConnected++;
+	}
+	CHECK(numConnected == NUM_CONNECTIONS);
+
+	// Every connection is answered (and then left idle):
+	int numAnswered = 0;
+	for (int i = 0; i < numConnected; i++) {
+		if (readAnswer(socks[i])) numAnswered++;
+	}
+	CHECK(numAnswered == numConnected);
+
+	long rssKB = statusKB("VmRSS") - rssBefore, sizeKB = statusKB("VmSize") - sizeBefore;
+	double rssPerConnection = numConnected > 0 ? (double)rssKB/numConnected : 0;
+	double sizePerConnection = numConnected > 0 ? (double)sizeKB/numConnected : 0;
+	printf("%d idle connections: RSS %.1f KB, address space %.1f KB per connection\n",
+		numConnected, rssPerConnection, sizePerConnection);
+	CHECK(rssPerConnection <= RSS_BUDGET_KB);
+	CHECK(sizePerConnection <= ADDRESS_SPACE_BUDGET_KB);
+
+	// (The server reports each connection that goes, on stdout:)
+	fflush(stdout);
+	int savedStdout = dup(1);
+	int devNull = open("/dev/null", O_WRONLY);
+	dup2(devNull, 1);
+
+	for (int i = 0; i < numConnected; i++)
+		close(socks[i]);
+	if (firstSock >= 0) close(firstSock);
+	server->stopServer();
+	RTSPServer::destroy();
+
+	fflush(stdout);
+	dup2(savedStdout, 1);
+	close(devNull);
+	close(savedStdout);
+
+	return testResult("test_idle_connections");
+}
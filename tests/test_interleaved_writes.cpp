@@ -0,0 +1,116 @@
+// Checks that what the server writes to a RTSP connection behind a partly sent RTP/TCP frame is kept, not
+// blocked on nor written in the middle of the frame: frames are sent to a client that doesn't read until
+// one is left part way, then RTSP responses are written; once the client reads, the stream it gets must
+// be whole '$' frames, in order, with the responses after them.
+
+#include "MySock.h"
+#include "TestUtil.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define FRAME_SIZE		(60000)	// (bigger than the socket buffer, so that a frame does get left part way)
+#define MAX_STREAM_SIZE	(8*1024*1024)
+
+static unsigned char gStream[MAX_STREAM_SIZE];	// what the client got
+static int gStreamLen = 0;
+
+// the client reads a little (or, with "all", whatever is there)
+static void clientRead(int sock, bool all)
+{
+	do {
+		int room = MAX_STREAM_SIZE - gStreamLen;
+		int len = recv(sock, &gStream[gStreamLen], all || room < 997 ? room : 997, MSG_DONTWAIT);
+		if (len <= 0) break;
+		gStreamLen += len;
+	} while (all);
+}
+
+static void fillFrame(char *frame, unsigned seq)
+{
+	memset(frame, seq&0xFF, FRAME_SIZE);
+	frame[0] = (char)(seq>>8);
+	frame[1] = (char)seq;
+}
+
+int main()
+{
+	// A connection; the client end (blocking, small buffers) doesn't read for now:
+	int listenSock = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof addr);
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t addrLen = sizeof addr;
+	CHECK(bind(listenSock, (struct sockaddr *)&addr, sizeof addr) == 0 && listen(listenSock, 1) == 0);
+	getsockname(listenSock, (struct sockaddr *)&addr, &addrLen);
+
+	int clientSock = socket(AF_INET, SOCK_STREAM, 0);
+	setReceiveBufferTo(clientSock, 4096);
+	CHECK(connect(clientSock, (struct sockaddr *)&addr, sizeof addr) == 0);
+
+	MySock serverSock;
+	CHECK(serverSock.setupClientSock(listenSock, 1) > 0);
+	serverSock.setSendBufferTo(4096);
+
+	// Send frames until one is left part way:
+	char frame[FRAME_SIZE];
+	unsigned numFrames = 0;
+	for (int tries = 0; tries < 1000 && !serverSock.hasPendingFrame(); tries++) {
+		fillFrame(frame, numFrames);
+		if (serverSock.sendRTPOverTCP1(frame, FRAME_SIZE, 0) == 0) numFrames++;
+		else clientRead(clientSock, false);
+	}
+	CHECK(serverSock.hasPendingFrame());
+
+	// Responses now are kept behind the frame, without waiting for it:
+	char const *response1 = "RTSP/1.0 200 OK\r\nCSeq: 10\r\n\r\n";
+	char const *response2 = "RTSP/1.0 200 OK\r\nCSeq: 11\r\n\r\n";
+	double t0 = nowMicros();
+	CHECK(serverSock.writeSocket1((char *)response1, strlen(response1)) == 0);
+	CHECK(serverSock.writeSocket((char *)response2, strlen(response2)) == (int)strlen(response2));
+	CHECK(nowMicros() - t0 < 100000);
+	CHECK(serverSock.hasPendingFrame());
+
+	// Another frame must wait (the caller queues it), and more than fits is refused:
+	fillFrame(frame, numFrames);
+	CHECK(serverSock.sendRTPOverTCP1(frame, FRAME_SIZE, 0) == -1);
+	static char huge[PENDING_BUFFER_MAX_SIZE];
+	CHECK(serverSock.writeSocket1(huge, sizeof huge) == -1);
+
+	// The client reads everything, as the server flushes:
+	for (int tries = 0; tries < 100000; tries++) {
+		int remain = serverSock.flushPendingFrame();
+		CHECK(remain >= 0);
+		clientRead(clientSock, true);
+		if (remain == 0) break;
+	}
+	CHECK(!serverSock.hasPendingFrame());
+	usleep(10000);
+	clientRead(clientSock, true);
+
+	// Whole frames in order, then the two responses:
+	int pos = 0;
+	unsigned seq = 0;
+	while (pos + 4 <= gStreamLen && gStream[pos] == '$') {
+		int len = (gStream[pos+2]<<8)|gStream[pos+3];
+		CHECK(len == FRAME_SIZE && pos + 4 + len <= gStreamLen);
+		if (len != FRAME_SIZE || pos + 4 + len > gStreamLen) break;
+		fillFrame(frame, seq++);
+		CHECK(memcmp(&gStream[pos+4], frame, FRAME_SIZE) == 0);
+		pos += 4 + len;
+	}
+	CHECK(seq == numFrames);	// (with the one left part way)
+
+	int responsesLen = strlen(response1) + strlen(response2);
+	CHECK(gStreamLen - pos == responsesLen);
+	CHECK(memcmp(&gStream[pos], response1, strlen(response1)) == 0);
+	CHECK(memcmp(&gStream[pos+strlen(response1)], response2, strlen(response2)) == 0);
+
+	close(clientSock);
+	closeSocket(listenSock);
+
+	return testResult("test_interleaved_writes");
+}
@@ -0,0 +1,264 @@
+// Checks "RTSPRequestParser" against the requests in "rtsp_requests.txt" (or the file given), each one
+// given whole, a byte at a time in a buffer that moves on every read, and in random pieces; then a few
+// cases that are easier made here: requests back to back, a "Content-Length:" too big for the server,
+// and more headers than "RTSP_MAX_HEADERS".
+
+#include "NetCommon.h"
+#include "RTSPCommon.h"
+#include "TestUtil.h"
+
+#include <string.h>
+
+#define MAX_REQUEST_SIZE	(4096)
+#define MAX_EXPECTS			(16)
+#define MAX_LINE_SIZE		(512)
+
+struct Request {
+	int		lineNum;	// in the corpus file, of its "%%"
+	char	text[MAX_REQUEST_SIZE];
+	int		len;
+	int		headerSize;	// up to and including the empty line
+	char	expects[MAX_EXPECTS][MAX_LINE_SIZE];
+	int		numExpects;
+};
+
+static void chopLine(char *line)
+{
+	int len = strlen(line);
+	while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r')) line[--len] = '\0';
+}
+
+// reads the request after the next "%%" line; returns false at the end of the file
+static bool readRequest(FILE *fp, int &lineNum, Request &request)
+{
+	char line[MAX_LINE_SIZE];
+	bool started = false;
+	while (!started) {
+		if (fgets(line, sizeof line, fp) == NULL) return false;
+		lineNum++;
+		started = strncmp(line, "%%", 2) == 0;
+	}
+
+	request.lineNum = lineNum;
+	request.len = request.headerSize = request.numExpects = 0;
+	char const *lineEnd = "\r\n";
+
+	char lines[64][MAX_LINE_SIZE];
+	int numLines = 0;
+	long pos = ftell(fp);
+	while (fgets(line, sizeof line, fp) != NULL && strncmp(line, "%%", 2) != 0) {
+		lineNum++;
+		pos = ftell(fp);
+		chopLine(line);
+		if (numLines == 0 && line[0] == '#') continue;
+		if (numLines == 0 && line[0] == '?') {
+			if (strcmp(line, "? lf") == 0) lineEnd = "\n";
+			else if (request.numExpects < MAX_EXPECTS) strcpy(request.expects[request.numExpects++], &line[2]);
+			continue;
+		}
+		if (numLines < 64) strcpy(lines[numLines++], line);
+	}
+	fseek(fp, pos, SEEK_SET);	// (back to the next "%%")
+
+	// Each line gets its end, but for a last one that isn't empty (the body):
+	bool sawRequestLine = false;
+	for (int i = 0; i < numLines; i++) {
+		int n = snprintf(&request.text[request.len], MAX_REQUEST_SIZE - request.len, "%s%s",
+			lines[i], i == numLines-1 && lines[i][0] != '\0' ? "" : lineEnd);
+		request.len += n;
+		if (lines[i][0] != '\0') sawRequestLine = true;
+		else if (sawRequestLine && request.headerSize == 0) request.headerSize = request.len;
+	}
+	return true;
+}
+
+static bool fieldIs(RTSPField const &field, char const *value)
+{
+	if (strcmp(value, "-") == 0) return field.len == 0;
+	return field.len == strlen(value) && strncmp(field.str, value, field.len) == 0;
+}
+
+static void checkRequest(Request const &request, RTSPRequestParser &parser, int headerSize, char const *how)
+{
+	int failures = gTestFailures;
+
+	CHECK(headerSize == request.headerSize);
+	for (int i = 0; i < request.numExpects; i++) {
+		char what[MAX_LINE_SIZE], value[MAX_LINE_SIZE];
+		char const *expect = request.expects[i];
+		char const *space = strchr(expect, ' ');
+		if (space == NULL) continue;
+		snprintf(what, sizeof what, "%.*s", (int)(space - expect), expect);
+		snprintf(value, sizeof value, "%s", space+1);
+
+		if (strcmp(what, "valid") == 0) CHECK(parser.isValid() == (atoi(value) != 0));
+		else if (strcmp(what, "method") == 0) CHECK(fieldIs(parser.method(), value));
+		else if (strcmp(what, "pre") == 0) CHECK(fieldIs(parser.urlPreSuffix(), value));
+		else if (strcmp(what, "suffix") == 0) CHECK(fieldIs(parser.urlSuffix(), value));
+		else if (strcmp(what, "cseq") == 0) CHECK(fieldIs(parser.cseq(), value));
+		else if (strcmp(what, "session") == 0) CHECK(fieldIs(parser.sessionId(), value));
+		else if (strcmp(what, "length") == 0) CHECK(parser.contentLength() == (unsigned)atoi(value));
+		else if (strcmp(what, "header") == 0) {
+			char *nameEnd = strchr(value, ' ');
+			if (nameEnd == NULL) continue;
+			*nameEnd = '\0';
+			RTSPField const *field = parser.header(value);
+			if (strcmp(nameEnd+1, "-") == 0) CHECK(field == NULL);
+			else CHECK(field != NULL && fieldIs(*field, nameEnd+1));
+		} else {
+			fprintf(stderr, "request at line %d: unknown \"? %s\"\n", request.lineNum, what);
+			gTestFailures++;
+		}
+	}
+
+	if (gTestFailures > failures)
+		fprintf(stderr, "  (the request at line %d, %s)\n", request.lineNum, how);
+}
+
+static void testWhole(Request const &request)
+{
+	RTSPRequestParser parser;
+	checkRequest(request, parser, parser.parse(request.text, request.len), "whole");
+}
+
+// A byte at a time, as a read might give it; the buffer moves (to the other of two) on every read, as
+// the server's does when it grows, and the parser has to follow it.
+static void testByteByByte(Request const &request)
+{
+	static char bufs[2][MAX_REQUEST_SIZE];
+	RTSPRequestParser parser;
+	int headerSize = 0;
+	char *buf = bufs[0];
+	for (int len = 1; len <= request.len && headerSize == 0; len++) {
+		buf = bufs[len%2];
+		memcpy(buf, request.text, len);
+		memset(bufs[(len+1)%2], 'x', len);	// (what the parser pointed at before is gone)
+		headerSize = parser.parse(buf, len);
+		if (headerSize == 0) CHECK(len < request.headerSize);
+	}
+	checkRequest(request, parser, headerSize, "a byte at a time");
+
+	// Once it is complete, the same (moved) request gives the same answer:
+	memcpy(bufs[0], request.text, request.len);
+	memcpy(bufs[1], request.text, request.len);
+	headerSize = parser.parse(buf == bufs[0] ? bufs[1] : bufs[0], request.len);
+	checkRequest(request, parser, headerSize, "complete, then moved");
+}
+
+static void testRandomPieces(Request const &request)
+{
+	static char buf[MAX_REQUEST_SIZE];
+	for (int round = 0; round < 50; round++) {
+		RTSPRequestParser parser;
+		int len = 0, headerSize = 0;
+		while (len < request.len && headerSize == 0) {
+			len += 1 + rand()%16;
+			if (len > request.len) len = request.len;
+			memcpy(buf, request.text, len);
+			headerSize = parser.parse(buf, len);
+		}
+		checkRequest(request, parser, headerSize, "in random pieces");
+	}
+}
+
+static void testBackToBack()
+{
+	char const *requests =
+		"OPTIONS rtsp://h/live RTSP/1.0\r\nCSeq: 1\r\n\r\n"
+		"SET_PARAMETER rtsp://h/live RTSP/1.0\r\nCSeq: 2\r\nContent-Length: 4\r\n\r\nabcd"
+		"GET_PARAMETER rtsp://h/live RTSP/1.0\r\nCSeq: 3\r\n\r\n";
+	int len = strlen(requests);
+
+	// The server hands the parser whatever is left after each request it has handled, after a "reset()":
+	RTSPRequestParser parser;
+	char const *cseqs[] = { "1", "2", "3" };
+	int pos = 0;
+	for (int i = 0; i < 3; i++) {
+		parser.reset();
+		int headerSize = parser.parse(&requests[pos], len - pos);
+		CHECK(headerSize > 0);
+		CHECK(parser.isValid());
+		CHECK(fieldIs(parser.cseq(), cseqs[i]));
+		pos += headerSize + parser.contentLength();
+	}
+	CHECK(pos == len);
+}
+
+static void testContentLength()
+{
+	RTSPRequestParser parser;
+
+	// Too big for the server to wait for (it drops the connection); it must not wrap around to something small:
+	char const *huge = "SET_PARAMETER rtsp://h/live RTSP/1.0\r\nCSeq: 1\r\nContent-Length: 4294967297\r\n\r\n";
+	CHECK(parser.parse(huge, strlen(huge)) == (int)strlen(huge));
+	CHECK(parser.contentLength() >= 0x10000000);
+
+	parser.reset();
+	char const *longer = "SET_PARAMETER rtsp://h/live RTSP/1.0\r\nCSeq: 1\r\nContent-Length: 99999999999999999999\r\n\r\n";
+	CHECK(parser.parse(longer, strlen(longer)) > 0);
+	CHECK(parser.contentLength() >= 0x10000000);
+
+	parser.reset();
+	char const *bad = "SET_PARAMETER rtsp://h/live RTSP/1.0\r\nCSeq: 1\r\nContent-Length: x12\r\n\r\n";
+	CHECK(parser.parse(bad, strlen(bad)) > 0);
+	CHECK(parser.contentLength() == 0);
+}
+
+static void testManyHeaders()
+{
+	// "RTSP_MAX_HEADERS" + 8 headers before "CSeq:", "Session:" and "Content-Length:"
+	char request[MAX_REQUEST_SIZE];
+	int len = snprintf(request, sizeof request, "PLAY rtsp://h/live RTSP/1.0\r\n");
+	for (int i = 0; i < RTSP_MAX_HEADERS + 8; i++)
+		len += snprintf(&request[len], sizeof request - len, "X-Header-%d: value %d\r\n", i, i);
+	len += snprintf(&request[len], sizeof request - len, "CSeq: 42\r\nSession: 77\r\nContent-Length: 3\r\n\r\nabc");
+
+	RTSPRequestParser parser;
+	CHECK(parser.parse(request, len) == len - 3);
+
+	// The headers every request needs are still picked out...
+	CHECK(parser.isValid());
+	CHECK(fieldIs(parser.cseq(), "42"));
+	CHECK(fieldIs(parser.sessionId(), "77"));
+	CHECK(parser.contentLength() == 3);
+
+	// ...but only the first "RTSP_MAX_HEADERS" can be looked up:
+	char name[32];
+	snprintf(name, sizeof name, "X-Header-%d", RTSP_MAX_HEADERS-1);
+	RTSPField const *field = parser.header(name);
+	CHECK(field != NULL);
+	char value[32];
+	snprintf(value, sizeof value, "value %d", RTSP_MAX_HEADERS-1);
+	CHECK(field != NULL && fieldIs(*field, value));
+	snprintf(name, sizeof name, "X-Header-%d", RTSP_MAX_HEADERS);
+	CHECK(parser.header(name) == NULL);
+	CHECK(parser.header("CSeq") == NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	char const *corpus = argc > 1 ? argv[1] : "rtsp_requests.txt";
+	FILE *fp = fopen(corpus, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "test_rtsp_parser: can't open %s\n", corpus);
+		return 1;
+	}
+
+	srand(1);
+	static Request request;
+	int lineNum = 0, numRequests = 0;
+	while (readRequest(fp, lineNum, request)) {
+		testWhole(request);
+		testByteByByte(request);
+		testRandomPieces(request);
+		numRequests++;
+	}
+	fclose(fp);
+	CHECK(numRequests > 0);
+
+	testBackToBack();
+	testContentLength();
+	testManyHeaders();
+
+	return testResult("test_rtsp_parser");
+}
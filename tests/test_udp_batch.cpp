@@ -0,0 +1,122 @@
+// Checks "writeSocketBatch()": every address gets the datagram, in batches of any size, and when a
+// destination fails part way, the count returned covers exactly the addresses before it.
+
+#include "SockCommon.h"
+#include "TestUtil.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#define NUM_RECEIVERS	(4)
+
+static int gReceivers[NUM_RECEIVERS];
+static struct sockaddr_in gReceiverAddrs[NUM_RECEIVERS];
+
+static void setupReceivers()
+{
+	for (int i = 0; i < NUM_RECEIVERS; i++) {
+		gReceivers[i] = setupDatagramSock(0, 1);
+		setReceiveBufferTo(gReceivers[i], 1024*1024);
+
+		socklen_t len = sizeof gReceiverAddrs[i];
+		getsockname(gReceivers[i], (struct sockaddr *)&gReceiverAddrs[i], &len);
+		gReceiverAddrs[i].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	}
+}
+
+// returns the number of datagrams waiting at receiver "i" (and reads them), checking their contents
+static int drain(int i, char const *expected, int expectedLen)
+{
+	char buf[2048];
+	int count = 0;
+	while (1) {
+		int len = recv(gReceivers[i], buf, sizeof buf, 0);
+		if (len < 0) break;
+		CHECK(len == expectedLen && memcmp(buf, expected, len) == 0);
+		count++;
+	}
+	return count;
+}
+
+static void testAllSent(int sender, int numAddresses)
+{
+	char packet[1316];
+	memset(packet, numAddresses, sizeof packet);
+
+	struct sockaddr_in *addrs = new struct sockaddr_in[numAddresses];
+	for (int i = 0; i < numAddresses; i++)
+		addrs[i] = gReceiverAddrs[i%NUM_RECEIVERS];
+
+	CHECK(writeSocketBatch(sender, packet, sizeof packet, addrs, numAddresses) == numAddresses);
+	usleep(10000);
+
+	for (int i = 0; i < NUM_RECEIVERS; i++) {
+		int expected = numAddresses/NUM_RECEIVERS + (i < numAddresses%NUM_RECEIVERS ? 1 : 0);
+		CHECK(drain(i, packet, sizeof packet) == expected);
+	}
+
+	delete[] addrs;
+}
+
+static void testPartial(int sender)
+{
+	// A broadcast address fails (EACCES, as the socket doesn't have SO_BROADCAST):
+	struct sockaddr_in bad;
+	memset(&bad, 0, sizeof bad);
+	bad.sin_family = AF_INET;
+	bad.sin_addr.s_addr = htonl(INADDR_BROADCAST);
+	bad.sin_port = gReceiverAddrs[0].sin_port;
+
+	char packet[200];
+	memset(packet, 0x5A, sizeof packet);
+
+	// "bad" in the middle: the addresses before it are sent to, the ones after it are not
+	struct sockaddr_in addrs[5] = { gReceiverAddrs[0], gReceiverAddrs[1], bad, gReceiverAddrs[2], gReceiverAddrs[3] };
+	CHECK(writeSocketBatch(sender, packet, sizeof packet, addrs, 5) == 2);
+	usleep(10000);
+	CHECK(drain(0, packet, sizeof packet) == 1);
+	CHECK(drain(1, packet, sizeof packet) == 1);
+	CHECK(drain(2, packet, sizeof packet) == 0);
+	CHECK(drain(3, packet, sizeof packet) == 0);
+
+	// The caller goes on one by one from there ("ServerMediaSubsession::sendUdpBatch()"), then batches the rest:
+	CHECK(writeSocket(sender, packet, sizeof packet, addrs[2]) < 0);
+	CHECK(writeSocketBatch(sender, packet, sizeof packet, &addrs[3], 2) == 2);
+	usleep(10000);
+	CHECK(drain(2, packet, sizeof packet) == 1);
+	CHECK(drain(3, packet, sizeof packet) == 1);
+
+	// "bad" first: nothing is sent
+	struct sockaddr_in addrs2[2] = { bad, gReceiverAddrs[0] };
+	CHECK(writeSocketBatch(sender, packet, sizeof packet, addrs2, 2) == -1);
+	usleep(10000);
+	CHECK(drain(0, packet, sizeof packet) == 0);
+
+	// "bad" after the first batch of 64: the first batch counts
+	struct sockaddr_in addrs3[70];
+	for (int i = 0; i < 70; i++) addrs3[i] = gReceiverAddrs[0];
+	addrs3[66] = bad;
+	CHECK(writeSocketBatch(sender, packet, sizeof packet, addrs3, 70) == 66);
+	usleep(10000);
+	CHECK(drain(0, packet, sizeof packet) == 66);
+}
+
+int main()
+{
+	setupReceivers();
+	int sender = setupDatagramSock(0, 1);
+	CHECK(sender >= 0);
+
+	testAllSent(sender, 1);
+	testAllSent(sender, 3);
+	testAllSent(sender, 64);
+	testAllSent(sender, 65);
+	testAllSent(sender, 200);
+	testPartial(sender);
+
+	closeSocket(sender);
+	for (int i = 0; i < NUM_RECEIVERS; i++)
+		closeSocket(gReceivers[i]);
+
+	return testResult("test_udp_batch");
+}